@@ -0,0 +1,121 @@
+# Times writing the glTF with the streaming json writer against the old tinygltf path.
+# Run from the scripts folder after building: python benchmark_writer.py [objects] [grid size]
+# Only the write step is compared: the export's own [PROFILE] lines for WriteGltfFile and
+# WriteGltfSceneToFile are what to look at, the total includes adding the objects.
+# Both streaming outputs are read back and compared to the tinygltf output, the script fails when they
+# aren't the same scene.
+
+import base64
+import json
+import os
+import struct
+import sys
+import tempfile
+import time
+import urllib.parse
+
+import numpy as np
+
+import glTFCompL
+
+
+def make_grid(name, n):
+    # n*n quads, with per loop normals and uvs like blender hands them over
+    xs, ys = np.meshgrid(np.linspace(0, 1, n + 1), np.linspace(0, 1, n + 1))
+    vertices = np.stack([xs.ravel(), ys.ravel(), np.zeros(xs.size)], axis=1).astype(np.float32)
+
+    quads = np.arange((n + 1) * n).reshape(n, n + 1)[:, :n].ravel()
+    a, b, c, d = quads, quads + 1, quads + n + 1, quads + n + 2
+    indices = np.stack([a, b, d, a, d, c], axis=1).ravel().astype(np.uint32)
+
+    normals = np.tile(np.array([0, 0, 1], dtype=np.float32), (len(indices), 1))
+    uvs = vertices[indices][:, :2].copy()
+    return {"vertices": vertices, "normals": normals, "indices": indices,
+            "uvs": uvs, "materials": [], "name": name}
+
+
+def load_gltf(path):
+    # the json and the bytes of every buffer, from data uris, .bin files or the BIN chunk of a glb
+    with open(path, "rb") as f:
+        data = f.read()
+    chunk = b""
+    if path.lower().endswith(".glb"):
+        json_length = struct.unpack_from("<I", data, 12)[0]
+        document = json.loads(data[20:20 + json_length])
+        offset = 20 + json_length
+        if offset + 8 <= len(data):
+            chunk = data[offset + 8:offset + 8 + struct.unpack_from("<I", data, offset)[0]]
+    else:
+        document = json.loads(data)
+
+    buffers = []
+    for buffer in document.get("buffers", []):
+        uri = buffer.pop("uri", None)
+        if uri is None:
+            content = chunk
+        elif uri.startswith("data:"):
+            content = base64.b64decode(uri.split(",", 1)[1])
+        else:
+            with open(os.path.join(os.path.dirname(path), urllib.parse.unquote(uri)), "rb") as f:
+                content = f.read()
+        buffers.append(content[:buffer["byteLength"]])
+    # only where the bytes are stored differs between the writers
+    for image in document.get("images", []):
+        image.pop("uri", None)
+    return document, buffers
+
+
+def compare_gltf(path_a, path_b):
+    # the top level parts that differ, the buffers by their bytes
+    document_a, buffers_a = load_gltf(path_a)
+    document_b, buffers_b = load_gltf(path_b)
+    differences = [key for key in sorted(set(document_a) | set(document_b))
+                   if document_a.get(key) != document_b.get(key)]
+    if buffers_a != buffers_b:
+        differences.append("buffer data")
+    return differences
+
+
+def run(directory, filename, objects, streaming):
+    directory = os.path.join(directory, os.path.splitext(filename)[0])
+    os.makedirs(directory)
+    filepath = os.path.join(directory, filename)
+    session = glTFCompL.ExportSession(directory, filepath, False, 7, False, 100, False,
+                                      streaming_json=streaming)
+    for mesh in objects:
+        session.add_object(mesh, [])
+
+    start = time.perf_counter()
+    ok = session.finish()
+    elapsed = time.perf_counter() - start
+
+    size = sum(os.path.getsize(os.path.join(directory, f)) for f in os.listdir(directory))
+    return ok, elapsed, size, filepath
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+    grid = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+    objects = [make_grid("Object.%05d" % i, grid) for i in range(count)]
+
+    print("%d objects, %d threads" % (count, glTFCompL.GetThreadCount()))
+    same = True
+    with tempfile.TemporaryDirectory() as directory:
+        reference = None
+        for label, filename, streaming in (("tinygltf", "old.gltf", False),
+                                           ("streaming", "new.gltf", True),
+                                           ("streaming glb", "glb.glb", True)):
+            ok, elapsed, size, filepath = run(directory, filename, objects, streaming)
+            print("%-14s ok=%s finish %.3f s, %.1f MB on disk" % (label, ok, elapsed, size / (1024 * 1024)))
+            if reference is None:
+                reference = filepath
+                continue
+            differences = compare_gltf(reference, filepath)
+            if differences:
+                print("%-14s differs from tinygltf in: %s" % (label, ", ".join(differences)))
+                same = False
+    return 0 if same else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -14,6 +14,9 @@ import bpy
 import numpy as np
 import bmesh
 
+# export session kept between exports, see execute
+_session = None
+
 # try to load the custom C++ module
 def load_glTFCompL_module():
     folderpath = os.path.dirname(__file__)
@@ -22,11 +25,125 @@ def load_glTFCompL_module():
     import glTFCompL as m
     return m
 
+def column_major(matrix):
+    return [matrix[row][col] for col in range(4) for row in range(4)]
+
+def decompose(matrix):
+    translation, rotation, scale = matrix.decompose()
+    return list(translation), [rotation.x, rotation.y, rotation.z, rotation.w], list(scale)
+
+def ordered_bones(armature):
+    # parents before their children, the native side links the joints up in one go
+    bones = []
+    def visit(bone):
+        bones.append(bone)
+        for child in bone.children:
+            visit(child)
+    for bone in armature.data.bones:
+        if bone.parent is None:
+            visit(bone)
+    return bones
+
+def extract_skin(obj, armature, mesh):
+    bones = ordered_bones(armature)
+    bone_index = {bone.name: i for i, bone in enumerate(bones)}
+    joints = []
+    for bone in bones:
+        rest = bone.matrix_local if bone.parent is None else bone.parent.matrix_local.inverted() @ bone.matrix_local
+        translation, rotation, scale = decompose(rest)
+        joints.append({
+            'name': bone.name,
+            'parent': bone_index[bone.parent.name] if bone.parent else -1,
+            'translation': translation,
+            'rotation': rotation,
+            'scale': scale,
+        })
+    # the mesh is in its own object space, the joints in the armature's
+    mesh_to_armature = armature.matrix_world.inverted() @ obj.matrix_world
+    inverse_bind = np.array([column_major(bone.matrix_local.inverted() @ mesh_to_armature) for bone in bones], dtype=np.float32)
+
+    # the 4 heaviest bone groups of every vertex, repeated per loop like the other attributes
+    group_joint = {i: bone_index.get(group.name, -1) for i, group in enumerate(obj.vertex_groups)}
+    vertex_joints = np.zeros((len(mesh.vertices), 4), dtype=np.uint16)
+    vertex_weights = np.zeros((len(mesh.vertices), 4), dtype=np.float32)
+    for v in mesh.vertices:
+        influences = sorted(((g.weight, group_joint.get(g.group, -1)) for g in v.groups if group_joint.get(g.group, -1) >= 0), reverse=True)[:4]
+        for i, (weight, joint) in enumerate(influences):
+            vertex_joints[v.index, i] = joint
+            vertex_weights[v.index, i] = weight
+    loop_vertices = np.array([loop.vertex_index for loop in mesh.loops], dtype=np.int64)
+    return joints, inverse_bind, vertex_joints[loop_vertices], vertex_weights[loop_vertices], bones
+
+def extract_animation(armature, bones):
+    # samples every frame of the armature's action, the native side drops the keys it can interpolate
+    action = armature.animation_data.action if armature.animation_data else None
+    if action is None:
+        return []
+    scene = bpy.context.scene
+    fps = scene.render.fps / scene.render.fps_base
+    first, last = int(action.frame_range[0]), int(action.frame_range[1])
+    frames = list(range(first, last + 1))
+    keys = {bone.name: ([], [], []) for bone in bones}
+    current = scene.frame_current
+    try:
+        for frame in frames:
+            scene.frame_set(frame)
+            for bone in bones:
+                pose_bone = armature.pose.bones[bone.name]
+                rest = bone.matrix_local if bone.parent is None else bone.parent.matrix_local.inverted() @ bone.matrix_local
+                translation, rotation, scale = decompose(rest @ pose_bone.matrix_basis)
+                rotations = keys[bone.name][1]
+                if rotations and np.dot(rotations[-1], rotation) < 0.0:
+                    # the shorter way around to the next key
+                    rotation = [-r for r in rotation]
+                keys[bone.name][0].append(translation)
+                rotations.append(rotation)
+                keys[bone.name][2].append(scale)
+    finally:
+        scene.frame_set(current)
+
+    times = np.array([(frame - first) / fps for frame in frames], dtype=np.float32)
+    channels = []
+    for i, bone in enumerate(bones):
+        for path, values in zip(('translation', 'rotation', 'scale'), keys[bone.name]):
+            channels.append({'joint': i, 'path': path, 'times': times, 'values': np.array(values, dtype=np.float32).ravel()})
+    return [{'name': action.name, 'channels': channels}]
+
+def extract_point_cloud(obj, mesh):
+    # foreach_get instead of a loop over the points, scans have millions of them
+    vertices = np.empty(len(mesh.vertices) * 3, dtype=np.float32)
+    mesh.vertices.foreach_get("co", vertices)
+    data = {'vertices': vertices.reshape(-1, 3), 'name': obj.name, 'point_cloud': True}
+    color_layer = mesh.color_attributes.active_color if hasattr(mesh, "color_attributes") else None
+    if color_layer and color_layer.domain == 'POINT':
+        colors = np.empty(len(mesh.vertices) * 4, dtype=np.float32)
+        color_layer.data.foreach_get("color", colors)
+        data['colors'] = colors.reshape(-1, 4)
+    return data
+
+
 def extract_data(obj):
+    # a skinned mesh goes out in its rest pose, the pose is in the animation
+    armature = obj.find_armature()
+    pose_position = None
+    if armature:
+        pose_position = armature.data.pose_position
+        armature.data.pose_position = 'REST'
+        bpy.context.view_layer.update()
+
     depsgraph = bpy.context.evaluated_depsgraph_get()
     obj_eval = obj.evaluated_get(depsgraph)
     mesh = obj_eval.to_mesh()
 
+    if obj.type == 'MESH' and not mesh.polygons and mesh.vertices:
+        # vertices without faces are a point cloud
+        try:
+            return extract_point_cloud(obj, mesh)
+        finally:
+            obj_eval.to_mesh_clear()
+            if armature:
+                armature.data.pose_position = pose_position
+
     if obj.type == 'MESH':
         try:
             bm = bmesh.new()
@@ -47,6 +164,20 @@ def extract_data(obj):
                 uv_layer = mesh.uv_layers.active.data
                 uvs = np.array([(uv.uv.x, uv.uv.y) for uv in uv_layer], dtype=np.float32)
 
+            # the other uv layers go in as TEXCOORD_1 and up
+            uv_sets = [np.array([(uv.uv.x, uv.uv.y) for uv in layer.data], dtype=np.float32)
+                       for layer in mesh.uv_layers if layer != mesh.uv_layers.active]
+
+            # vertex colors per loop, linear rgba
+            colors = None
+            color_layer = mesh.color_attributes.active_color if hasattr(mesh, "color_attributes") else None
+            if color_layer:
+                layer_colors = [c.color[:] for c in color_layer.data]
+                if color_layer.domain == 'POINT':
+                    colors = np.array([layer_colors[loop.vertex_index] for loop in mesh.loops], dtype=np.float32)
+                else:
+                    colors = np.array(layer_colors, dtype=np.float32)
+
             materials = []
             for mat in mesh.materials:
                 if mat:
@@ -57,17 +188,36 @@ def extract_data(obj):
                         'roughness': getattr(mat, "roughness", 0.5),
                     })
 
-            return {
+            data = {
                 'vertices': vertices,
                 'normals': normals,
                 'indices': indices,
                 'uvs': uvs,
+                'uv_sets': uv_sets,
+                'colors': colors,
                 'materials': materials,
                 'name': obj.name
             }
+            # shape keys as morph targets, moved by what the key moves from the reference key
+            shape_keys = obj.data.shape_keys
+            if shape_keys and len(shape_keys.key_blocks) > 1 and len(shape_keys.reference_key.data) == len(mesh.vertices):
+                reference = np.array([point.co[:] for point in shape_keys.reference_key.data], dtype=np.float32)
+                data['morph_targets'] = [{
+                    'name': key.name,
+                    'positions': vertices + np.array([point.co[:] for point in key.data], dtype=np.float32) - reference,
+                } for key in shape_keys.key_blocks if key != shape_keys.reference_key]
+            if armature:
+                joints, inverse_bind, loop_joints, loop_weights, bones = extract_skin(obj, armature, mesh)
+                data['skin'] = {'joints': joints, 'inverse_bind_matrices': inverse_bind}
+                data['joints'] = loop_joints
+                data['weights'] = loop_weights
+                data['animations'] = extract_animation(armature, bones)
+            return data
 
         finally:
             obj_eval.to_mesh_clear()
+            if armature:
+                armature.data.pose_position = pose_position
     return None
 
 def get_texture_data(obj):
@@ -156,6 +306,20 @@ class EXPORT_SCENE_OT_compgltf(bpy.types.Operator):
         default=False,
     )
 
+    thread_count: bpy.props.IntProperty(
+        name="Threads",
+        description="Worker threads used for exporting (0 = one per core)",
+        default=0,
+        min=0, max=256,
+    )
+
+    memory_budget: bpy.props.IntProperty(
+        name="Memory Budget (MB)",
+        description="Memory the export may use for textures and meshes in flight (0 = no limit)",
+        default=0,
+        min=0,
+    )
+
     def execute(self, context):
         # Load compression module
         try:
@@ -164,33 +328,99 @@ class EXPORT_SCENE_OT_compgltf(bpy.types.Operator):
             self.report({'ERROR'}, f"Could not import glTFCompL: {e}")
             return {'CANCELLED'}
 
+        if not m.SetThreadCount(self.thread_count):
+            # an earlier export is still finishing on the pool
+            self.report({'WARNING'}, f"Export still running, keeping {m.GetThreadCount()} threads")
+
         objects = context.selected_objects if self.export_selected else context.scene.objects
         export_folder = os.path.dirname(self.filepath)
         os.makedirs(export_folder, exist_ok=True)
 
-        for obj in objects:
-            # only export meshes
-            if obj.type != "MESH":
-                continue
-
-            mesh_data = extract_data(obj)
-            if not mesh_data:
-                continue
-            textures = get_texture_data(obj)
-
-            # pass data to compression module
-            m.ReadBlenderData(
-                mesh_data,
-                export_folder,
-                self.filepath,
-                textures,
-                self.use_draco,
-                self.draco_level,
-                self.use_jpeg,
-                self.jpeg_quality,
-                self.use_zip,
-            )
+        # Extraction needs bpy so it runs on this thread, one object per timer tick.
+        # Every extracted object goes straight to the native session which compresses it
+        # in the background while we extract the next one.
+        self._objects = [obj for obj in objects if obj.type == "MESH"]
+        if not self._objects:
+            self.report({'WARNING'}, "Nothing to export")
+            return {'CANCELLED'}
+
+        settings = (
+            export_folder,
+            self.filepath,
+            self.use_draco,
+            self.draco_level,
+            self.use_jpeg,
+            self.jpeg_quality,
+            self.use_zip,
+        )
+        # Reuse the session of the previous export, its caches make re-exporting unchanged objects cheap
+        global _session
+        try:
+            if _session is None:
+                raise RuntimeError
+            _session.begin(*settings, memory_budget_mb=self.memory_budget)
+        except RuntimeError:
+            # first export, or the last one was cancelled halfway
+            _session = m.ExportSession(*settings, memory_budget_mb=self.memory_budget)
+        self._session = _session
+        self._job = None
+        self._total = len(self._objects)
+
+        wm = context.window_manager
+        wm.progress_begin(0, 1)
+        self._timer = wm.event_timer_add(0.01, window=context.window)
+        wm.modal_handler_add(self)
+        return {'RUNNING_MODAL'}
+
+    def _extract_next(self):
+        obj = self._objects.pop(0)
+        mesh_data = extract_data(obj)
+        if not mesh_data:
+            return
+        if mesh_data.get('point_cloud'):
+            self._session.add_point_cloud(mesh_data)
+            return
+        textures = get_texture_data(obj)
+        # pass data to compression module
+        self._session.add_object(mesh_data, textures)
+
+    def _finish(self, context):
+        wm = context.window_manager
+        wm.event_timer_remove(self._timer)
+        wm.progress_end()
+
+    def modal(self, context, event):
+        if event.type == 'ESC':
+            self._session.cancel()
+            if self._job:
+                self._job.wait()
+            self._finish(context)
+            self.report({'WARNING'}, "Export cancelled")
+            return {'CANCELLED'}
+
+        if event.type != 'TIMER':
+            # keep the rest of blender usable while we export
+            return {'PASS_THROUGH'}
+
+        if self._objects:
+            self._extract_next()
+            if not self._objects:
+                self._job = self._session.finish_async()
+            context.window_manager.progress_update(self._session.progress())
+            return {'PASS_THROUGH'}
 
+        context.window_manager.progress_update(self._job.progress())
+        if not self._job.done():
+            return {'PASS_THROUGH'}
+
+        self._finish(context)
+        if not self._job.succeeded():
+            self.report({'ERROR'}, f"Export failed: {self._job.error()}")
+            return {'CANCELLED'}
+
+        cleanup = self._session.cleanup_stats()
+        if any(cleanup.values()):
+            print("glTFComp cleanup:", ", ".join(f"{count} {what.replace('_', ' ')}" for what, count in cleanup.items()))
         self.report({'INFO'}, f"Export complete: {self.filepath}")
         return {'FINISHED'}
 
@@ -226,6 +456,11 @@ class EXPORT_SCENE_OT_compgltf(bpy.types.Operator):
         box.separator()
         box.prop(self, "use_zip")
 
+        box = layout.box()
+        box.label(text="Performance:")
+        box.prop(self, "thread_count")
+        box.prop(self, "memory_budget")
+
 
 # manditory plugin functions
 def menu_func_export(self, context):
@@ -0,0 +1,120 @@
+#include "animation.h"
+
+//stl
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+    // glTF's slerp, along the shorter way around
+    void Slerp(const float* a, const float* b, float t, float out[4])
+    {
+        float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+        float sign = dot < 0.0f ? -1.0f : 1.0f;
+        dot = std::fabs(dot);
+
+        float wa = 1.0f - t;
+        float wb = t;
+        if (dot < 0.9995f)
+        {
+            // close ones are lerped, the angle is too small to divide by
+            float angle = std::acos(dot);
+            float s = std::sin(angle);
+            wa = std::sin(wa * angle) / s;
+            wb = std::sin(wb * angle) / s;
+        }
+        float length = 0.0f;
+        for (int i = 0; i < 4; i++)
+        {
+            out[i] = a[i] * wa + b[i] * wb * sign;
+            length += out[i] * out[i];
+        }
+        length = std::sqrt(length);
+        for (int i = 0; i < 4 && length > 0.0f; i++)
+        {
+            out[i] /= length;
+        }
+    }
+
+    bool Within(const float* a, const float* b, int components, float tolerance, bool rotation)
+    {
+        bool same = true;
+        bool flipped = rotation;
+        for (int i = 0; i < components; i++)
+        {
+            same = same && std::fabs(a[i] - b[i]) <= tolerance;
+            flipped = flipped && std::fabs(a[i] + b[i]) <= tolerance;
+        }
+        return same || flipped;
+    }
+}
+
+int KeyComponents(const AnimationChannelData& channel)
+{
+    return channel.path == "rotation" ? 4 : 3;
+}
+
+size_t ReduceKeyframes(AnimationChannelData& channel, float tolerance)
+{
+    int components = KeyComponents(channel);
+    size_t count = std::min(channel.times.size(), channel.values.size() / components);
+    bool step = channel.interpolation == "STEP";
+    if (count < 3 || tolerance <= 0.0f || (!step && channel.interpolation != "LINEAR"))
+    {
+        return 0;
+    }
+    bool rotation = components == 4;
+    const float* times = channel.times.data();
+    const float* values = channel.values.data();
+
+    // does the segment from key a to key b give back key k?
+    auto interpolates = [&](size_t a, size_t b, size_t k) {
+        const float* key = values + k * components;
+        if (step)
+        {
+            return Within(values + a * components, key, components, tolerance, rotation);
+        }
+        float span = times[b] - times[a];
+        float t = span > 0.0f ? (times[k] - times[a]) / span : 0.0f;
+        float interpolated[4];
+        if (rotation)
+        {
+            Slerp(values + a * components, values + b * components, t, interpolated);
+        }
+        else
+        {
+            for (int i = 0; i < components; i++)
+            {
+                interpolated[i] = values[a * components + i] * (1.0f - t) + values[b * components + i] * t;
+            }
+        }
+        return Within(interpolated, key, components, tolerance, rotation);
+    };
+
+    // Greedy: the segment from the last kept key grows while it still gives back every key it skips
+    std::vector<size_t> kept = { 0 };
+    for (size_t i = 1; i + 1 < count; i++)
+    {
+        size_t from = kept.back();
+        bool fits = true;
+        for (size_t k = from + 1; k <= i && fits; k++)
+        {
+            fits = interpolates(from, i + 1, k);
+        }
+        if (!fits)
+        {
+            kept.push_back(i);
+        }
+    }
+    kept.push_back(count - 1);
+
+    for (size_t n = 0; n < kept.size(); n++)
+    {
+        channel.times[n] = channel.times[kept[n]];
+        std::copy_n(channel.values.begin() + kept[n] * components, components, channel.values.begin() + n * components);
+    }
+    channel.times.resize(kept.size());
+    channel.values.resize(kept.size() * components);
+    return count - kept.size();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <cstddef>
+
+// Keyframe reduction: drops the keys of a LINEAR or STEP channel that the keys left around them give back within
+// tolerance, per component. Rotations are compared after slerp, and q and -q count as the same rotation.
+// The first and last key always stay, CUBICSPLINE channels are left alone. Returns how many keys were dropped
+size_t ReduceKeyframes(AnimationChannelData& channel, float tolerance);
+
+// Components per key of a channel's path: 4 for a rotation, 3 otherwise
+int KeyComponents(const AnimationChannelData& channel);
@@ -0,0 +1,483 @@
+#include "batch_convert.h"
+#include "export_cache.h"
+#include "gltf_optimizer.h"
+#include "task_scheduler.h"
+
+//tinygltf, only for URIDecode. The json parser is the one tinygltf uses
+#include "../external/tinygltf/json.hpp"
+#include "../external/tinygltf/tiny_gltf.h"
+
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <unistd.h>
+#endif
+
+//stl
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct JournalEntry
+    {
+        uint64_t inputHash = 0;
+        uint64_t settingsHash = 0;
+        uint64_t inputSize = 0;
+        int64_t inputTime = 0;
+        uint64_t outputSize = 0;
+        double seconds = 0.0;
+    };
+
+    struct BatchFile
+    {
+        fs::path input;
+        fs::path output;
+        std::string key; // path relative to the input directory, what the journal knows it by
+        std::vector<fs::path> references; // .bin files and images the input points at, they are part of it
+        uint64_t size = 0; // of the input and its references together
+        int64_t time = 0; // modification time of the input, folded with the ones of its references
+    };
+
+    size_t PhysicalMemory()
+    {
+#ifdef _WIN32
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+        return GlobalMemoryStatusEx(&status) ? static_cast<size_t>(status.ullTotalPhys) : 0;
+#else
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGE_SIZE);
+        return pages > 0 && pageSize > 0 ? static_cast<size_t>(pages) * static_cast<size_t>(pageSize) : 0;
+#endif
+    }
+
+    // Everything that changes the output, the paths aren't in it. The format name changes with the layout of the
+    // output, so journals of glbs with their textures next to them convert again
+    uint64_t SettingsHash(const ExportSettings& settings)
+    {
+        uint64_t hash = HashString("glb embedded images", HashBytes(nullptr, 0));
+        hash = HashValue(settings.useDraco, HashValue(settings.dracoLevel, hash));
+        hash = HashValue(settings.useJpg, HashValue(settings.jpgLevel, hash));
+        hash = HashValue(settings.passthroughTextures, HashValue(settings.keepJpeg, HashValue(settings.tangents, hash)));
+        hash = HashValue(settings.cleanup, HashValue(settings.pointBits, HashValue(settings.pointChunk, hash)));
+        hash = HashValue(settings.compactJson, hash);
+        return hash;
+    }
+
+    // Buffer and image uris of a .gltf or .glb that aren't data uris, relative to its directory
+    std::vector<fs::path> ReferencedFiles(const fs::path& path, bool binary)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::string text;
+        if (binary)
+        {
+            // header, then the JSON chunk's length and type
+            uint32_t header[5] = {};
+            if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != 0x46546C67u || header[4] != 0x4E4F534Au)
+            {
+                return {};
+            }
+            text.resize(header[3]);
+        }
+        else
+        {
+            std::error_code error;
+            text.resize(static_cast<size_t>(fs::file_size(path, error)));
+        }
+        if (!file.read(text.data(), static_cast<std::streamsize>(text.size())))
+        {
+            return {};
+        }
+
+        nlohmann::json document = nlohmann::json::parse(text, nullptr, false);
+        std::vector<fs::path> references;
+        if (!document.is_object())
+        {
+            return references;
+        }
+        for (const char* list : { "buffers", "images" })
+        {
+            auto entries = document.find(list);
+            if (entries == document.end() || !entries->is_array())
+            {
+                continue;
+            }
+            for (const auto& entry : *entries)
+            {
+                auto uri = entry.find("uri");
+                if (uri == entry.end() || !uri->is_string() || uri->get<std::string>().rfind("data:", 0) == 0)
+                {
+                    continue;
+                }
+                std::string decoded;
+                tinygltf::URIDecode(uri->get<std::string>(), &decoded, nullptr);
+                fs::path reference = path.parent_path() / fs::u8path(decoded);
+                if (std::find(references.begin(), references.end(), reference) == references.end())
+                {
+                    references.push_back(reference);
+                }
+            }
+        }
+        return references;
+    }
+
+    bool HashFile(const fs::path& path, uint64_t& hash)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        hash = HashBytes(nullptr, 0);
+        std::vector<char> block(1 << 20);
+        while (file)
+        {
+            file.read(block.data(), block.size());
+            hash = HashBytes(block.data(), static_cast<size_t>(file.gcount()), hash);
+        }
+        return file.eof();
+    }
+
+    // The input and every file it references. One that is missing counts by its path, so it showing up
+    // later changes the hash too
+    bool HashInput(const BatchFile& file, uint64_t& hash)
+    {
+        if (!HashFile(file.input, hash))
+        {
+            return false;
+        }
+        for (const auto& reference : file.references)
+        {
+            uint64_t referenceHash = 0;
+            hash = HashFile(reference, referenceHash) ? HashValue(referenceHash, hash) : HashString(reference.generic_string(), hash);
+        }
+        return true;
+    }
+
+    // One line per converted file: hashes, sizes and time, then the path. A line cut short by a crash doesn't parse
+    // and gets ignored, a file seen twice keeps its last line
+    std::unordered_map<std::string, JournalEntry> ReadJournal(const fs::path& path)
+    {
+        std::unordered_map<std::string, JournalEntry> entries;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            JournalEntry entry;
+            std::string key;
+            fields >> std::hex >> entry.inputHash >> entry.settingsHash >> std::dec >> entry.inputSize >> entry.inputTime >> entry.outputSize >>
+                entry.seconds;
+            if (!fields || fields.get() != '\t' || !std::getline(fields, key) || key.empty())
+            {
+                continue;
+            }
+            entries[key] = entry;
+        }
+        return entries;
+    }
+
+    std::string JournalLine(const std::string& key, const JournalEntry& entry)
+    {
+        std::ostringstream line;
+        line << std::hex << entry.inputHash << ' ' << entry.settingsHash << std::dec << ' ' << entry.inputSize << ' ' << entry.inputTime << ' '
+             << entry.outputSize << ' ' << entry.seconds << '\t' << key << '\n';
+        return line.str();
+    }
+
+    std::string JsonString(const std::string& value)
+    {
+        std::string out = "\"";
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    void WriteReport(const fs::path& path, const BatchReport& report)
+    {
+        std::ofstream file(path);
+        file << "{\n"
+             << "  \"files\": " << report.files << ",\n"
+             << "  \"converted\": " << report.converted << ",\n"
+             << "  \"skipped\": " << report.skipped << ",\n"
+             << "  \"failed\": " << report.failed << ",\n"
+             << "  \"workers\": " << report.workers << ",\n"
+             << "  \"input_bytes\": " << report.inputBytes << ",\n"
+             << "  \"output_bytes\": " << report.outputBytes << ",\n"
+             << "  \"bytes_saved\": " << (static_cast<long long>(report.inputBytes) - static_cast<long long>(report.outputBytes)) << ",\n"
+             << "  \"seconds\": " << report.seconds << ",\n"
+             << "  \"convert_seconds\": " << report.convertSeconds << ",\n"
+             << "  \"failures\": [";
+        for (size_t i = 0; i < report.failures.size(); i++)
+        {
+            file << (i > 0 ? ", " : "") << JsonString(report.failures[i]);
+        }
+        file << "]\n}\n";
+        if (!file)
+        {
+            std::cerr << "Couldn't write the batch report " << path.string() << std::endl;
+        }
+    }
+
+    std::vector<BatchFile> FindInputs(const fs::path& inputDir, const fs::path& outputDir)
+    {
+        std::vector<BatchFile> files;
+        std::error_code error;
+        fs::path outputRoot = fs::weakly_canonical(outputDir, error);
+        for (auto it = fs::recursive_directory_iterator(inputDir, fs::directory_options::skip_permission_denied, error);
+             it != fs::recursive_directory_iterator(); it.increment(error))
+        {
+            if (error)
+            {
+                std::cerr << "Couldn't list " << inputDir.string() << ": " << error.message() << std::endl;
+                break;
+            }
+            // an output directory inside the input directory isn't input
+            if (it->is_directory() && fs::weakly_canonical(it->path(), error) == outputRoot)
+            {
+                it.disable_recursion_pending();
+                continue;
+            }
+            std::string extension = it->path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            if (!it->is_regular_file() || (extension != ".gltf" && extension != ".glb"))
+            {
+                continue;
+            }
+            BatchFile file;
+            file.input = it->path();
+            fs::path relative = it->path().lexically_relative(inputDir);
+            file.key = relative.generic_string();
+            file.output = (outputDir / relative).replace_extension(".glb");
+            file.size = it->file_size(error);
+            file.time = static_cast<int64_t>(it->last_write_time(error).time_since_epoch().count());
+            // a replaced texture or .bin has to make the input look changed, and count in its bytes
+            file.references = ReferencedFiles(file.input, extension == ".glb");
+            for (const auto& reference : file.references)
+            {
+                std::error_code referenceError;
+                uint64_t size = fs::file_size(reference, referenceError);
+                int64_t time = static_cast<int64_t>(fs::last_write_time(reference, referenceError).time_since_epoch().count());
+                file.size += referenceError ? 0 : size;
+                file.time = static_cast<int64_t>(HashValue(referenceError ? 0 : time, HashValue(file.time, HashBytes(nullptr, 0))));
+            }
+            files.push_back(std::move(file));
+        }
+        // a .gltf and a .glb of the same name would end up in the same output
+        std::sort(files.begin(), files.end(), [](const BatchFile& a, const BatchFile& b) { return a.output < b.output; });
+        files.erase(std::unique(files.begin(), files.end(), [](const BatchFile& a, const BatchFile& b) {
+            if (a.output == b.output)
+            {
+                std::cerr << b.input.string() << " has the same output as " << a.input.string() << ", left out" << std::endl;
+                return true;
+            }
+            return false;
+        }), files.end());
+        std::stable_sort(files.begin(), files.end(), [](const BatchFile& a, const BatchFile& b) { return a.size > b.size; });
+        return files;
+    }
+}
+
+BatchReport BatchConvert(const BatchSettings& batch, const ExportSettings& settings)
+{
+    auto start = std::chrono::steady_clock::now();
+    BatchReport report;
+    fs::path inputDir(batch.inputDir);
+    fs::path outputDir(batch.outputDir);
+    std::error_code error;
+    fs::create_directories(outputDir, error);
+    if (!fs::is_directory(inputDir) || !fs::is_directory(outputDir))
+    {
+        std::cerr << "Batch needs an input directory and an output directory it can create" << std::endl;
+        return report;
+    }
+    fs::path journalPath = batch.journal.empty() ? outputDir / ".gltfcomp_journal" : fs::path(batch.journal);
+    fs::path reportPath = batch.report.empty() ? outputDir / "batch_report.json" : fs::path(batch.report);
+
+    std::vector<BatchFile> files = FindInputs(inputDir, outputDir);
+    report.files = files.size();
+    std::unordered_map<std::string, JournalEntry> journal = batch.force ? std::unordered_map<std::string, JournalEntry>() : ReadJournal(journalPath);
+    uint64_t settingsHash = SettingsHash(settings);
+
+    // Rewrite the journal with only the entries of files that are still there, through a temporary file so a crash
+    // in between leaves the old one. From here on lines are appended as files finish
+    {
+        fs::path compacted = journalPath;
+        compacted += ".tmp";
+        std::ofstream out(compacted, std::ios::trunc);
+        for (const auto& file : files)
+        {
+            auto it = journal.find(file.key);
+            if (it != journal.end())
+            {
+                out << JournalLine(file.key, it->second);
+            }
+        }
+        out.close();
+        fs::rename(compacted, journalPath, error);
+        if (!out || error)
+        {
+            std::cerr << "Couldn't write the journal " << journalPath.string() << ", the batch won't be resumable" << std::endl;
+        }
+    }
+    std::ofstream journalFile(journalPath, std::ios::app);
+    std::mutex journalMutex;
+
+    // A file takes a few times its size while it's loaded, copied into objects and compressed. The workers only load
+    // and hand the objects to the task pool all sessions share, then wait in Finish while the pool compresses them.
+    // Half the pool's threads keep it fed while a file loads, more would only take cores from it. Fewer when the
+    // biggest file times the workers wouldn't fit in the memory, and never more than the pool has threads
+    size_t memory = batch.memoryBudget > 0 ? batch.memoryBudget : PhysicalMemory() / 2;
+    size_t perWorker = std::max<size_t>(files.empty() ? 0 : static_cast<size_t>(files.front().size) * 8, 64ull * 1024 * 1024);
+    size_t poolThreads = static_cast<size_t>(std::max(GetThreadCount(), 1));
+    size_t workers = batch.workers > 0 ? static_cast<size_t>(batch.workers) : std::max<size_t>(poolThreads / 2, 1);
+    if (batch.workers <= 0 && memory > 0)
+    {
+        workers = std::min(workers, std::max<size_t>(memory / perWorker, 1));
+    }
+    workers = std::max<size_t>(std::min({ workers, poolThreads, files.size() }), 1);
+    report.workers = static_cast<int>(workers);
+
+    ExportSettings workerSettings = settings;
+    if (workerSettings.memoryBudget == 0 && memory > 0)
+    {
+        workerSettings.memoryBudget = memory / workers;
+    }
+    workerSettings.inMemory = false;
+    workerSettings.tiling = false;
+    workerSettings.zip = false;
+
+    std::atomic<size_t> next{ 0 };
+    std::mutex reportMutex;
+    std::vector<std::shared_ptr<ExportSession>> sessions;
+    for (size_t w = 0; w < workers; w++)
+    {
+        sessions.push_back(std::make_shared<ExportSession>(workerSettings));
+        if (w > 0)
+        {
+            sessions[w]->ShareTextureCache(*sessions[0]);
+        }
+    }
+
+    auto work = [&](ExportSession& session) {
+        for (size_t i = next++; i < files.size(); i = next++)
+        {
+            const BatchFile& file = files[i];
+            JournalEntry entry;
+            entry.inputSize = file.size;
+            entry.inputTime = file.time;
+            entry.settingsHash = settingsHash;
+
+            auto known = journal.find(file.key);
+            bool hashed = false;
+            if (known != journal.end() && known->second.settingsHash == settingsHash)
+            {
+                std::error_code sizeError;
+                uint64_t outputSize = fs::file_size(file.output, sizeError);
+                bool outputThere = !sizeError && outputSize == known->second.outputSize;
+                bool sameFile = known->second.inputSize == file.size && known->second.inputTime == file.time;
+                if (outputThere && !sameFile)
+                {
+                    // touched, but maybe not changed
+                    hashed = HashInput(file, entry.inputHash);
+                    sameFile = hashed && entry.inputHash == known->second.inputHash;
+                }
+                if (outputThere && sameFile)
+                {
+                    std::lock_guard<std::mutex> lock(reportMutex);
+                    report.skipped++;
+                    continue;
+                }
+            }
+            if (!hashed && !HashInput(file, entry.inputHash))
+            {
+                std::lock_guard<std::mutex> lock(reportMutex);
+                std::cerr << "Couldn't read " << file.input.string() << std::endl;
+                report.failed++;
+                report.failures.push_back(file.key);
+                continue;
+            }
+
+            auto fileStart = std::chrono::steady_clock::now();
+            bool success = false;
+            try
+            {
+                success = OptimizeGltf(file.input.string(), file.output.string(), workerSettings, session);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Converting " << file.input.string() << " failed: " << e.what() << std::endl;
+            }
+            entry.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fileStart).count();
+            std::error_code sizeError;
+            entry.outputSize = success ? fs::file_size(file.output, sizeError) : 0;
+            success = success && !sizeError;
+
+            if (success)
+            {
+                std::lock_guard<std::mutex> lock(journalMutex);
+                journalFile << JournalLine(file.key, entry);
+                journalFile.flush();
+            }
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (success)
+            {
+                report.converted++;
+                report.inputBytes += file.size;
+                report.outputBytes += entry.outputSize;
+                report.convertSeconds += entry.seconds;
+                std::cout << "[" << report.converted + report.skipped + report.failed << "/" << files.size() << "] " << file.key << ": "
+                          << file.size << " -> " << entry.outputSize << " bytes in " << entry.seconds << " s" << std::endl;
+            }
+            else
+            {
+                report.failed++;
+                report.failures.push_back(file.key);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < workers; w++)
+    {
+        threads.emplace_back(work, std::ref(*sessions[w]));
+    }
+    work(*sessions[0]);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::sort(report.failures.begin(), report.failures.end());
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WriteReport(reportPath, report);
+    return report;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <string>
+#include <vector>
+
+struct BatchSettings
+{
+    std::string inputDir;
+    std::string outputDir; // the input tree is mirrored in here, every .gltf/.glb becomes a .glb with its textures inside
+    std::string journal; // empty = .gltfcomp_journal in outputDir
+    std::string report; // empty = batch_report.json in outputDir
+    int workers = 0; // files converted at the same time, at most one per thread of the task pool. 0 = half the pool as far as the memory allows
+    size_t memoryBudget = 0; // bytes all workers together may use, 0 = half of the physical memory
+    bool force = false; // convert everything, even what the journal says is up to date
+};
+
+struct BatchReport
+{
+    size_t files = 0;
+    size_t converted = 0;
+    size_t skipped = 0; // up to date according to the journal
+    size_t failed = 0;
+    size_t inputBytes = 0; // of the converted files
+    size_t outputBytes = 0;
+    double seconds = 0.0; // the whole batch
+    double convertSeconds = 0.0; // summed over the converted files
+    int workers = 0;
+    std::vector<std::string> failures;
+};
+
+// Re-exports every .gltf/.glb under batch.inputDir with OptimizeGltf. Each worker thread has an ExportSession it reuses
+// from file to file, all of them share one texture cache. The workers load the files, the compressing runs on the task
+// pool like any export. The biggest files go first so a worker doesn't end the batch
+// on its own with one. Every converted file gets a line in the journal (input hash, settings hash, output size) as soon
+// as it is written, so a batch that crashed or got stopped picks up where it was: a file is skipped when its entry has
+// the same settings and the output is still there with its size. Inputs with the same size and modification time aren't
+// hashed again. The report is written as json next to being returned
+BatchReport BatchConvert(const BatchSettings& batch, const ExportSettings& settings);
@@ -0,0 +1,267 @@
+#include "export_arena.h"
+#include "task_scheduler.h"
+
+//stl
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    thread_local ExportArena* tlsArena = nullptr;
+
+    // 2MB is the large page size on both x64 windows and linux
+    constexpr size_t largePageSize = 2 * 1024 * 1024;
+
+    size_t RoundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    char* AllocatePages(size_t& size, bool& largePages)
+    {
+        largePages = false;
+#ifdef _WIN32
+        // needs the "lock pages in memory" privilege, without it we get normal pages
+        SIZE_T largeMinimum = GetLargePageMinimum();
+        if (largeMinimum > 0)
+        {
+            size_t largeSize = RoundUp(size, largeMinimum);
+            void* data = VirtualAlloc(nullptr, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (data)
+            {
+                size = largeSize;
+                largePages = true;
+                return static_cast<char*>(data);
+            }
+        }
+        return static_cast<char*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        // transparent huge pages, only a hint
+        largePages = madvise(data, size, MADV_HUGEPAGE) == 0;
+#endif
+        return static_cast<char*>(data);
+#endif
+    }
+
+    void FreePages(char* data, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        VirtualFree(data, 0, MEM_RELEASE);
+#else
+        munmap(data, size);
+#endif
+    }
+
+    // In front of every stb allocation, so free and realloc know where it came from
+    struct alignas(16) AllocationHeader
+    {
+        size_t size;
+        bool fromArena;
+    };
+}
+
+ExportArena::ExportArena(size_t size)
+    : blockSize(RoundUp(size, largePageSize))
+{
+}
+
+ExportArena::~ExportArena()
+{
+    Release();
+}
+
+void* ExportArena::do_allocate(size_t bytes, size_t alignment)
+{
+    // first fit, starting at the block we are in: blocks kept over a Reset get reused in order
+    for (; current < blocks.size(); current++, offset = 0)
+    {
+        Block& block = blocks[current];
+        size_t aligned = RoundUp(reinterpret_cast<uintptr_t>(block.data) + offset, alignment) - reinterpret_cast<uintptr_t>(block.data);
+        if (aligned + bytes <= block.size)
+        {
+            offset = aligned + bytes;
+            return block.data + aligned;
+        }
+    }
+
+    Block block;
+    block.size = std::max(blockSize, RoundUp(bytes + alignment, largePageSize));
+    block.data = AllocatePages(block.size, block.largePages);
+    if (!block.data)
+    {
+        throw std::bad_alloc();
+    }
+    blocks.push_back(block);
+    reserved += block.size;
+
+    current = blocks.size() - 1;
+    size_t aligned = RoundUp(reinterpret_cast<uintptr_t>(block.data), alignment) - reinterpret_cast<uintptr_t>(block.data);
+    offset = aligned + bytes;
+    return block.data + aligned;
+}
+
+bool ExportArena::TryGrow(void* ptr, size_t oldSize, size_t newSize)
+{
+    if (current >= blocks.size())
+    {
+        return false;
+    }
+
+    Block& block = blocks[current];
+    char* end = static_cast<char*>(ptr) + oldSize;
+    if (end != block.data + offset)
+    {
+        return false;
+    }
+
+    size_t start = static_cast<size_t>(static_cast<char*>(ptr) - block.data);
+    if (start + newSize > block.size)
+    {
+        return false;
+    }
+    offset = start + newSize;
+    return true;
+}
+
+void ExportArena::Reset(size_t keepBytes)
+{
+    while (!blocks.empty() && reserved > keepBytes)
+    {
+        FreePages(blocks.back().data, blocks.back().size);
+        reserved -= blocks.back().size;
+        blocks.pop_back();
+    }
+    current = 0;
+    offset = 0;
+}
+
+ExportArenas::ExportArenas()
+{
+    Release();
+}
+
+void ExportArenas::Release()
+{
+    // also picks up a changed thread count for the next export
+    size_t count = static_cast<size_t>(GetScheduler().GetThreadCount()) + 1;
+    if (slots.size() != count)
+    {
+        slots.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            slots.push_back(std::make_unique<Slot>());
+        }
+        return;
+    }
+
+    for (auto& slot : slots)
+    {
+        slot->arena.Release();
+    }
+}
+
+ArenaScope::ArenaScope(ExportArenas& exportArenas)
+    : arenas(exportArenas)
+{
+    // nested scope (a task helping out while it waits), keep using the outer arena
+    if (tlsArena || arenas.slots.empty())
+    {
+        return;
+    }
+
+    int workerIndex = GetScheduler().CurrentWorkerIndex();
+    size_t slot = workerIndex >= 0 && static_cast<size_t>(workerIndex) < arenas.slots.size() - 1
+        ? static_cast<size_t>(workerIndex)
+        : arenas.slots.size() - 1;
+
+    // only the shared slot can be taken, then this task just uses the heap
+    lock = std::unique_lock<std::mutex>(arenas.slots[slot]->mutex, std::try_to_lock);
+    if (lock.owns_lock())
+    {
+        arena = &arenas.slots[slot]->arena;
+        tlsArena = arena;
+    }
+}
+
+ArenaScope::~ArenaScope()
+{
+    if (arena)
+    {
+        tlsArena = nullptr;
+        arena->Reset(arenas.retainLimit);
+    }
+}
+
+void* ArenaMalloc(size_t size)
+{
+    AllocationHeader* header = nullptr;
+    if (tlsArena)
+    {
+        header = static_cast<AllocationHeader*>(tlsArena->allocate(sizeof(AllocationHeader) + size, alignof(AllocationHeader)));
+    }
+    else
+    {
+        header = static_cast<AllocationHeader*>(std::malloc(sizeof(AllocationHeader) + size));
+        if (!header)
+        {
+            return nullptr;
+        }
+    }
+
+    header->size = size;
+    header->fromArena = tlsArena != nullptr;
+    return header + 1;
+}
+
+void* ArenaRealloc(void* ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return ArenaMalloc(size);
+    }
+
+    AllocationHeader* header = static_cast<AllocationHeader*>(ptr) - 1;
+    if (header->fromArena && tlsArena && tlsArena->TryGrow(header, sizeof(AllocationHeader) + header->size, sizeof(AllocationHeader) + size))
+    {
+        header->size = size;
+        return ptr;
+    }
+
+    void* grown = ArenaMalloc(size);
+    if (grown)
+    {
+        std::memcpy(grown, ptr, std::min(size, header->size));
+        ArenaFree(ptr);
+    }
+    return grown;
+}
+
+void ArenaFree(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    // arena memory goes away with the arena's next reset
+    AllocationHeader* header = static_cast<AllocationHeader*>(ptr) - 1;
+    if (!header->fromArena)
+    {
+        std::free(header);
+    }
+}
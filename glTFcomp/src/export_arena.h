@@ -0,0 +1,96 @@
+#pragma once
+
+//stl
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+// Monotonic arena: allocating just bumps a pointer through big blocks and freeing does nothing.
+// Reset rewinds it while keeping the blocks (their pages are already faulted in), Release gives them back.
+// Blocks are asked for with large pages when the OS lets us.
+class ExportArena : public std::pmr::memory_resource
+{
+public:
+    explicit ExportArena(size_t blockSize = 16 * 1024 * 1024);
+    ~ExportArena() override;
+
+    ExportArena(const ExportArena&) = delete;
+    ExportArena& operator=(const ExportArena&) = delete;
+
+    // Grows the last allocation in place when there is room behind it
+    bool TryGrow(void* ptr, size_t oldSize, size_t newSize);
+
+    // Rewind, blocks beyond keepBytes go back to the OS
+    void Reset(size_t keepBytes = SIZE_MAX);
+    void Release() { Reset(0); }
+
+    size_t ReservedBytes() const { return reserved; }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+    struct Block
+    {
+        char* data = nullptr;
+        size_t size = 0;
+        bool largePages = false;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0; // block we are bumping through
+    size_t offset = 0;
+    size_t blockSize;
+    size_t reserved = 0;
+};
+
+// Per-export arenas: one per scheduler worker, plus one shared by any other thread that helps
+// out with tasks (python waiting in finish). Released in one go when the export is done.
+class ExportArenas
+{
+public:
+    ExportArenas();
+
+    // Bytes all arenas together may keep between two tasks, the rest is given back right away
+    void SetRetainLimit(size_t bytes) { retainLimit = bytes == SIZE_MAX ? bytes : bytes / slots.size(); }
+    // Frees everything, only while no task runs
+    void Release();
+
+private:
+    friend class ArenaScope;
+    struct Slot
+    {
+        ExportArena arena;
+        std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots; // the last one is for non-worker threads
+    size_t retainLimit = SIZE_MAX;
+};
+
+// While alive, the stb allocations of this thread come from its arena, which is rewound afterwards.
+// Nothing allocated inside may be used after the scope ends.
+class ArenaScope
+{
+public:
+    explicit ArenaScope(ExportArenas& arenas);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    ExportArenas& arenas;
+    ExportArena* arena = nullptr;
+    std::unique_lock<std::mutex> lock;
+};
+
+// malloc/realloc/free for stb: from the thread's arena inside an ArenaScope, from the heap otherwise
+void* ArenaMalloc(size_t size);
+void* ArenaRealloc(void* ptr, size_t size);
+void ArenaFree(void* ptr);
@@ -0,0 +1,118 @@
+#pragma once
+
+//stl
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// FNV-1a, good enough to recognise the same mesh or texture coming in again
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+template <typename T>
+inline uint64_t HashValue(const T& value, uint64_t hash)
+{
+    return HashBytes(&value, sizeof(T), hash);
+}
+
+inline uint64_t HashString(const std::string& value, uint64_t hash)
+{
+    return HashBytes(value.data(), value.size(), hash);
+}
+
+// Thread safe cache with a byte limit, the least recently used entries get dropped when it's full.
+// Entries are shared_ptr's so a task can keep using one while another task evicts it.
+template <typename Value>
+class ExportCache
+{
+public:
+    explicit ExportCache(size_t limitBytes = 0) : limit(limitBytes) {}
+
+    std::shared_ptr<const Value> Find(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end())
+        {
+            misses++;
+            return nullptr;
+        }
+
+        // move to the front of the lru list
+        order.splice(order.begin(), order, it->second.orderIt);
+        hits++;
+        return it->second.value;
+    }
+
+    void Insert(uint64_t key, std::shared_ptr<const Value> value, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (bytes > limit || entries.count(key))
+        {
+            return;
+        }
+
+        order.push_front(key);
+        entries[key] = Entry{ std::move(value), bytes, order.begin() };
+        usedBytes += bytes;
+        EvictToLimit();
+    }
+
+    void SetLimit(size_t limitBytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = limitBytes;
+        EvictToLimit();
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        order.clear();
+        usedBytes = 0;
+    }
+
+    size_t Limit() const { std::lock_guard<std::mutex> lock(mutex); return limit; }
+    size_t UsedBytes() const { std::lock_guard<std::mutex> lock(mutex); return usedBytes; }
+    size_t Hits() const { std::lock_guard<std::mutex> lock(mutex); return hits; }
+    size_t Misses() const { std::lock_guard<std::mutex> lock(mutex); return misses; }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const Value> value;
+        size_t bytes = 0;
+        std::list<uint64_t>::iterator orderIt;
+    };
+
+    void EvictToLimit()
+    {
+        while (usedBytes > limit && !order.empty())
+        {
+            auto it = entries.find(order.back());
+            usedBytes -= it->second.bytes;
+            entries.erase(it);
+            order.pop_back();
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::list<uint64_t> order; // most recently used first
+    size_t limit = 0;
+    size_t usedBytes = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+};
@@ -0,0 +1,161 @@
+#include "export_job.h"
+
+//stl
+#include <algorithm>
+
+ExportJob::ExportJob(std::shared_ptr<ExportSession> exportSession, py::object callback, double interval)
+    : session(std::move(exportSession))
+    , progressCallback(std::move(callback))
+    , callbackInterval(std::max(interval, 0.01))
+{
+    // refuse add_object and begin right away, not only once the task below gets to run
+    session->Seal();
+
+    // The job itself is just another task, it helps out with its own subtasks while it waits on them
+    task = GetScheduler().Submit([this] {
+        bool success = false;
+        std::string message;
+        try
+        {
+            success = session->FinishSealed();
+        }
+        catch (const std::exception& e)
+        {
+            message = e.what();
+        }
+        catch (...)
+        {
+            message = "unknown error";
+        }
+        Finish(success, message);
+    });
+
+    if (!progressCallback.is_none())
+    {
+        notifyThread = std::thread(&ExportJob::NotifyLoop, this);
+    }
+}
+
+ExportJob::~ExportJob()
+{
+    // The task and the notify thread both use this object. The notify thread needs the GIL to call
+    // into python, so give it up while we wait for them.
+    if (PyGILState_Check())
+    {
+        py::gil_scoped_release releaseGil;
+        Wait(-1.0);
+        if (notifyThread.joinable())
+        {
+            notifyThread.join();
+        }
+    }
+    else
+    {
+        Wait(-1.0);
+        if (notifyThread.joinable())
+        {
+            notifyThread.join();
+        }
+    }
+}
+
+float ExportJob::Progress() const
+{
+    if (Succeeded())
+    {
+        return 1.0f;
+    }
+    return session->Progress().Fraction();
+}
+
+bool ExportJob::Wait(double timeoutSeconds)
+{
+    std::unique_lock<std::mutex> lock(stateMutex);
+    if (timeoutSeconds < 0.0)
+    {
+        doneCondition.wait(lock, [this] { return done.load(); });
+        return true;
+    }
+
+    auto timeout = std::chrono::duration<double>(timeoutSeconds);
+    return doneCondition.wait_for(lock, timeout, [this] { return done.load(); });
+}
+
+void ExportJob::Cancel()
+{
+    if (!done)
+    {
+        session->Cancel();
+    }
+}
+
+std::string ExportJob::Error() const
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return error;
+}
+
+void ExportJob::Finish(bool success, const std::string& errorMessage)
+{
+    // notify under the lock: a waiting destructor may free the condition variable as soon as it wakes up
+    std::lock_guard<std::mutex> lock(stateMutex);
+    succeeded = success;
+    error = errorMessage;
+    done = true;
+    doneCondition.notify_all();
+}
+
+void ExportJob::NotifyLoop()
+{
+    float lastReported = -1.0f;
+    while (true)
+    {
+        bool finished = false;
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            doneCondition.wait_for(lock, callbackInterval, [this] { return done.load(); });
+            finished = done;
+        }
+
+        // throttled: only call back when something changed since the last call
+        float fraction = Progress();
+        if (fraction != lastReported || finished)
+        {
+            py::gil_scoped_acquire gil;
+            try
+            {
+                progressCallback(fraction);
+            }
+            catch (py::error_already_set& e)
+            {
+                e.discard_as_unraisable(__func__);
+            }
+            lastReported = fraction;
+        }
+
+        if (finished)
+        {
+            break;
+        }
+    }
+}
+
+std::shared_ptr<ExportJob> StartExport(const py::dict& mesh_data, const std::string& exportDir,
+    const std::string& filepath, py::list textures, bool useDraco,
+    int dracoLevel, bool useJpg, int jpgLevel, bool zip,
+    py::object progressCallback, double callbackInterval)
+{
+    ExportSettings settings;
+    settings.exportDir = exportDir;
+    settings.filepath = filepath;
+    settings.useDraco = useDraco;
+    settings.dracoLevel = dracoLevel;
+    settings.useJpg = useJpg;
+    settings.jpgLevel = jpgLevel;
+    settings.zip = zip;
+
+    // copying out of python has to happen here while we still hold the GIL
+    auto session = std::make_shared<ExportSession>(std::move(settings));
+    session->AddObject(IngestBlenderData(mesh_data, textures));
+    return std::make_shared<ExportJob>(std::move(session), std::move(progressCallback), callbackInterval);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../external/pybind11/include/pybind11/pybind11.h"
+
+#include "gltf_loader.h"
+#include "export_progress.h"
+#include "task_scheduler.h"
+
+//stl
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace py = pybind11;
+
+// pybind11 keeps its types hidden in the module, a class with a py::object member has to be hidden as well
+#if defined(__GNUC__) && !defined(_WIN32)
+#define GLTFCOMP_HIDDEN __attribute__((visibility("hidden")))
+#else
+#define GLTFCOMP_HIDDEN
+#endif
+
+// The final assembly of an export session running in the background,
+// returned to python by start_export and ExportSession.finish_async.
+class GLTFCOMP_HIDDEN ExportJob
+{
+public:
+    ExportJob(std::shared_ptr<ExportSession> session, py::object progressCallback, double callbackInterval);
+    ~ExportJob();
+
+    ExportJob(const ExportJob&) = delete;
+    ExportJob& operator=(const ExportJob&) = delete;
+
+    float Progress() const;
+    // Negative timeout waits forever, returns whether the job finished
+    bool Wait(double timeoutSeconds);
+    void Cancel();
+
+    bool IsDone() const { return done; }
+    bool Succeeded() const { return done && succeeded; }
+    bool IsCancelled() const { return session->Progress().IsCancelled(); }
+    std::string Error() const;
+
+private:
+    void Finish(bool success, const std::string& errorMessage);
+    void NotifyLoop();
+
+    std::shared_ptr<ExportSession> session;
+    TaskHandle task;
+
+    std::atomic<bool> done{ false };
+    bool succeeded = false;
+    std::string error;
+    mutable std::mutex stateMutex;
+    std::condition_variable doneCondition;
+
+    // Progress callback, called with the GIL from its own thread at most every callbackInterval seconds
+    py::object progressCallback;
+    std::chrono::duration<double> callbackInterval;
+    std::thread notifyThread;
+};
+
+std::shared_ptr<ExportJob> StartExport(const py::dict& mesh_data, const std::string& exportDir,
+    const std::string& filepath, py::list textures, bool useDraco,
+    int dracoLevel, bool useJpg, int jpgLevel, bool zip,
+    py::object progressCallback, double callbackInterval);
@@ -0,0 +1,81 @@
+#pragma once
+
+//stl
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Thrown by export tasks when they notice the export got cancelled.
+// Because the scheduler skips dependents of a failed task, throwing this stops the rest of the graph too.
+class ExportCancelled : public std::runtime_error
+{
+public:
+    ExportCancelled() : std::runtime_error("export cancelled") {}
+};
+
+// Shared between the export tasks and whoever is watching the export.
+// Tasks report finished steps and check for cancellation at their chunk boundaries.
+class ExportProgress
+{
+public:
+    // For a session starting its next export. Nothing may be running anymore.
+    void Reset()
+    {
+        totalSteps = 0;
+        doneSteps = 0;
+        cancelled = false;
+        std::lock_guard<std::mutex> lock(filesMutex);
+        writtenFiles.clear();
+    }
+
+    void AddSteps(size_t steps) { totalSteps += steps; }
+    void Advance(size_t steps = 1) { doneSteps += steps; }
+    float Fraction() const
+    {
+        size_t total = totalSteps;
+        if (total == 0)
+        {
+            return 0.0f;
+        }
+        return std::min(1.0f, static_cast<float>(doneSteps) / static_cast<float>(total));
+    }
+
+    void Cancel() { cancelled = true; }
+    bool IsCancelled() const { return cancelled; }
+    // Convenience for tasks: bail out at a chunk boundary
+    void ThrowIfCancelled() const
+    {
+        if (cancelled)
+        {
+            throw ExportCancelled();
+        }
+    }
+
+    // Files written by the export, removed again when the export doesn't finish
+    void TrackFile(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(filesMutex);
+        writtenFiles.push_back(path);
+    }
+    void RemoveTrackedFiles()
+    {
+        std::lock_guard<std::mutex> lock(filesMutex);
+        for (const auto& path : writtenFiles)
+        {
+            std::remove(path.c_str());
+        }
+        writtenFiles.clear();
+    }
+
+private:
+    std::atomic<size_t> totalSteps{ 0 };
+    std::atomic<size_t> doneSteps{ 0 };
+    std::atomic<bool> cancelled{ false };
+
+    std::mutex filesMutex;
+    std::vector<std::string> writtenFiles;
+};
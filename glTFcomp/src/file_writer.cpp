@@ -0,0 +1,422 @@
+#include "file_writer.h"
+
+//stl
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr size_t directMinimum = 4 * 1024 * 1024;
+    constexpr size_t directAlignment = 4096; // covers the logical block size of every disk we care about
+    constexpr size_t stagingSize = 4 * 1024 * 1024;
+
+#ifndef _WIN32
+    bool WriteAll(int fd, const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+#endif
+}
+
+AsyncFileWriter::AsyncFileWriter(size_t maxBytes)
+    : maxQueuedBytes(maxBytes)
+{
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void AsyncFileWriter::SetDirectIo(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    directIo = enabled;
+}
+
+void AsyncFileWriter::Write(std::string path, std::vector<Segment> segments, std::shared_ptr<const void> owner)
+{
+    Job job;
+    job.path = std::move(path);
+    job.segments = std::move(segments);
+    job.owner = std::move(owner);
+    for (const auto& segment : job.segments)
+    {
+        job.size += segment.size;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!thread.joinable())
+    {
+        thread = std::thread([this] { Run(); });
+    }
+
+    // one file bigger than the whole queue still gets in once the queue is empty
+    queueChanged.wait(lock, [&] { return queuedBytes == 0 || queuedBytes + job.size <= maxQueuedBytes; });
+    queuedBytes += job.size;
+    queue.push_back(std::move(job));
+    lock.unlock();
+    queueChanged.notify_all();
+}
+
+bool AsyncFileWriter::Finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    queueChanged.wait(lock, [&] { return queue.empty() && !writing; });
+    bool success = !failed;
+    failed = false;
+    return success;
+}
+
+void AsyncFileWriter::Discard()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.clear();
+        queuedBytes = 0;
+    }
+    queueChanged.notify_all();
+}
+
+void AsyncFileWriter::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        queueChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty())
+        {
+            return; // stopping, and everything queued is written
+        }
+
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        writing = true;
+        bool direct = directIo && job.size >= directMinimum;
+        lock.unlock();
+
+        bool success = WriteJob(job, direct);
+        job.owner.reset();
+
+        lock.lock();
+        queuedBytes -= std::min(job.size, queuedBytes);
+        writing = false;
+        failed = failed || !success;
+        queueChanged.notify_all();
+    }
+}
+
+bool AsyncFileWriter::WriteJob(const Job& job, bool direct)
+{
+#ifdef _WIN32
+    (void)direct;
+    HANDLE file = CreateFileA(job.path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Can't write file: " << job.path << std::endl;
+        return false;
+    }
+
+    // reserve the space up front so the file doesn't get fragmented while it grows
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(job.size);
+    SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation));
+
+    bool success = true;
+    for (const auto& segment : job.segments)
+    {
+        const char* data = static_cast<const char*>(segment.data);
+        size_t left = segment.size;
+        while (success && left > 0)
+        {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(left, 1u << 30));
+            DWORD written = 0;
+            success = WriteFile(file, data, chunk, &written, nullptr) && written == chunk;
+            data += written;
+            left -= written;
+        }
+    }
+    CloseHandle(file);
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (direct)
+    {
+        flags |= O_DIRECT;
+    }
+#else
+    direct = false;
+#endif
+    int fd = ::open(job.path.c_str(), flags, 0644);
+    if (fd < 0 && direct)
+    {
+        // tmpfs and some network filesystems don't do O_DIRECT
+        direct = false;
+        fd = ::open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0)
+    {
+        std::cerr << "Can't write file: " << job.path << " (" << std::strerror(errno) << ")" << std::endl;
+        return false;
+    }
+
+#ifdef __linux__
+    // reserve the space up front, not every filesystem supports it and that's fine
+    if (job.size > 0)
+    {
+        ::fallocate(fd, 0, 0, static_cast<off_t>(job.size));
+    }
+#endif
+
+    bool success = true;
+    if (!direct)
+    {
+        for (const auto& segment : job.segments)
+        {
+            success = success && WriteAll(fd, static_cast<const char*>(segment.data), segment.size);
+        }
+    }
+    else
+    {
+        // O_DIRECT wants aligned memory and whole blocks, so the segments go through an aligned staging buffer.
+        // The last block is padded and the file cut back to its size afterwards.
+        void* staging = nullptr;
+        if (posix_memalign(&staging, directAlignment, stagingSize) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        char* stage = static_cast<char*>(staging);
+        size_t filled = 0;
+        for (const auto& segment : job.segments)
+        {
+            const char* data = static_cast<const char*>(segment.data);
+            size_t left = segment.size;
+            while (success && left > 0)
+            {
+                size_t chunk = std::min(left, stagingSize - filled);
+                std::memcpy(stage + filled, data, chunk);
+                filled += chunk;
+                data += chunk;
+                left -= chunk;
+                if (filled == stagingSize)
+                {
+                    success = WriteAll(fd, stage, filled);
+                    filled = 0;
+                }
+            }
+        }
+        if (success && filled > 0)
+        {
+            size_t padded = (filled + directAlignment - 1) / directAlignment * directAlignment;
+            std::memset(stage + filled, 0, padded - filled);
+            success = WriteAll(fd, stage, padded);
+        }
+        std::free(staging);
+        success = success && ::ftruncate(fd, static_cast<off_t>(job.size)) == 0;
+    }
+
+    success = ::close(fd) == 0 && success;
+#endif
+
+    if (!success)
+    {
+        std::cerr << "Failed writing file: " << job.path << std::endl;
+    }
+    return success;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& filePath, size_t fileSize)
+{
+    Close();
+    path = filePath;
+    if (fileSize == 0)
+    {
+        std::cerr << "Can't map an empty file: " << path << std::endl;
+        return false;
+    }
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Can't write file: " << path << std::endl;
+        return false;
+    }
+    file = handle;
+
+    // the mapping makes the file as big as it is
+    LARGE_INTEGER mappingSize;
+    mappingSize.QuadPart = static_cast<LONGLONG>(fileSize);
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READWRITE, static_cast<DWORD>(mappingSize.HighPart), mappingSize.LowPart, nullptr);
+    data = mapping ? static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, fileSize)) : nullptr;
+#else
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Can't write file: " << path << " (" << std::strerror(errno) << ")" << std::endl;
+        return false;
+    }
+
+    // Reserve the blocks up front, a sparse file that runs out of disk halfway would be a SIGBUS in the middle of
+    // copying instead of an error. posix_fallocate writes zeros itself where the file system can't allocate
+#ifdef __APPLE__
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(fileSize), 0 };
+    int error = ::fcntl(fd, F_PREALLOCATE, &store) != -1 && ::ftruncate(fd, static_cast<off_t>(fileSize)) == 0 ? 0 : errno;
+#else
+    int error = ::posix_fallocate(fd, 0, static_cast<off_t>(fileSize));
+#endif
+    if (error != 0)
+    {
+        std::cerr << "Can't reserve " << fileSize << " bytes for file: " << path << " (" << std::strerror(error) << ")" << std::endl;
+        Close();
+        return false;
+    }
+
+    void* mapped = ::mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    data = mapped != MAP_FAILED ? static_cast<unsigned char*>(mapped) : nullptr;
+#endif
+
+    if (!data)
+    {
+        std::cerr << "Can't map file: " << path << std::endl;
+        Close();
+        return false;
+    }
+    size = fileSize;
+    writable = true;
+    return true;
+}
+
+bool MappedFile::OpenRead(const std::string& filePath)
+{
+    Close();
+    path = filePath;
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    file = handle;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data = mapping ? static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        Close();
+        return false;
+    }
+    size = static_cast<size_t>(info.st_size);
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    data = mapped != MAP_FAILED ? static_cast<unsigned char*>(mapped) : nullptr;
+#endif
+
+    if (!data)
+    {
+        Close();
+        return false;
+    }
+    writable = false;
+    return true;
+}
+
+bool MappedFile::Close()
+{
+    bool success = true;
+#ifdef _WIN32
+    if (data)
+    {
+        success = !writable || FlushViewOfFile(data, 0) != 0;
+        UnmapViewOfFile(data);
+    }
+    if (mapping)
+    {
+        CloseHandle(mapping);
+    }
+    if (file)
+    {
+        success = (!writable || FlushFileBuffers(file) != 0) && success;
+        CloseHandle(file);
+    }
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (data)
+    {
+        // MS_SYNC: only a synchronous flush reports a failed writeback, an export must not succeed without its data
+        success = !writable || ::msync(data, size, MS_SYNC) == 0;
+        ::munmap(data, size);
+    }
+    if (fd >= 0)
+    {
+        success = ::close(fd) == 0 && success;
+    }
+    fd = -1;
+#endif
+
+    if (!success)
+    {
+        std::cerr << "Failed writing file: " << path << std::endl;
+    }
+    data = nullptr;
+    size = 0;
+    writable = false;
+    return success;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+//stl
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes finished files on its own I/O thread, so the disk works while the workers keep encoding.
+// The queue is bounded by bytes: Write blocks while too much is waiting, so a slow disk holds the
+// encoders back instead of piling up memory.
+// On linux the file is preallocated with fallocate and big files can skip the page cache with O_DIRECT.
+class AsyncFileWriter
+{
+public:
+    // Piece of a file, the pointer has to stay valid until the file is written
+    struct Segment
+    {
+        const void* data;
+        size_t size;
+    };
+
+    explicit AsyncFileWriter(size_t maxQueuedBytes = 256 * 1024 * 1024);
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    // Queues the segments as one file. owner keeps their memory alive until it is written,
+    // without one the caller has to keep it alive until Finish
+    void Write(std::string path, std::vector<Segment> segments, std::shared_ptr<const void> owner = nullptr);
+
+    // Waits until everything queued is on disk. False when a write failed since the last Finish
+    bool Finish();
+    // Drops the files that haven't started yet (cancelling), Finish still has to be called
+    void Discard();
+
+    // O_DIRECT for files of at least 4MB, falls back to normal writes where the filesystem refuses it
+    void SetDirectIo(bool enabled);
+
+private:
+    struct Job
+    {
+        std::string path;
+        std::vector<Segment> segments;
+        std::shared_ptr<const void> owner;
+        size_t size = 0;
+    };
+
+    void Run();
+    bool WriteJob(const Job& job, bool direct);
+
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<Job> queue;
+    size_t queuedBytes = 0;
+    size_t maxQueuedBytes;
+    bool writing = false; // the I/O thread is busy with a job it took off the queue
+    bool failed = false;
+    bool stopping = false;
+    bool directIo = false;
+    std::thread thread; // started with the first write
+};
+
+// File mapped into memory. As output it is created at its final size and the workers copy their bytes
+// straight to their offsets, so a multi-GB buffer never has to be built in RAM first.
+// The pages are written back by the OS, Close flushes and unmaps them.
+// Opened for reading only the pages that are looked at get loaded, reading a header doesn't read the file.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Creates (or truncates) the file at size bytes and maps it writable
+    bool Open(const std::string& path, size_t size);
+    // Maps an existing file read-only, Data() must not be written to
+    bool OpenRead(const std::string& path);
+    // Flushes the mapping to disk and closes the file, false when that failed
+    bool Close();
+
+    unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    unsigned char* data = nullptr;
+    size_t size = 0;
+    bool writable = false;
+    std::string path;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -5,7 +5,23 @@
 #define TINYGLTF_NOEXCEPTION 
 #define TINYGLTF_ENABLE_DRACO  
 
+// stb decodes and encodes into the worker's export arena, see export_arena.h
+#define STBI_MALLOC(size) ArenaMalloc(size)
+#define STBI_REALLOC(ptr, size) ArenaRealloc(ptr, size)
+#define STBI_FREE(ptr) ArenaFree(ptr)
+#define STBIW_MALLOC(size) ArenaMalloc(size)
+#define STBIW_REALLOC(ptr, size) ArenaRealloc(ptr, size)
+#define STBIW_FREE(ptr) ArenaFree(ptr)
+
 #include "gltf_loader.h"
+#include "file_writer.h"
+#include "gltf_writer.h"
+#include "mesh_chunker.h"
+#include "tiling.h"
+#include "tangents.h"
+#include "mesh_cleanup.h"
+#include "animation.h"
+#include "task_scheduler.h"
 
 //tinygltf
 #include "../external/tinygltf/tiny_gltf.h"
@@ -20,6 +36,7 @@
 
 //draco
 #include "../external/draco/src/draco/compression/encode.h"
+#include "../external/draco/src/draco/compression/expert_encode.h"
 #include "../external/draco/src/draco/compression/decode.h"
 #include "../external/draco/src/draco/mesh/mesh.h"
 #include "../external/draco/src/draco/point_cloud/point_cloud.h"
@@ -32,8 +49,19 @@
 #include <memory>
 #include <fstream>
 #include <cstdio>
-
+#include <cstring>
+#include <atomic>
+#include <numeric>
+#include <filesystem>
+#include <mutex>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+
+#ifdef _WIN32
 #include "Windows.h"
+#endif
 
 // profiling
 #include <chrono>
@@ -42,7 +70,6 @@
 // Most of the GLTF exporter code was from the examples in https://github.com/syoyo/tinygltf
 
 namespace py = pybind11;
-draco::Encoder encoder;
 
 // RAII profiler done by also watching cherno's profiling C++ video
 // https://www.youtube.com/watch?v=YG4jexlSAjc
@@ -68,22 +95,86 @@ public:
 #define PROFILE_SCOPE(name) Profiler profiler(name)
 
 
-struct TextureData 
+static bool WriteBytesToFile(const std::string& path, const void* data, size_t size)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Can't write file: " << path << std::endl;
+        return false;
+    }
+    file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    return file.good();
+}
+
+// .glb gets written as binary glTF, anything else as .gltf json
+static bool IsGlbPath(const std::string& path)
+{
+    size_t lastDot = path.find_last_of('.');
+    if (lastDot == std::string::npos)
+    {
+        return false;
+    }
+    std::string ext = path.substr(lastDot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext == ".glb";
+}
+
+// What the header of a texture file tells us, read without decoding the image
+struct TextureProbe
 {
-    std::string type;
-    std::string filepath; // if filepath texture
-    std::vector<uint8_t> data; // if packed texture
+    enum class Format { Other, Png, Jpeg };
+    Format format = Format::Other;
     int width = 0;
     int height = 0;
     int channels = 0;
-    std::string name;
+    int bits = 8;
+};
+
+static bool ProbeTexture(const unsigned char* data, size_t size, TextureProbe& probe)
+{
+    // stb takes the length as an int
+    if (size > INT_MAX)
+    {
+        return false;
+    }
+    int length = static_cast<int>(size);
+    if (!stbi_info_from_memory(data, length, &probe.width, &probe.height, &probe.channels))
+    {
+        return false;
+    }
+    probe.bits = stbi_is_16_bit_from_memory(data, length) ? 16 : 8;
+
+    static const unsigned char pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (size >= sizeof(pngSignature) && std::memcmp(data, pngSignature, sizeof(pngSignature)) == 0)
+    {
+        probe.format = TextureProbe::Format::Png;
+    }
+    else if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+    {
+        probe.format = TextureProbe::Format::Jpeg;
+    }
+    return true;
+}
+
+// Draco's encoder writes into a std::vector<char>, we take that vector over as is
+using DracoBuffer = std::vector<char>;
+
+// Bytes of one bufferView waiting to be copied to their offset in the buffer
+struct PendingBufferWrite
+{
+    int buffer;
+    size_t byteOffset;
+    const unsigned char* data;
+    size_t byteLength;
 };
 
-struct Vertex 
+// Result of encoding one entry of the texture list
+struct EncodedTexture
 {
-    float position[3];
-    float normal[3];
-    float texcoord[2];
+    bool attempted = false;
+    bool ok = false;
+    tinygltf::Image image;
 };
 
 struct Material 
@@ -95,6 +186,19 @@ struct Material
     int baseColorTexture = -1;
     int normalTexture = -1;
     int metallicRoughnessTexture = -1;
+    int occlusionTexture = -1;
+    int emissiveTexture = -1;
+    float emissive[3] = { 0.0f, 0.0f, 0.0f };
+    float normalScale = 1.0f;
+    float occlusionStrength = 1.0f;
+    std::string alphaMode = "OPAQUE";
+    float alphaCutoff = 0.5f;
+    bool doubleSided = false;
+    int baseColorTexCoord = 0;
+    int normalTexCoord = 0;
+    int metallicRoughnessTexCoord = 0;
+    int occlusionTexCoord = 0;
+    int emissiveTexCoord = 0;
 };
 
 struct Mesh 
@@ -106,13 +210,63 @@ struct Mesh
     int primitiveMode = TINYGLTF_MODE_TRIANGLES; // Default to triangles
     bool useDracoCompression = true;
     int dracoCompressionLevel = 7; // 7 default (most stable speed)
+    std::vector<std::string> targetNames; // of the morph targets, in the mesh's extras
+    bool normals = true; // a point cloud can come without them
+};
+
+// What a draco primitive needs to know about the mesh it compressed, so the vertices don't have to be kept for it
+struct MeshInfo
+{
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    std::vector<double> boundsMin; // empty without vertices
+    std::vector<double> boundsMax;
+    bool tangents = false; // the draco data has them
 };
 
+// Data of one primitive, see AddMesh. info is only needed for draco data whose vertices were dropped
+struct MeshPart
+{
+    const std::vector<Vertex>* vertices;
+    const std::vector<uint32_t>* indices;
+    const DracoBuffer* dracoData;
+    const MeshInfo* info;
+    std::shared_ptr<const void> owner;
+    const std::vector<float>* tangents = nullptr; // 4 per vertex, or empty/nullptr for none
+    VertexExtras extrasLayout; // what extras has, also when it was dropped with the vertices
+    const std::vector<float>* extras = nullptr;
+};
+
+// Vertex count and position bounds, the bounds in gltf space https://discussions.unity.com/t/how-to-get-the-min-max-vertexs-pos-of-a-mesh-in-object-space/841241/5
+static MeshInfo DescribeMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+    MeshInfo info;
+    info.vertexCount = vertices.size();
+    info.indexCount = indices.size();
+    for (const auto& vertex : vertices)
+    {
+        for (int i = 0; i < 3; i++) {
+            if (info.boundsMin.empty())
+            {
+                info.boundsMin = { vertex.position[0], vertex.position[1], vertex.position[2] };
+                info.boundsMax = { vertex.position[0], vertex.position[1], vertex.position[2] };
+            }
+            else {
+                info.boundsMin[i] = std::min(info.boundsMin[i], static_cast<double>(vertex.position[i]));
+                info.boundsMax[i] = std::max(info.boundsMax[i], static_cast<double>(vertex.position[i]));
+            }
+        }
+    }
+    return info;
+}
+
 struct Node 
 {
     std::string name;
     float transform[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 }; // Identity matrix
     int meshIndex = -1;
+    int skin = -1;
+    bool animated = false; // gets no matrix, glTF only animates nodes without one
     std::vector<int> children;
 };
 
@@ -122,9 +276,36 @@ private:
     tinygltf::Model model;
     std::unordered_map<std::string, int> textureCache;
     std::vector<TextureData> textureList;
+    std::vector<EncodedTexture> encodedTextures; // filled by PushEncodedTexture, indexed like textureList
     std::string exportDir;
     bool useJpg = true;
     int jpgLevel = 100;
+    ExportProgress* progress = nullptr; // optional, for cancellation and cleaning up written files
+    bool streamingJson = true; // our own json writer instead of tinygltf's, see gltf_writer.h
+    bool compactJson = true;
+    bool passthroughTextures = true; // source files already in the output format are copied instead of re-encoded
+    bool keepJpeg = false; // a jpeg source is copied even when the output is png
+    bool mapBuffer = false; // the buffer is copied straight into the mapped .bin/.glb instead of built in memory
+    std::vector<std::string> bufferFiles; // .bin files written next to the gltf
+    bool inMemory = false; // textures are kept in memoryTextures instead of written
+    bool embedImages = false; // same for a .glb file, its textures go into the BIN chunk instead of next to it
+    AsyncFileWriter* fileWriter = nullptr; // optional, files are queued to its I/O thread instead of written right away
+    std::mutex memoryTexturesMutex; // also guards textureFiles
+    std::vector<MemoryFile> memoryTextures;
+    std::vector<std::string> textureFiles;
+    std::vector<unsigned char> spareBufferData; // buffer memory kept around by Reset
+
+    // buffer layout, see CreateBufferView and WriteBufferViews
+    std::vector<size_t> plannedBufferSizes; // per buffer
+    std::vector<PendingBufferWrite> pendingWrites;
+    bool bufferPerMesh = false; // every mesh gets a buffer (a .bin) of its own
+    int sharedBuffer = -1; // buffer of everything that isn't in a mesh's own buffer, made when first needed
+    int meshBuffer = -1; // buffer of the mesh being added
+    bool loadOrder = false; // views ordered for a quick first picture, see LayOutForLoading
+    std::vector<std::shared_ptr<const void>> bufferOwners;
+    std::unordered_map<std::string, int> animationIndices; // by name, see AddAnimationChannel
+    float morphTolerance = 0.0001f; // see AddMorphTargets
+    bool meshQuantization = false; // an accessor needs KHR_mesh_quantization
 
 public:
     GLTFExporter() 
@@ -139,7 +320,47 @@ public:
         model.asset.generator = "Custom GLTF Exporter";
     }
 
-    bool GLTFExporter::CompressToZip(const std::string& gltfPath,
+    // Gets ready for the next export. Clears the model but keeps the allocated memory of the big lists around.
+    void Reset()
+    {
+        if (!model.buffers.empty())
+        {
+            spareBufferData = std::move(model.buffers[0].data);
+            spareBufferData.clear();
+        }
+        model.buffers.clear();
+        model.bufferViews.clear();
+        model.accessors.clear();
+        model.meshes.clear();
+        model.nodes.clear();
+        model.materials.clear();
+        model.textures.clear();
+        model.images.clear();
+        model.samplers.clear();
+        model.skins.clear();
+        model.animations.clear();
+        model.extensionsUsed.clear();
+        model.extensionsRequired.clear();
+        model.extras = tinygltf::Value();
+        model.scenes[0].nodes.clear();
+
+        textureCache.clear();
+        animationIndices.clear();
+        meshQuantization = false;
+        textureList.clear();
+        encodedTextures.clear();
+
+        plannedBufferSizes.clear();
+        pendingWrites.clear();
+        sharedBuffer = -1;
+        meshBuffer = -1;
+        bufferOwners.clear();
+        bufferFiles.clear();
+        memoryTextures.clear();
+        textureFiles.clear();
+    }
+
+    bool CompressToZip(const std::string& gltfPath,
         const std::string& zipPath,
         const std::vector<std::string>& texturePaths) 
     {
@@ -154,7 +375,8 @@ public:
         }
 
         // glTF file
-        if (!mz_zip_writer_add_file(&zip, "model.gltf", gltfPath.c_str(), nullptr, 0, MZ_BEST_COMPRESSION)) 
+        std::string modelName = IsGlbPath(gltfPath) ? "model.glb" : "model.gltf";
+        if (!mz_zip_writer_add_file(&zip, modelName.c_str(), gltfPath.c_str(), nullptr, 0, MZ_BEST_COMPRESSION)) 
         {
             std::cerr << "Cant add glTF file" << std::endl;
             mz_zip_writer_end(&zip);
@@ -168,37 +390,64 @@ public:
             size_t lastSlash = texPath.find_last_of("/\\");
             std::string filename = (lastSlash != std::string::npos) ? texPath.substr(lastSlash + 1) : texPath;
 
-            // does file exist?
+            // the model points at it, a zip without it would be broken
             std::ifstream testFile(texPath);
             if (!testFile.good()) 
             {
-                std::cerr << "File doesnt exist" << std::endl;
-                continue;
+                std::cerr << "File doesnt exist: " << texPath << std::endl;
+                mz_zip_writer_end(&zip);
+                return false;
             }
             testFile.close();
 
             if (!mz_zip_writer_add_file(&zip, filename.c_str(), texPath.c_str(), nullptr, 0, MZ_BEST_COMPRESSION)) 
             {
                 std::cerr << "Cant add texture: " << filename << std::endl;
+                mz_zip_writer_end(&zip);
+                return false;
             }
         }
 
-        mz_zip_writer_finalize_archive(&zip);
+        bool finalized = mz_zip_writer_finalize_archive(&zip);
         mz_zip_writer_end(&zip);
-        return true;
+        return finalized;
+    }
+
+    DracoBuffer CompressMesh(const Mesh& mesh)
+    {
+        return CompressMesh(mesh.vertices, mesh.indices, mesh.dracoCompressionLevel);
     }
 
-    std::vector<uint8_t> CompressMesh(const Mesh& mesh)
+    // tangents (4 per vertex) and extras (see VertexExtras) are optional, they become attributes after position, normal and uv:
+    // the tangent, the color, the extra uv sets, then the joints and weights. DracoAttributeIds gives the ids they get
+    DracoBuffer CompressMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int compressionLevel,
+        const std::vector<float>* tangents = nullptr, const std::vector<float>* extras = nullptr, VertexExtras extrasLayout = {})
     {
         PROFILE_FUNCTION();
         auto dracoMesh = std::make_unique<draco::Mesh>();
 
-        size_t numVertices = mesh.vertices.size();
-        size_t numFaces = mesh.indices.size() / 3;
+        size_t numVertices = vertices.size();
+        size_t numFaces = indices.size() / 3;
+        if (!HasExtras(vertices, extras, extrasLayout))
+        {
+            extrasLayout = {};
+        }
+        size_t stride = extrasLayout.Stride();
 
         dracoMesh->set_num_points(numVertices);
+        if (progress) {
+            progress->ThrowIfCancelled();
+        }
 
         // first create attributes (tell draco positions normals and uvs exist)
+        int pos_att_id = -1;
+        int norm_att_id = -1;
+        int uv_att_id = -1;
+        int tangent_att_id = -1;
+        int color_att_id = -1;
+        std::vector<int> extra_uv_att_ids;
+        int joints_att_id = -1;
+        int weights_att_id = -1;
         {
             PROFILE_SCOPE("Setting Attributes");
 
@@ -206,24 +455,64 @@ public:
             draco::GeometryAttribute pos_att;
             pos_att.Init(draco::GeometryAttribute::POSITION, nullptr, 3,
                 draco::DT_FLOAT32, false, sizeof(float) * 3, 0);
-            int pos_att_id = dracoMesh->AddAttribute(pos_att, true, numVertices);
+            pos_att_id = dracoMesh->AddAttribute(pos_att, true, numVertices);
 
 
             // normal 
             draco::GeometryAttribute norm_att;
             norm_att.Init(draco::GeometryAttribute::NORMAL, nullptr, 3,
                 draco::DT_FLOAT32, false, sizeof(float) * 3, 0);
-            int norm_att_id = dracoMesh->AddAttribute(norm_att, true, numVertices);
+            norm_att_id = dracoMesh->AddAttribute(norm_att, true, numVertices);
 
             // UV 
             draco::GeometryAttribute uv_att;
             uv_att.Init(draco::GeometryAttribute::TEX_COORD, nullptr, 2,
                 draco::DT_FLOAT32, false, sizeof(float) * 2, 0);
-            int uv_att_id = dracoMesh->AddAttribute(uv_att, true, numVertices);
+            uv_att_id = dracoMesh->AddAttribute(uv_att, true, numVertices);
+
+            // tangent, draco has no type for those so it's a generic one the gltf maps to TANGENT
+            if (HasTangents(vertices, tangents))
+            {
+                draco::GeometryAttribute tangent_att;
+                tangent_att.Init(draco::GeometryAttribute::GENERIC, nullptr, 4,
+                    draco::DT_FLOAT32, false, sizeof(float) * 4, 0);
+                tangent_att_id = dracoMesh->AddAttribute(tangent_att, true, numVertices);
+            }
+
+            // color as normalized bytes, that's all a baked color needs and draco keeps integers as they are
+            if (extrasLayout.color)
+            {
+                draco::GeometryAttribute color_att;
+                color_att.Init(draco::GeometryAttribute::COLOR, nullptr, 4,
+                    draco::DT_UINT8, true, sizeof(uint8_t) * 4, 0);
+                color_att_id = dracoMesh->AddAttribute(color_att, true, numVertices);
+            }
+
+            for (int set = 0; set < extrasLayout.uvSets; set++)
+            {
+                draco::GeometryAttribute extra_uv_att;
+                extra_uv_att.Init(draco::GeometryAttribute::TEX_COORD, nullptr, 2,
+                    draco::DT_FLOAT32, false, sizeof(float) * 2, 0);
+                extra_uv_att_ids.push_back(dracoMesh->AddAttribute(extra_uv_att, true, numVertices));
+            }
+
+            // joints and weights are integers like the gltf has them, so draco keeps them exact
+            if (extrasLayout.skin)
+            {
+                draco::GeometryAttribute joints_att;
+                joints_att.Init(draco::GeometryAttribute::GENERIC, nullptr, 4,
+                    draco::DT_UINT16, false, sizeof(uint16_t) * 4, 0);
+                joints_att_id = dracoMesh->AddAttribute(joints_att, true, numVertices);
+
+                draco::GeometryAttribute weights_att;
+                weights_att.Init(draco::GeometryAttribute::GENERIC, nullptr, 4,
+                    draco::DT_UINT8, true, sizeof(uint8_t) * 4, 0);
+                weights_att_id = dracoMesh->AddAttribute(weights_att, true, numVertices);
+            }
 
             // Set vertex data to the newly created attributes
             for (size_t i = 0; i < numVertices; ++i) {
-                const Vertex& v = mesh.vertices[i];
+                const Vertex& v = vertices[i];
 
                 dracoMesh->attribute(pos_att_id)->SetAttributeValue(
                     draco::AttributeValueIndex(i), v.position);
@@ -231,42 +520,84 @@ public:
                     draco::AttributeValueIndex(i), v.normal);
                 dracoMesh->attribute(uv_att_id)->SetAttributeValue(
                     draco::AttributeValueIndex(i), v.texcoord);
+                if (tangent_att_id >= 0) {
+                    dracoMesh->attribute(tangent_att_id)->SetAttributeValue(
+                        draco::AttributeValueIndex(i), &(*tangents)[i * 4]);
+                }
+
+                const float* extra = stride > 0 ? &(*extras)[i * stride] : nullptr;
+                if (color_att_id >= 0) {
+                    uint8_t color[4];
+                    ColorToBytes(extra, color);
+                    dracoMesh->attribute(color_att_id)->SetAttributeValue(
+                        draco::AttributeValueIndex(i), color);
+                    extra += 4;
+                }
+                for (int extra_uv_att_id : extra_uv_att_ids) {
+                    dracoMesh->attribute(extra_uv_att_id)->SetAttributeValue(
+                        draco::AttributeValueIndex(i), extra);
+                    extra += 2;
+                }
+                if (joints_att_id >= 0) {
+                    uint16_t joints[4];
+                    uint8_t weights[4];
+                    SkinToIntegers(extra, joints, weights);
+                    dracoMesh->attribute(joints_att_id)->SetAttributeValue(
+                        draco::AttributeValueIndex(i), joints);
+                    dracoMesh->attribute(weights_att_id)->SetAttributeValue(
+                        draco::AttributeValueIndex(i), weights);
+                }
             }
         }
+        if (progress) {
+            progress->ThrowIfCancelled();
+        }
         {
             PROFILE_SCOPE("Adding faces");
 
             // Add faces to the draco mesh
             for (size_t i = 0; i < numFaces; ++i) {
                 draco::Mesh::Face face;
-                face[0] = mesh.indices[i * 3];
-                face[1] = mesh.indices[i * 3 + 1];
-                face[2] = mesh.indices[i * 3 + 2];
+                face[0] = indices[i * 3];
+                face[1] = indices[i * 3 + 1];
+                face[2] = indices[i * 3 + 2];
                 dracoMesh->AddFace(face);
             }
         }
 
+        // One encoder per call: this runs on several scheduler workers at once, so no shared encoder state.
+        // The expert encoder sets the quantization per attribute instead of per type, the uv sets need their own
+        draco::ExpertEncoder encoder(*dracoMesh);
         {
             PROFILE_SCOPE("Setting Quantization");
 
-            // set up encoder
-            draco::Encoder encoder;
-            // draco uses quantization to compress the data, here we feed the data we want to compress and to what bit level. 
-            encoder.SetAttributeQuantization(draco::GeometryAttribute::POSITION, 14);
-            encoder.SetAttributeQuantization(draco::GeometryAttribute::NORMAL, 10);
-            encoder.SetAttributeQuantization(draco::GeometryAttribute::TEX_COORD, 12);
-            // draco uses "speed options" to choose which compression algorithm should be used and at which "agression level. 
+            // draco uses quantization to compress the data, here we feed the data we want to compress and to what bit level.
+            encoder.SetAttributeQuantization(pos_att_id, 14);
+            encoder.SetAttributeQuantization(norm_att_id, 10);
+            encoder.SetAttributeQuantization(uv_att_id, 12);
+            if (tangent_att_id >= 0) {
+                // w is -1 or 1, the ends of the range stay exact
+                encoder.SetAttributeQuantization(tangent_att_id, 10);
+            }
+            for (size_t set = 0; set < extra_uv_att_ids.size(); set++) {
+                encoder.SetAttributeQuantization(extra_uv_att_ids[set], UvQuantizationBits(*extras, stride, (extrasLayout.color ? 4 : 0) + set * 2));
+            }
+            // draco uses "speed options" to choose which compression algorithm should be used and at which "agression level.
             // speed goes from 1 - 10
-            encoder.SetSpeedOptions(10 - mesh.dracoCompressionLevel, 10 - mesh.dracoCompressionLevel);
+            encoder.SetSpeedOptions(10 - compressionLevel, 10 - compressionLevel);
         }
 
 
+        // last chance, draco can't be interrupted once it's encoding
+        if (progress) {
+            progress->ThrowIfCancelled();
+        }
         {
             PROFILE_SCOPE("Draco Encoding");
 
             // Encode mesh
             draco::EncoderBuffer buffer;
-            draco::Status status = encoder.EncodeMeshToBuffer(*dracoMesh, &buffer);
+            draco::Status status = encoder.EncodeToBuffer(&buffer);
         
 
         if (!status.ok()) {
@@ -274,13 +605,170 @@ public:
             return {};
         }
 
-        return std::vector<uint8_t>(buffer.data(), buffer.data() + buffer.size());
+        // hand over the encoder's own memory instead of copying it
+        return std::move(*buffer.buffer());
+        }
+    }
+
+    // Points as a draco point cloud, with the normals when withNormals and the color from extras like CompressMesh does.
+    // The k-d tree encoder only takes quantized floats, which is what positionBits is for. It reorders the points,
+    // which a cloud without indices doesn't mind
+    DracoBuffer CompressPointCloud(const std::vector<Vertex>& points, bool withNormals, const std::vector<float>* extras,
+        VertexExtras extrasLayout, int positionBits, int compressionLevel)
+    {
+        PROFILE_FUNCTION();
+        draco::PointCloud cloud;
+        size_t numPoints = points.size();
+        bool hasColor = HasExtras(points, extras, extrasLayout) && extrasLayout.color;
+        size_t stride = extrasLayout.Stride();
+        cloud.set_num_points(static_cast<uint32_t>(numPoints));
+
+        draco::GeometryAttribute pos_att;
+        pos_att.Init(draco::GeometryAttribute::POSITION, nullptr, 3,
+            draco::DT_FLOAT32, false, sizeof(float) * 3, 0);
+        int pos_att_id = cloud.AddAttribute(pos_att, true, static_cast<uint32_t>(numPoints));
+
+        int norm_att_id = -1;
+        if (withNormals)
+        {
+            draco::GeometryAttribute norm_att;
+            norm_att.Init(draco::GeometryAttribute::NORMAL, nullptr, 3,
+                draco::DT_FLOAT32, false, sizeof(float) * 3, 0);
+            norm_att_id = cloud.AddAttribute(norm_att, true, static_cast<uint32_t>(numPoints));
+        }
+
+        int color_att_id = -1;
+        if (hasColor)
+        {
+            draco::GeometryAttribute color_att;
+            color_att.Init(draco::GeometryAttribute::COLOR, nullptr, 4,
+                draco::DT_UINT8, true, sizeof(uint8_t) * 4, 0);
+            color_att_id = cloud.AddAttribute(color_att, true, static_cast<uint32_t>(numPoints));
+        }
+
+        for (size_t i = 0; i < numPoints; ++i)
+        {
+            cloud.attribute(pos_att_id)->SetAttributeValue(draco::AttributeValueIndex(i), points[i].position);
+            if (norm_att_id >= 0)
+            {
+                cloud.attribute(norm_att_id)->SetAttributeValue(draco::AttributeValueIndex(i), points[i].normal);
+            }
+            if (color_att_id >= 0)
+            {
+                uint8_t color[4];
+                ColorToBytes(&(*extras)[i * stride], color);
+                cloud.attribute(color_att_id)->SetAttributeValue(draco::AttributeValueIndex(i), color);
+            }
+        }
+        if (progress) {
+            progress->ThrowIfCancelled();
+        }
+
+        draco::ExpertEncoder encoder(cloud);
+        encoder.SetAttributeQuantization(pos_att_id, std::clamp(positionBits, 1, 30));
+        if (norm_att_id >= 0) {
+            encoder.SetAttributeQuantization(norm_att_id, 10);
+        }
+        encoder.SetEncodingMethod(draco::POINT_CLOUD_KD_TREE_ENCODING);
+        encoder.SetSpeedOptions(10 - compressionLevel, 10 - compressionLevel);
+
+        draco::EncoderBuffer buffer;
+        draco::Status status = encoder.EncodeToBuffer(&buffer);
+        if (!status.ok()) {
+            std::cerr << "Draco point cloud encoding failed: " << status.error_msg() << std::endl;
+            return {};
+        }
+        return std::move(*buffer.buffer());
+    }
+
+    // Fewest bits that keep an extra uv set within uvError of where it was. Those are lightmaps mostly,
+    // which don't forgive a shifted texel the way a tiling color texture does
+    static int UvQuantizationBits(const std::vector<float>& extras, size_t stride, size_t offset)
+    {
+        const float uvError = 1.0f / 8192.0f; // a quarter texel of a 2048 map
+        float range = 0.0f;
+        for (int axis = 0; axis < 2; axis++)
+        {
+            float low = 0.0f;
+            float high = 0.0f;
+            for (size_t i = offset + axis; i < extras.size(); i += stride)
+            {
+                low = i == offset + axis ? extras[i] : std::min(low, extras[i]);
+                high = i == offset + axis ? extras[i] : std::max(high, extras[i]);
+            }
+            range = std::max(range, high - low);
+        }
+        // a step of range / (2^bits - 1) rounds to at most half a step off
+        int bits = static_cast<int>(std::ceil(std::log2(range / (2.0f * uvError) + 1.0f)));
+        return std::clamp(bits, 8, 20);
+    }
+
+    static void ColorToBytes(const float* color, uint8_t out[4])
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            out[i] = static_cast<uint8_t>(std::lround(std::clamp(color[i], 0.0f, 1.0f) * 255.0f));
+        }
+    }
+
+    // 4 joint indices and their weights as JOINTS_0 and WEIGHTS_0 want them. The weights become bytes that add up
+    // to exactly 255, the rounding goes to the biggest one. A vertex without any weight goes to the first joint
+    static void SkinToIntegers(const float* skin, uint16_t joints[4], uint8_t weights[4])
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < 4; i++)
+        {
+            joints[i] = static_cast<uint16_t>(std::lround(std::clamp(skin[i], 0.0f, 65535.0f)));
+            sum += std::max(skin[4 + i], 0.0f);
+        }
+        int total = 0;
+        int biggest = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            float weight = sum > 0.0f ? std::max(skin[4 + i], 0.0f) / sum : (i == 0 ? 1.0f : 0.0f);
+            weights[i] = static_cast<uint8_t>(std::lround(weight * 255.0f));
+            total += weights[i];
+            biggest = weights[i] > weights[biggest] ? i : biggest;
+        }
+        weights[biggest] = static_cast<uint8_t>(weights[biggest] + 255 - total);
+    }
+
+    static bool HasExtras(const std::vector<Vertex>& vertices, const std::vector<float>* extras, const VertexExtras& layout)
+    {
+        return layout.Stride() > 0 && extras && extras->size() == vertices.size() * layout.Stride();
+    }
+
+    // Ids CompressMesh gives the attributes past position (0), normal (1) and uv (2), -1 for the ones the mesh doesn't have
+    struct DracoAttributeIds
+    {
+        int tangent = -1;
+        int color = -1;
+        std::vector<int> uvSets;
+        int joints = -1;
+        int weights = -1;
+
+        DracoAttributeIds(bool tangents, const VertexExtras& layout)
+        {
+            int next = 3;
+            tangent = tangents ? next++ : -1;
+            color = layout.color ? next++ : -1;
+            for (int set = 0; set < layout.uvSets; set++)
+            {
+                uvSets.push_back(next++);
+            }
+            joints = layout.skin ? next++ : -1;
+            weights = layout.skin ? next++ : -1;
         }
+    };
+
+    static bool HasTangents(const std::vector<Vertex>& vertices, const std::vector<float>* tangents)
+    {
+        return tangents && !tangents->empty() && tangents->size() == vertices.size() * 4;
     }
 
     void PushTextures(TextureData texture)
     {
-        textureList.push_back(texture);
+        textureList.push_back(std::move(texture));
     }
 
     void SetExportDirectory(std::string dir)
@@ -296,125 +784,286 @@ public:
         useJpg = usejpg;
         jpgLevel = level;
     }
-
-    int AddTexture(int idx) 
+    void SetProgress(ExportProgress* exportProgress)
     {
-        // We first either load a packed texture or load a texture file. 
-        // We then set up all the tinygltf image and texture variables.
-        // Finally we export the textures to either png or jpeg (specified by user).
-
+        progress = exportProgress;
+    }
+    void SetJsonOptions(bool streaming, bool compact)
+    {
+        streamingJson = streaming;
+        compactJson = compact;
+    }
+    void SetTexturePassthrough(bool passthrough, bool keepJpegs)
+    {
+        passthroughTextures = passthrough;
+        keepJpeg = keepJpegs;
+    }
+    void SetMorphTolerance(float tolerance)
+    {
+        morphTolerance = tolerance;
+    }
 
+    void SetLoadOrder(bool order)
+    {
+        loadOrder = order;
+    }
+    void SetBufferPerMesh(bool perMesh)
+    {
+        bufferPerMesh = perMesh;
+    }
+    void SetMapBuffer(bool map)
+    {
+        mapBuffer = map;
+    }
+    void SetInMemory(bool memory)
+    {
+        inMemory = memory;
+    }
+    void SetEmbedImages(bool embed)
+    {
+        embedImages = embed;
+    }
+    void SetFileWriter(AsyncFileWriter* writer)
+    {
+        fileWriter = writer;
+    }
+    const std::vector<std::string>& BufferFiles() const
+    {
+        return bufferFiles;
+    }
+    // The texture files WriteTextureFile wrote next to the gltf
+    std::vector<std::string> TextureFiles()
+    {
+        std::lock_guard<std::mutex> lock(memoryTexturesMutex);
+        return textureFiles;
+    }
 
-        //if (textureCache.find(filepath) != textureCache.end()) {
-        //    return textureCache[filepath];
-        //}
-        if (idx < 0 || idx >= static_cast<int>(textureList.size()))
-        {
-            return -1;
+    // Loads a texture (from file, from the encoded bytes or from the packed pixels) and encodes it as png or jpeg into memory.
+    // Fills in everything of the image except the uri. Doesn't touch the model, so the scheduler can run several of these at once.
+    bool EncodeTextureToMemory(const TextureData& tex, tinygltf::Image& image, std::vector<uint8_t>& encoded)
+    {
+        PROFILE_FUNCTION();
+        if (progress) {
+            progress->ThrowIfCancelled();
         }
 
-        // standard is set to 8
-        stbi_write_png_compression_level = 9;
+        int width = 0, height = 0, channels = 0;
+        const unsigned char* pixels = nullptr;
+        unsigned char* loaded = nullptr;
 
-        if (textureList[idx].type == "file")
+        if (tex.type == "file" || tex.type == "encoded")
         {
-            // Load image data
-            int width = 0, height = 0, channels = 0;
-            unsigned char* data = stbi_load(textureList[idx].filepath.c_str(), &width, &height, &channels, 0);
-
-            if (!data) {
-                std::cerr << "Failed to load texture: " << textureList[idx].filepath.c_str() << std::endl;
-                return -1;
+            // the header says whether we need the pixels at all, only what we look at is read from the mapping
+            MappedFile source;
+            bool isFile = tex.type == "file";
+            bool opened = !isFile || source.OpenRead(tex.filepath);
+            const unsigned char* bytes = isFile ? source.Data() : tex.data.data();
+            size_t size = isFile ? source.Size() : tex.data.size();
+            const std::string& label = isFile ? tex.filepath : tex.name;
+            TextureProbe probe;
+            if (!opened || !ProbeTexture(bytes, size, probe)) {
+                std::cerr << "Failed to load texture: " << label << std::endl;
+                return false;
+            }
+            if (CanPassThrough(probe))
+            {
+                SetupImage(tex, probe.width, probe.height, probe.channels, probe.format == TextureProbe::Format::Jpeg, image);
+                encoded.assign(bytes, bytes + size);
+                return true;
             }
 
-            size_t dataSize = width * height * channels;
-            tinygltf::Image image;
-            image.name = textureList[idx].name;
-            image.width = width;
-            image.height = height;
-            image.component = channels;
-            image.bits = 8;
-            image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
-            std::string ext = useJpg ? ".jpg" : ".png";
-            std::string fileName = std::to_string(idx) + ext;
-            std::string fullPath = exportDir + fileName;
+            // Load image data
+            loaded = stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &channels, 0);
+            if (!loaded) {
+                std::cerr << "Failed to load texture: " << label << std::endl;
+                return false;
+            }
+            pixels = loaded;
+        }
+        else if (tex.type == "packed")
+        {
+            width = tex.width;
+            height = tex.height;
+            channels = tex.channels;
+            pixels = tex.data.data();
+        }
+        else
+        {
+            return false;
+        }
 
-            image.uri = fileName;
-            image.mimeType = useJpg ? "image/jpeg" : "image/png";
+        SetupImage(tex, width, height, channels, useJpg, image);
 
-            if (useJpg) 
-            {
-                stbi_write_jpg(fullPath.c_str(), width, height, channels, data, jpgLevel);
-            }
-            else 
+        // decoding can take a while, check again before we start encoding
+        if (progress && progress->IsCancelled())
+        {
+            if (loaded)
             {
-                stbi_write_png(fullPath.c_str(), width, height, channels, data, width * channels);
+                stbi_image_free(loaded);
             }
+            throw ExportCancelled();
+        }
+
+        // stb hands us the encoded file in pieces
+        auto appendBytes = [](void* context, void* data, int size) {
+            auto* out = static_cast<std::vector<uint8_t>*>(context);
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            out->insert(out->end(), bytes, bytes + size);
+        };
 
-            int imageIndex = static_cast<int>(model.images.size());
-            model.images.push_back(image);
+        encoded.clear();
+        if (useJpg)
+        {
+            stbi_write_jpg_to_func(appendBytes, &encoded, width, height, channels, pixels, jpgLevel);
+        }
+        else
+        {
+            stbi_write_png_to_func(appendBytes, &encoded, width, height, channels, pixels, width * channels);
+        }
+
+        if (loaded)
+        {
+            stbi_image_free(loaded);
+        }
+        return !encoded.empty();
+    }
 
-            // Create texture
-            tinygltf::Texture texture;
-            texture.source = imageIndex;
-            texture.sampler = 0;
+    // An 8 bit source that is already a png (or a jpeg) is written as it is: re-encoding a png gains nothing,
+    // and a jpeg only gets re-encoded when a lower quality was asked for, or when png was asked for without keepJpeg
+    bool CanPassThrough(const TextureProbe& probe) const
+    {
+        if (!passthroughTextures || probe.bits != 8)
+        {
+            return false;
+        }
+        if (useJpg)
+        {
+            return probe.format == TextureProbe::Format::Jpeg && jpgLevel >= 100;
+        }
+        return probe.format == TextureProbe::Format::Png || (keepJpeg && probe.format == TextureProbe::Format::Jpeg);
+    }
 
-            int textureIndex = static_cast<int>(model.textures.size());
-            model.textures.push_back(texture);
+    void SetupImage(const TextureData& tex, int width, int height, int channels, bool jpeg, tinygltf::Image& image) const
+    {
+        image.name = tex.name;
+        image.width = width;
+        image.height = height;
+        image.component = channels;
+        image.bits = 8;
+        image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+        image.mimeType = jpeg ? "image/jpeg" : "image/png";
+    }
 
-            //textureCache[filepath] = textureIndex;
+    // Writes an encoded texture next to the gltf, named after idx, and points the image at it.
+    // In memory or for a glb the bytes are kept instead, without a copy when an owner keeps them alive.
+    bool WriteTextureFile(int idx, tinygltf::Image& image, const std::vector<uint8_t>& encoded, std::shared_ptr<const void> owner = nullptr)
+    {
+        std::string ext = image.mimeType == "image/jpeg" ? ".jpg" : ".png";
+        std::string fileName = std::to_string(idx) + ext;
+        std::string fullPath = exportDir + fileName;
+        image.uri = fileName;
 
-            std::cout << "Texture index: " << textureIndex << std::endl;
-            return textureIndex;
+        if (inMemory || embedImages)
+        {
+            const unsigned char* data = encoded.data();
+            if (!owner)
+            {
+                auto copy = std::make_shared<std::vector<uint8_t>>(encoded);
+                data = copy->data();
+                owner = std::move(copy);
+            }
+            std::lock_guard<std::mutex> lock(memoryTexturesMutex);
+            memoryTextures.push_back({ fileName, data, encoded.size(), std::move(owner) });
+            return true;
         }
 
+        if (progress)
+        {
+            progress->ThrowIfCancelled();
+            progress->TrackFile(fullPath);
+        }
+        {
+            std::lock_guard<std::mutex> lock(memoryTexturesMutex);
+            textureFiles.push_back(fullPath);
+        }
 
-        if (textureList[idx].type == "packed")
+        if (fileWriter)
         {
-            int width = textureList[idx].width, height = textureList[idx].height, channels = textureList[idx].channels;
+            // the I/O thread writes it while we go on encoding, a failed write fails the export in ExportToFile
+            const unsigned char* data = encoded.data();
+            if (!owner)
+            {
+                auto copy = std::make_shared<std::vector<uint8_t>>(encoded);
+                data = copy->data();
+                owner = std::move(copy);
+            }
+            fileWriter->Write(fullPath, { { data, encoded.size() } }, std::move(owner));
+            return true;
+        }
+        return WriteBytesToFile(fullPath, encoded.data(), encoded.size());
+    }
+
+    bool EncodeTexture(const TextureData& tex, int idx, tinygltf::Image& image)
+    {
+        std::vector<uint8_t> encoded;
+        return EncodeTextureToMemory(tex, image, encoded) && WriteTextureFile(idx, image, encoded);
+    }
 
-            size_t dataSize = width * height * channels;
-            tinygltf::Image image;
-            image.name = textureList[idx].name;
-            image.width = width;
-            image.height = height;
-            image.component = channels;
-            image.bits = 8;
-            image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    // Adds a texture that was already encoded by a scheduler task, AddTexture then only registers it
+    void PushEncodedTexture(TextureData texture, EncodedTexture encoded)
+    {
+        textureList.push_back(std::move(texture));
+        encodedTextures.resize(textureList.size());
+        encodedTextures.back() = std::move(encoded);
+    }
 
-            std::string ext = useJpg ? ".jpg" : ".png";
-            std::string fileName = std::to_string(idx) + ext;
-            std::string fullPath = exportDir + fileName;
+    int AddTexture(int idx) 
+    {
+        // We first either load a packed texture or load a texture file. 
+        // We then set up all the tinygltf image and texture variables.
+        // Finally we export the textures to either png or jpeg (specified by user).
+        // When a scheduler task already did the encoding we only register the result.
 
-            image.uri = fileName;
-            image.mimeType = useJpg ? "image/jpeg" : "image/png";
+        //if (textureCache.find(filepath) != textureCache.end()) {
+        //    return textureCache[filepath];
+        //}
+        if (idx < 0 || idx >= static_cast<int>(textureList.size()))
+        {
+            return -1;
+        }
 
-            if (useJpg) 
+        tinygltf::Image image;
+        if (idx < static_cast<int>(encodedTextures.size()) && encodedTextures[idx].attempted)
+        {
+            if (!encodedTextures[idx].ok)
             {
-                stbi_write_jpg(fullPath.c_str(), width, height, channels, textureList[idx].data.data(), jpgLevel);
+                return -1;
             }
-            else 
+            image = encodedTextures[idx].image;
+        }
+        else
+        {
+            if (!EncodeTexture(textureList[idx], idx, image))
             {
-                stbi_write_png(fullPath.c_str(), width, height, channels, textureList[idx].data.data(), width * channels);
+                return -1;
             }
+        }
 
-            int imageIndex = static_cast<int>(model.images.size());
-            model.images.push_back(image);
+        int imageIndex = static_cast<int>(model.images.size());
+        model.images.push_back(image);
 
-            // Create texture
-            tinygltf::Texture texture;
-            texture.source = imageIndex;
-            texture.sampler = 0;
+        // Create texture
+        tinygltf::Texture texture;
+        texture.source = imageIndex;
+        texture.sampler = 0;
 
-            int textureIndex = static_cast<int>(model.textures.size());
-            model.textures.push_back(texture);
+        int textureIndex = static_cast<int>(model.textures.size());
+        model.textures.push_back(texture);
 
-            //textureCache[filepath] = textureIndex;
+        //textureCache[filepath] = textureIndex;
 
-            std::cout << "Texture index: " << textureIndex << std::endl;
-            return textureIndex;
-        }
-        return -1;
+        std::cout << "Texture index: " << textureIndex << std::endl;
+        return textureIndex;
     }
 
     // Add a material
@@ -429,69 +1078,108 @@ public:
         };
         gltfMat.pbrMetallicRoughness.metallicFactor = mat.metallicFactor;
         gltfMat.pbrMetallicRoughness.roughnessFactor = mat.roughnessFactor;
-
-        // Add textures if provided
+        gltfMat.emissiveFactor = { mat.emissive[0], mat.emissive[1], mat.emissive[2] };
+        gltfMat.alphaMode = mat.alphaMode;
+        gltfMat.alphaCutoff = mat.alphaCutoff;
+        gltfMat.doubleSided = mat.doubleSided;
+
+        // Add textures if provided, a texture in several slots (occlusion in the metallic roughness map) goes in once
+        std::map<int, int> added;
+        auto texture = [&](int idx) {
+            auto found = added.find(idx);
+            return found != added.end() ? found->second : added[idx] = AddTexture(idx);
+        };
         if (mat.baseColorTexture != -1) 
         {
-            int texIndex = AddTexture(mat.baseColorTexture);
+            int texIndex = texture(mat.baseColorTexture);
             if (texIndex >= 0) 
             {
                 gltfMat.pbrMetallicRoughness.baseColorTexture.index = texIndex;
+                gltfMat.pbrMetallicRoughness.baseColorTexture.texCoord = mat.baseColorTexCoord;
             }
         }
 
         if (mat.metallicRoughnessTexture != -1) 
         {
-            int texIndex = AddTexture(mat.metallicRoughnessTexture);
+            int texIndex = texture(mat.metallicRoughnessTexture);
             if (texIndex >= 0) 
             {
                 gltfMat.pbrMetallicRoughness.metallicRoughnessTexture.index = texIndex;
+                gltfMat.pbrMetallicRoughness.metallicRoughnessTexture.texCoord = mat.metallicRoughnessTexCoord;
             }
         }
 
         if (mat.normalTexture != -1)
         {
-            int texIndex = AddTexture(mat.normalTexture);
+            int texIndex = texture(mat.normalTexture);
             if (texIndex >= 0)
             {
                 gltfMat.normalTexture.index = texIndex;
+                gltfMat.normalTexture.texCoord = mat.normalTexCoord;
+                gltfMat.normalTexture.scale = mat.normalScale;
             }
         }
 
-        int materialIndex = static_cast<int>(model.materials.size());
-        model.materials.push_back(gltfMat);
-        return materialIndex;
-    }
-
-    // Create buffer and buffer view for data
-    int CreateBufferView(const void* data, size_t byteLength, int target = 0) 
-    {
-        if (model.buffers.empty()) 
+        if (mat.occlusionTexture != -1)
         {
-            model.buffers.resize(1);
-            model.buffers[0].name = "buffer";
+            int texIndex = texture(mat.occlusionTexture);
+            if (texIndex >= 0)
+            {
+                gltfMat.occlusionTexture.index = texIndex;
+                gltfMat.occlusionTexture.texCoord = mat.occlusionTexCoord;
+                gltfMat.occlusionTexture.strength = mat.occlusionStrength;
+            }
         }
 
-        tinygltf::Buffer& buffer = model.buffers[0];
-        size_t byteOffset = buffer.data.size();
+        if (mat.emissiveTexture != -1)
+        {
+            int texIndex = texture(mat.emissiveTexture);
+            if (texIndex >= 0)
+            {
+                gltfMat.emissiveTexture.index = texIndex;
+                gltfMat.emissiveTexture.texCoord = mat.emissiveTexCoord;
+            }
+        }
 
-        // Align to 4 bytes
-        while (byteOffset % 4 != 0) 
+        int materialIndex = static_cast<int>(model.materials.size());
+        model.materials.push_back(gltfMat);
+        return materialIndex;
+    }
+
+    // Create buffer and buffer view for data.
+    // First pass of the buffer layout: the view only gets its offset here, the bytes are copied in
+    // by WriteBufferViews once every view is known. Until then the data has to stay alive: pass an owner
+    // that keeps it alive, without one the data is copied aside.
+    int CreateBufferView(const void* data, size_t byteLength, int target = 0, std::shared_ptr<const void> owner = nullptr,
+        size_t vertexStride = sizeof(Vertex)) 
+    {
+        if (meshBuffer < 0 && sharedBuffer < 0)
         {
-            buffer.data.push_back(0);
-            byteOffset++;
+            sharedBuffer = AddBuffer("buffer");
         }
+        int buffer = meshBuffer >= 0 ? meshBuffer : sharedBuffer;
+
+        // Align to 4 bytes
+        size_t& plannedBufferSize = plannedBufferSizes[buffer];
+        size_t byteOffset = (plannedBufferSize + 3) / 4 * 4;
+        plannedBufferSize = byteOffset + byteLength;
 
-        // Copy data
         const unsigned char* bytes = static_cast<const unsigned char*>(data);
-        buffer.data.insert(buffer.data.end(), bytes, bytes + byteLength);
+        if (!owner)
+        {
+            auto copy = std::make_shared<std::vector<unsigned char>>(bytes, bytes + byteLength);
+            bytes = copy->data();
+            owner = std::move(copy);
+        }
+        pendingWrites.push_back({ buffer, byteOffset, bytes, byteLength });
+        bufferOwners.push_back(std::move(owner));
 
         // Create buffer view
         tinygltf::BufferView bufferView;
-        bufferView.buffer = 0;
+        bufferView.buffer = buffer;
         bufferView.byteOffset = byteOffset;
         bufferView.byteLength = byteLength;
-        bufferView.byteStride = (target == TINYGLTF_TARGET_ARRAY_BUFFER) ? sizeof(Vertex) : 0;
+        bufferView.byteStride = (target == TINYGLTF_TARGET_ARRAY_BUFFER) ? vertexStride : 0;
         bufferView.target = target;
 
         int bufferViewIndex = static_cast<int>(model.bufferViews.size());
@@ -499,17 +1187,288 @@ public:
         return bufferViewIndex;
     }
 
+    int AddBuffer(const std::string& name)
+    {
+        tinygltf::Buffer buffer;
+        buffer.name = name;
+        model.buffers.push_back(std::move(buffer));
+        plannedBufferSizes.push_back(0);
+        return static_cast<int>(model.buffers.size()) - 1;
+    }
+
+    // Moves the planned views around so a viewer that streams the file gets a first picture early: small views first,
+    // then the meshes from small to big, then the images from small to big. The views of one mesh or image stay together,
+    // their byte ranges go into extras.byteRanges (offsets in the buffer, so in the BIN chunk of a glb) in file order.
+    // Has to run before the json is written and WriteBufferViews copies the views in.
+    void LayOutForLoading()
+    {
+        PROFILE_FUNCTION();
+        if (pendingWrites.size() != model.bufferViews.size())
+        {
+            return;
+        }
+
+        // one unit per mesh, image or view that neither uses
+        struct LoadUnit
+        {
+            int mesh = -1;
+            int image = -1;
+            int buffer = 0;
+            size_t bytes = 0;
+            std::vector<int> views;
+        };
+        std::vector<int> viewUnit(model.bufferViews.size(), -1);
+        std::vector<LoadUnit> units;
+        auto claim = [&](int view, int mesh, int image, int& unit) {
+            if (view < 0 || view >= static_cast<int>(viewUnit.size()) || viewUnit[view] >= 0)
+            {
+                return;
+            }
+            if (unit < 0)
+            {
+                unit = static_cast<int>(units.size());
+                units.emplace_back();
+                units.back().mesh = mesh;
+                units.back().image = image;
+                units.back().buffer = model.bufferViews[view].buffer;
+            }
+            viewUnit[view] = unit;
+        };
+        auto accessorView = [&](int accessor) {
+            return accessor >= 0 && accessor < static_cast<int>(model.accessors.size()) ? model.accessors[accessor].bufferView : -1;
+        };
+
+        for (size_t m = 0; m < model.meshes.size(); m++)
+        {
+            int unit = -1;
+            for (const auto& primitive : model.meshes[m].primitives)
+            {
+                auto draco = primitive.extensions.find("KHR_draco_mesh_compression");
+                if (draco != primitive.extensions.end() && draco->second.Has("bufferView"))
+                {
+                    claim(draco->second.Get("bufferView").GetNumberAsInt(), static_cast<int>(m), -1, unit);
+                }
+                claim(accessorView(primitive.indices), static_cast<int>(m), -1, unit);
+                for (const auto& attribute : primitive.attributes)
+                {
+                    claim(accessorView(attribute.second), static_cast<int>(m), -1, unit);
+                }
+                for (const auto& target : primitive.targets)
+                {
+                    for (const auto& attribute : target)
+                    {
+                        claim(accessorView(attribute.second), static_cast<int>(m), -1, unit);
+                        const tinygltf::Accessor::Sparse& sparse = model.accessors[attribute.second].sparse;
+                        if (sparse.isSparse)
+                        {
+                            claim(sparse.indices.bufferView, static_cast<int>(m), -1, unit);
+                            claim(sparse.values.bufferView, static_cast<int>(m), -1, unit);
+                        }
+                    }
+                }
+            }
+        }
+        for (size_t i = 0; i < model.images.size(); i++)
+        {
+            int unit = -1;
+            claim(model.images[i].bufferView, -1, static_cast<int>(i), unit);
+        }
+        for (size_t v = 0; v < viewUnit.size(); v++)
+        {
+            int unit = -1;
+            claim(static_cast<int>(v), -1, -1, unit);
+        }
+        // views in the order they were made within a unit, that's also the order the mesh reads them
+        for (size_t v = 0; v < viewUnit.size(); v++)
+        {
+            units[viewUnit[v]].views.push_back(static_cast<int>(v));
+            units[viewUnit[v]].bytes += pendingWrites[v].byteLength;
+        }
+
+        // anything this small costs about nothing to fetch first
+        const size_t smallBytes = 64 * 1024;
+        auto tier = [&](const LoadUnit& unit) {
+            return unit.bytes <= smallBytes ? 0 : unit.image >= 0 ? 2 : 1;
+        };
+        std::vector<size_t> order(units.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            int tierA = tier(units[a]);
+            int tierB = tier(units[b]);
+            return tierA != tierB ? tierA < tierB : units[a].bytes < units[b].bytes;
+        });
+
+        // tinygltf values only have int for integers, past that it has to be a double
+        auto byteValue = [](size_t bytes) {
+            return bytes <= static_cast<size_t>(INT_MAX) ? tinygltf::Value(static_cast<int>(bytes)) : tinygltf::Value(static_cast<double>(bytes));
+        };
+
+        std::fill(plannedBufferSizes.begin(), plannedBufferSizes.end(), 0);
+        tinygltf::Value::Array ranges;
+        for (size_t u : order)
+        {
+            const LoadUnit& unit = units[u];
+            size_t& plannedBufferSize = plannedBufferSizes[unit.buffer];
+            size_t start = (plannedBufferSize + 3) / 4 * 4;
+            for (int v : unit.views)
+            {
+                size_t byteOffset = (plannedBufferSize + 3) / 4 * 4;
+                pendingWrites[v].byteOffset = byteOffset;
+                model.bufferViews[v].byteOffset = byteOffset;
+                plannedBufferSize = byteOffset + pendingWrites[v].byteLength;
+            }
+
+            tinygltf::Value::Object range;
+            range["buffer"] = tinygltf::Value(unit.buffer);
+            range["byteOffset"] = byteValue(start);
+            range["byteLength"] = byteValue(plannedBufferSize - start);
+            if (unit.mesh >= 0)
+            {
+                range["mesh"] = tinygltf::Value(unit.mesh);
+            }
+            if (unit.image >= 0)
+            {
+                range["image"] = tinygltf::Value(unit.image);
+            }
+            ranges.push_back(tinygltf::Value(std::move(range)));
+        }
+
+        tinygltf::Value::Object extras;
+        extras["byteRanges"] = tinygltf::Value(std::move(ranges));
+        model.extras = tinygltf::Value(std::move(extras));
+    }
+
+    // Second pass of the buffer layout: allocate the buffers once at their final size and copy
+    // every view into its own slot, in parallel. Called before writing the model out.
+    // With a destination (a mapped file of plannedBufferSizes[0] zeroed bytes, only with a single buffer)
+    // the views go there and the model's buffer stays empty.
+    void WriteBufferViews(unsigned char* destination = nullptr)
+    {
+        PROFILE_FUNCTION();
+        if (model.buffers.empty() || pendingWrites.empty())
+        {
+            return;
+        }
+
+        std::vector<unsigned char*> destinations(model.buffers.size(), destination);
+        if (!destination)
+        {
+            for (size_t i = 0; i < model.buffers.size(); i++)
+            {
+                // reuse the memory of the previous export's buffer, resize zeroes the padding for us
+                std::vector<unsigned char>& data = model.buffers[i].data;
+                if (i == 0 && data.empty())
+                {
+                    data = std::move(spareBufferData);
+                    data.clear();
+                }
+                data.resize(plannedBufferSizes[i]);
+                destinations[i] = data.data();
+            }
+        }
+
+        // big views are split up so one huge mesh doesn't end up on a single worker
+        const size_t pieceSize = 4 * 1024 * 1024;
+        std::vector<PendingBufferWrite> pieces;
+        for (const auto& write : pendingWrites)
+        {
+            for (size_t done = 0; done < write.byteLength; done += pieceSize)
+            {
+                pieces.push_back({ write.buffer, write.byteOffset + done, write.data + done, std::min(pieceSize, write.byteLength - done) });
+            }
+        }
+
+        GetScheduler().ParallelFor(pieces.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                std::memcpy(destinations[pieces[i].buffer] + pieces[i].byteOffset, pieces[i].data, pieces[i].byteLength);
+            }
+        });
+
+        pendingWrites.clear();
+        bufferOwners.clear();
+    }
+
     int AddMesh(const Mesh& mesh) 
+    {
+        DracoBuffer dracoData;
+        if (mesh.useDracoCompression)
+        {
+            dracoData = CompressMesh(mesh);
+        }
+        return AddMesh(mesh, mesh.vertices, mesh.indices, dracoData);
+    }
+
+    // Same as above but with the draco data already compressed (by a scheduler task).
+    // The buffers are passed separately so they can stay wherever they are owned (the session's mesh cache).
+    // owner keeps the buffers alive until the model is written, without one they are copied aside
+    int AddMesh(const Mesh& mesh, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const DracoBuffer& dracoData,
+        std::shared_ptr<const void> owner = nullptr)
+    {
+        return AddMesh(mesh, { { &vertices, &indices, &dracoData, nullptr, std::move(owner), nullptr, VertexExtras(), nullptr } });
+    }
+
+    // A mesh of several primitives with the same material, one per part (the chunks of a mesh too big to do in one go)
+    int AddMesh(const Mesh& mesh, const std::vector<MeshPart>& parts)
     {
         tinygltf::Mesh gltfMesh;
         gltfMesh.name = mesh.name;
+        if (bufferPerMesh)
+        {
+            // a client that only shows this mesh only has to fetch this .bin
+            meshBuffer = AddBuffer(mesh.name);
+        }
+        for (const auto& part : parts)
+        {
+            gltfMesh.primitives.push_back(AddPrimitive(mesh, part));
+        }
+        if (!mesh.targetNames.empty() && !gltfMesh.primitives.empty() && !gltfMesh.primitives[0].targets.empty())
+        {
+            // every target at rest, the names are where most viewers look for them
+            gltfMesh.weights.assign(mesh.targetNames.size(), 0.0);
+            tinygltf::Value::Array names;
+            for (const auto& name : mesh.targetNames)
+            {
+                names.push_back(tinygltf::Value(name));
+            }
+            tinygltf::Value::Object extras;
+            extras["targetNames"] = tinygltf::Value(std::move(names));
+            gltfMesh.extras = tinygltf::Value(std::move(extras));
+        }
+        if (bufferPerMesh && plannedBufferSizes[meshBuffer] == 0)
+        {
+            // nothing went in (failed draco without vertices), a buffer can't be empty
+            model.buffers.pop_back();
+            plannedBufferSizes.pop_back();
+        }
+        meshBuffer = -1;
+
+        int meshIndex = static_cast<int>(model.meshes.size());
+        model.meshes.push_back(std::move(gltfMesh));
+        return meshIndex;
+    }
+
+    // Adds the accessors and buffer views of one primitive
+    tinygltf::Primitive AddPrimitive(const Mesh& mesh, const MeshPart& part)
+    {
+        if (mesh.primitiveMode == TINYGLTF_MODE_POINTS)
+        {
+            return AddPointPrimitive(mesh, part);
+        }
+        const std::vector<Vertex>& vertices = *part.vertices;
+        const std::vector<uint32_t>& indices = *part.indices;
+        const DracoBuffer& dracoData = *part.dracoData;
+        const MeshInfo* info = part.info;
+        const std::shared_ptr<const void>& owner = part.owner;
+        const std::vector<float>* tangents = part.tangents;
+        const std::vector<float>* extras = part.extras;
 
         // Create primitive
         tinygltf::Primitive primitive;
 
         if (mesh.useDracoCompression)
         {
-            std::vector<uint8_t> dracoData = CompressMesh(mesh);
             if (dracoData.empty())
             {
                 std::cout << "Draco compression failed.. \n";
@@ -518,30 +1477,24 @@ public:
             else
             {
                 // buffer view for Draco
-                int dracoBufferView = CreateBufferView(dracoData.data(), dracoData.size());
+                int dracoBufferView = CreateBufferView(dracoData.data(), dracoData.size(), 0, owner);
+
+                // Calculate bounds from original data, unless the caller already did
+                MeshInfo described;
+                if (!info)
+                {
+                    described = DescribeMesh(vertices, indices);
+                    info = &described;
+                }
 
                 tinygltf::Accessor posAccessor;
                 posAccessor.bufferView = -1; // using the custom bufferview
                 posAccessor.byteOffset = 0;
                 posAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-                posAccessor.count = mesh.vertices.size();
+                posAccessor.count = info->vertexCount;
                 posAccessor.type = TINYGLTF_TYPE_VEC3;
-
-                // Calculate bounds from original data https://discussions.unity.com/t/how-to-get-the-min-max-vertexs-pos-of-a-mesh-in-object-space/841241/5
-                for (const auto& vertex : mesh.vertices) 
-                {
-                    for (int i = 0; i < 3; i++) {
-                        if (posAccessor.minValues.empty()) 
-                        {
-                            posAccessor.minValues = { vertex.position[0], vertex.position[1], vertex.position[2] };
-                            posAccessor.maxValues = { vertex.position[0], vertex.position[1], vertex.position[2] };
-                        }
-                        else {
-                            posAccessor.minValues[i] = std::min(posAccessor.minValues[i], static_cast<double>(vertex.position[i]));
-                            posAccessor.maxValues[i] = std::max(posAccessor.maxValues[i], static_cast<double>(vertex.position[i]));
-                        }
-                    }
-                }
+                posAccessor.minValues = info->boundsMin;
+                posAccessor.maxValues = info->boundsMax;
 
                 int posAccessorIndex = static_cast<int>(model.accessors.size());
                 model.accessors.push_back(posAccessor);
@@ -552,7 +1505,7 @@ public:
                 normalAccessor.bufferView = -1;
                 normalAccessor.byteOffset = 0;
                 normalAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-                normalAccessor.count = mesh.vertices.size();
+                normalAccessor.count = info->vertexCount;
                 normalAccessor.type = TINYGLTF_TYPE_VEC3;
 
                 int normalAccessorIndex = static_cast<int>(model.accessors.size());
@@ -564,19 +1517,97 @@ public:
                 texAccessor.bufferView = -1;
                 texAccessor.byteOffset = 0;
                 texAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-                texAccessor.count = mesh.vertices.size();
+                texAccessor.count = info->vertexCount;
                 texAccessor.type = TINYGLTF_TYPE_VEC2;
 
                 int texAccessorIndex = static_cast<int>(model.accessors.size());
                 model.accessors.push_back(texAccessor);
                 primitive.attributes["TEXCOORD_0"] = texAccessorIndex;
 
+                // the attributes that went into the draco data on top of these
+                bool hasVertices = info == &described;
+                DracoAttributeIds extraIds(hasVertices ? HasTangents(vertices, tangents) : info->tangents,
+                    !hasVertices || HasExtras(vertices, extras, part.extrasLayout) ? part.extrasLayout : VertexExtras{});
+
+                // Tangent accessor
+                if (extraIds.tangent >= 0)
+                {
+                    tinygltf::Accessor tangentAccessor;
+                    tangentAccessor.bufferView = -1;
+                    tangentAccessor.byteOffset = 0;
+                    tangentAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+                    tangentAccessor.count = info->vertexCount;
+                    tangentAccessor.type = TINYGLTF_TYPE_VEC4;
+
+                    int tangentAccessorIndex = static_cast<int>(model.accessors.size());
+                    model.accessors.push_back(tangentAccessor);
+                    primitive.attributes["TANGENT"] = tangentAccessorIndex;
+                }
+
+                // Color accessor, draco has it as normalized bytes
+                if (extraIds.color >= 0)
+                {
+                    tinygltf::Accessor colorAccessor;
+                    colorAccessor.bufferView = -1;
+                    colorAccessor.byteOffset = 0;
+                    colorAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+                    colorAccessor.normalized = true;
+                    colorAccessor.count = info->vertexCount;
+                    colorAccessor.type = TINYGLTF_TYPE_VEC4;
+
+                    int colorAccessorIndex = static_cast<int>(model.accessors.size());
+                    model.accessors.push_back(colorAccessor);
+                    primitive.attributes["COLOR_0"] = colorAccessorIndex;
+                }
+
+                // Accessors of the extra uv sets
+                for (size_t set = 0; set < extraIds.uvSets.size(); set++)
+                {
+                    tinygltf::Accessor uvAccessor;
+                    uvAccessor.bufferView = -1;
+                    uvAccessor.byteOffset = 0;
+                    uvAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+                    uvAccessor.count = info->vertexCount;
+                    uvAccessor.type = TINYGLTF_TYPE_VEC2;
+
+                    int uvAccessorIndex = static_cast<int>(model.accessors.size());
+                    model.accessors.push_back(uvAccessor);
+                    primitive.attributes["TEXCOORD_" + std::to_string(set + 1)] = uvAccessorIndex;
+                }
+
+                // Joints and weights accessors
+                if (extraIds.joints >= 0)
+                {
+                    tinygltf::Accessor jointsAccessor;
+                    jointsAccessor.bufferView = -1;
+                    jointsAccessor.byteOffset = 0;
+                    jointsAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+                    jointsAccessor.count = info->vertexCount;
+                    jointsAccessor.type = TINYGLTF_TYPE_VEC4;
+
+                    int jointsAccessorIndex = static_cast<int>(model.accessors.size());
+                    model.accessors.push_back(jointsAccessor);
+                    primitive.attributes["JOINTS_0"] = jointsAccessorIndex;
+
+                    tinygltf::Accessor weightsAccessor;
+                    weightsAccessor.bufferView = -1;
+                    weightsAccessor.byteOffset = 0;
+                    weightsAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+                    weightsAccessor.normalized = true;
+                    weightsAccessor.count = info->vertexCount;
+                    weightsAccessor.type = TINYGLTF_TYPE_VEC4;
+
+                    int weightsAccessorIndex = static_cast<int>(model.accessors.size());
+                    model.accessors.push_back(weightsAccessor);
+                    primitive.attributes["WEIGHTS_0"] = weightsAccessorIndex;
+                }
+
                 // Indices accessor
                 tinygltf::Accessor indexAccessor;
                 indexAccessor.bufferView = -1;
                 indexAccessor.byteOffset = 0;
                 indexAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
-                indexAccessor.count = mesh.indices.size();
+                indexAccessor.count = info->indexCount;
                 indexAccessor.type = TINYGLTF_TYPE_SCALAR;
 
                 int indexAccessorIndex = static_cast<int>(model.accessors.size());
@@ -593,6 +1624,23 @@ public:
                 attribObj["POSITION"] = tinygltf::Value(0);
                 attribObj["NORMAL"] = tinygltf::Value(1);
                 attribObj["TEXCOORD_0"] = tinygltf::Value(2);
+                if (extraIds.tangent >= 0)
+                {
+                    attribObj["TANGENT"] = tinygltf::Value(extraIds.tangent);
+                }
+                if (extraIds.color >= 0)
+                {
+                    attribObj["COLOR_0"] = tinygltf::Value(extraIds.color);
+                }
+                for (size_t set = 0; set < extraIds.uvSets.size(); set++)
+                {
+                    attribObj["TEXCOORD_" + std::to_string(set + 1)] = tinygltf::Value(extraIds.uvSets[set]);
+                }
+                if (extraIds.joints >= 0)
+                {
+                    attribObj["JOINTS_0"] = tinygltf::Value(extraIds.joints);
+                    attribObj["WEIGHTS_0"] = tinygltf::Value(extraIds.weights);
+                }
 
                 dracoObj["attributes"] = std::move(attributes);
                 primitive.extensions["KHR_draco_mesh_compression"] = std::move(dracoExtension);
@@ -606,34 +1654,30 @@ public:
                     primitive.material = mesh.materialIndex;
                 }
 
-                gltfMesh.primitives.push_back(primitive);
-
-                int meshIndex = static_cast<int>(model.meshes.size());
-                model.meshes.push_back(gltfMesh);
-
-                return meshIndex;
+                return primitive;
             }
         }
 
         // Vertices
-        if (!mesh.vertices.empty()) 
+        if (!vertices.empty()) 
         {
             // Position accessor
             int posBufferView = CreateBufferView(
-                mesh.vertices.data(),
-                mesh.vertices.size() * sizeof(Vertex),
-                TINYGLTF_TARGET_ARRAY_BUFFER
+                vertices.data(),
+                vertices.size() * sizeof(Vertex),
+                TINYGLTF_TARGET_ARRAY_BUFFER,
+                owner
             );
 
             tinygltf::Accessor posAccessor;
             posAccessor.bufferView = posBufferView;
             posAccessor.byteOffset = offsetof(Vertex, position);
             posAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-            posAccessor.count = mesh.vertices.size();
+            posAccessor.count = vertices.size();
             posAccessor.type = TINYGLTF_TYPE_VEC3;
 
             // Calculate bounds
-            for (const auto& vertex : mesh.vertices) 
+            for (const auto& vertex : vertices) 
             {
                 for (int i = 0; i < 3; i++) {
                     if (posAccessor.minValues.empty()) 
@@ -658,7 +1702,7 @@ public:
             normalAccessor.bufferView = posBufferView;
             normalAccessor.byteOffset = offsetof(Vertex, normal);
             normalAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-            normalAccessor.count = mesh.vertices.size();
+            normalAccessor.count = vertices.size();
             normalAccessor.type = TINYGLTF_TYPE_VEC3;
 
             int normalAccessorIndex = static_cast<int>(model.accessors.size());
@@ -670,27 +1714,56 @@ public:
             texAccessor.bufferView = posBufferView;
             texAccessor.byteOffset = offsetof(Vertex, texcoord);
             texAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-            texAccessor.count = mesh.vertices.size();
+            texAccessor.count = vertices.size();
             texAccessor.type = TINYGLTF_TYPE_VEC2;
 
             int texAccessorIndex = static_cast<int>(model.accessors.size());
             model.accessors.push_back(texAccessor);
             primitive.attributes["TEXCOORD_0"] = texAccessorIndex;
+
+            // Tangents are in a stream of their own, Vertex doesn't have room for them
+            if (HasTangents(vertices, tangents))
+            {
+                int tangentBufferView = CreateBufferView(
+                    tangents->data(),
+                    tangents->size() * sizeof(float),
+                    TINYGLTF_TARGET_ARRAY_BUFFER,
+                    owner,
+                    sizeof(float) * 4
+                );
+
+                tinygltf::Accessor tangentAccessor;
+                tangentAccessor.bufferView = tangentBufferView;
+                tangentAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+                tangentAccessor.count = vertices.size();
+                tangentAccessor.type = TINYGLTF_TYPE_VEC4;
+
+                int tangentAccessorIndex = static_cast<int>(model.accessors.size());
+                model.accessors.push_back(tangentAccessor);
+                primitive.attributes["TANGENT"] = tangentAccessorIndex;
+            }
+
+            if (HasExtras(vertices, extras, part.extrasLayout))
+            {
+                AddExtraStreams(primitive, vertices.size(), *extras, part.extrasLayout);
+                AddMorphTargets(primitive, vertices.size(), *extras, part.extrasLayout);
+            }
         }
 
         // Indices
-        if (!mesh.indices.empty()) 
+        if (!indices.empty()) 
         {
             int indexBufferView = CreateBufferView(
-                mesh.indices.data(),
-                mesh.indices.size() * sizeof(uint32_t),
-                TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER
+                indices.data(),
+                indices.size() * sizeof(uint32_t),
+                TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER,
+                owner
             );
 
             tinygltf::Accessor indexAccessor;
             indexAccessor.bufferView = indexBufferView;
             indexAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
-            indexAccessor.count = mesh.indices.size();
+            indexAccessor.count = indices.size();
             indexAccessor.type = TINYGLTF_TYPE_SCALAR;
 
             int indexAccessorIndex = static_cast<int>(model.accessors.size());
@@ -706,108 +1779,718 @@ public:
             primitive.material = mesh.materialIndex;
         }
 
-        gltfMesh.primitives.push_back(primitive);
-
-        int meshIndex = static_cast<int>(model.meshes.size());
-        model.meshes.push_back(gltfMesh);
-        return meshIndex;
+        return primitive;
     }
 
-    // Add a node
-    int AddNode(const Node& node) 
+    // POINTS primitive of a point cloud: position, the normal if the cloud has them and the color, no uvs or indices
+    tinygltf::Primitive AddPointPrimitive(const Mesh& mesh, const MeshPart& part)
     {
-        tinygltf::Node gltfNode;
-        gltfNode.name = node.name;
-
-        // Transform matrix
-        gltfNode.matrix = {
-            node.transform[0], node.transform[1], node.transform[2], node.transform[3],
-            node.transform[4], node.transform[5], node.transform[6], node.transform[7],
-            node.transform[8], node.transform[9], node.transform[10], node.transform[11],
-            node.transform[12], node.transform[13], node.transform[14], node.transform[15]
-        };
+        const std::vector<Vertex>& points = *part.vertices;
+        const DracoBuffer& dracoData = *part.dracoData;
+        bool hasColor = part.extrasLayout.color && (part.info || HasExtras(points, part.extras, part.extrasLayout));
 
-        // Mesh reference
-        if (node.meshIndex >= 0) {
-            gltfNode.mesh = node.meshIndex;
+        tinygltf::Primitive primitive;
+        primitive.mode = TINYGLTF_MODE_POINTS;
+        if (mesh.materialIndex >= 0)
+        {
+            primitive.material = mesh.materialIndex;
         }
 
-        // Children
-        gltfNode.children = node.children;
-
-        int nodeIndex = static_cast<int>(model.nodes.size());
-        model.nodes.push_back(gltfNode);
+        if (mesh.useDracoCompression && !dracoData.empty())
+        {
+            MeshInfo described;
+            const MeshInfo* info = part.info;
+            if (!info)
+            {
+                described = DescribeMesh(points, {});
+                info = &described;
+            }
 
-        // Add to scene
-        model.scenes[0].nodes.push_back(nodeIndex);
+            // the accessors only describe what the draco data decodes to
+            auto addAccessor = [&](const char* name, int componentType, int type, bool normalized) {
+                tinygltf::Accessor accessor;
+                accessor.bufferView = -1;
+                accessor.componentType = componentType;
+                accessor.normalized = normalized;
+                accessor.count = info->vertexCount;
+                accessor.type = type;
+                primitive.attributes[name] = static_cast<int>(model.accessors.size());
+                model.accessors.push_back(std::move(accessor));
+            };
+            addAccessor("POSITION", TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, false);
+            model.accessors.back().minValues = info->boundsMin;
+            model.accessors.back().maxValues = info->boundsMax;
+
+            // ids in the order CompressPointCloud adds them
+            tinygltf::Value::Object attribObj;
+            int next = 0;
+            attribObj["POSITION"] = tinygltf::Value(next++);
+            if (mesh.normals)
+            {
+                addAccessor("NORMAL", TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, false);
+                attribObj["NORMAL"] = tinygltf::Value(next++);
+            }
+            if (hasColor)
+            {
+                addAccessor("COLOR_0", TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, TINYGLTF_TYPE_VEC4, true);
+                attribObj["COLOR_0"] = tinygltf::Value(next++);
+            }
 
-        return nodeIndex;
-    }
+            tinygltf::Value::Object dracoObj;
+            dracoObj["bufferView"] = tinygltf::Value(CreateBufferView(dracoData.data(), dracoData.size(), 0, part.owner));
+            dracoObj["attributes"] = tinygltf::Value(std::move(attribObj));
+            primitive.extensions["KHR_draco_mesh_compression"] = tinygltf::Value(std::move(dracoObj));
+            return primitive;
+        }
 
-    // Set up default sampler
-    void SetupDefaultSampler() 
-    {
-        if (model.samplers.empty()) 
+        if (points.empty())
         {
-            tinygltf::Sampler sampler;
-            sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
-            sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR;
-            sampler.wrapS = TINYGLTF_TEXTURE_WRAP_REPEAT;
-            sampler.wrapT = TINYGLTF_TEXTURE_WRAP_REPEAT;
-            model.samplers.push_back(sampler);
+            return primitive;
+        }
+        if (mesh.useDracoCompression)
+        {
+            std::cout << "Draco compression failed.. \n";
         }
-    }
-    void DeclareExtensions() 
-    {
-        model.extensionsUsed.push_back("KHR_draco_mesh_compression");
-        model.extensionsRequired.push_back("KHR_draco_mesh_compression");
-    }
-    // Export to file
-    bool ExportToFile(const std::string& filename, bool binary = false) 
-    {
-        SetupDefaultSampler();
-        DeclareExtensions();
-
-        tinygltf::TinyGLTF gltf;
 
-        if (binary) {
-            return gltf.WriteGltfSceneToFile(&model, filename, true, true, true, false);
+        // Vertex has room for a uv the points don't use, so the streams are packed into copies
+        std::vector<float> positions(points.size() * 3);
+        std::vector<float> normals(mesh.normals ? points.size() * 3 : 0);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            std::copy(points[i].position, points[i].position + 3, &positions[i * 3]);
+            if (mesh.normals)
+            {
+                std::copy(points[i].normal, points[i].normal + 3, &normals[i * 3]);
+            }
         }
-        else {
-            return gltf.WriteGltfSceneToFile(&model, filename, true, true, false, false);
+        MeshInfo info = DescribeMesh(points, {});
+
+        tinygltf::Accessor posAccessor;
+        posAccessor.bufferView = CreateBufferView(positions.data(), positions.size() * sizeof(float), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr,
+            sizeof(float) * 3);
+        posAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+        posAccessor.count = points.size();
+        posAccessor.type = TINYGLTF_TYPE_VEC3;
+        posAccessor.minValues = info.boundsMin;
+        posAccessor.maxValues = info.boundsMax;
+        primitive.attributes["POSITION"] = static_cast<int>(model.accessors.size());
+        model.accessors.push_back(std::move(posAccessor));
+
+        if (mesh.normals)
+        {
+            tinygltf::Accessor normalAccessor;
+            normalAccessor.bufferView = CreateBufferView(normals.data(), normals.size() * sizeof(float), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr,
+                sizeof(float) * 3);
+            normalAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+            normalAccessor.count = points.size();
+            normalAccessor.type = TINYGLTF_TYPE_VEC3;
+            primitive.attributes["NORMAL"] = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(std::move(normalAccessor));
+        }
+
+        if (hasColor)
+        {
+            AddExtraStreams(primitive, points.size(), *part.extras, part.extrasLayout);
         }
+        return primitive;
     }
 
-    // Export to string (JSON format only)
-    std::string ExportToString() 
+    // Uncompressed extras, every attribute in a stream of its own: the color and the weights as normalized bytes,
+    // the uv sets as floats and the joints as shorts.
+    // These are converted, so the buffer views get copies instead of pointing into extras
+    void AddExtraStreams(tinygltf::Primitive& primitive, size_t vertexCount, const std::vector<float>& extras, const VertexExtras& layout)
     {
-        SetupDefaultSampler();
+        size_t stride = layout.Stride();
+        size_t offset = 0;
+        if (layout.color)
+        {
+            std::vector<uint8_t> colors(vertexCount * 4);
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                ColorToBytes(&extras[i * stride], &colors[i * 4]);
+            }
+            int colorBufferView = CreateBufferView(colors.data(), colors.size(), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr, 4);
+
+            tinygltf::Accessor colorAccessor;
+            colorAccessor.bufferView = colorBufferView;
+            colorAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+            colorAccessor.normalized = true;
+            colorAccessor.count = vertexCount;
+            colorAccessor.type = TINYGLTF_TYPE_VEC4;
+
+            int colorAccessorIndex = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(colorAccessor);
+            primitive.attributes["COLOR_0"] = colorAccessorIndex;
+            offset += 4;
+        }
 
-        tinygltf::TinyGLTF gltf;
+        for (int set = 0; set < layout.uvSets; set++, offset += 2)
+        {
+            std::vector<float> uvs(vertexCount * 2);
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                uvs[i * 2] = extras[i * stride + offset];
+                uvs[i * 2 + 1] = extras[i * stride + offset + 1];
+            }
+            int uvBufferView = CreateBufferView(uvs.data(), uvs.size() * sizeof(float), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr, sizeof(float) * 2);
 
-        // Write to temporary file then read back
-        std::string tempFile = "temp_export.gltf";
-        bool success = gltf.WriteGltfSceneToFile(&model, tempFile, false, true, false, false);
+            tinygltf::Accessor uvAccessor;
+            uvAccessor.bufferView = uvBufferView;
+            uvAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+            uvAccessor.count = vertexCount;
+            uvAccessor.type = TINYGLTF_TYPE_VEC2;
 
-        if (!success) {
-            return "";
+            int uvAccessorIndex = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(uvAccessor);
+            primitive.attributes["TEXCOORD_" + std::to_string(set + 1)] = uvAccessorIndex;
         }
 
-        // Read file content
-        std::ifstream file(tempFile);
-        if (!file.is_open()) {
-            return "";
+        if (layout.skin)
+        {
+            std::vector<uint16_t> joints(vertexCount * 4);
+            std::vector<uint8_t> weights(vertexCount * 4);
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                SkinToIntegers(&extras[i * stride + offset], &joints[i * 4], &weights[i * 4]);
+            }
+            int jointsBufferView = CreateBufferView(joints.data(), joints.size() * sizeof(uint16_t), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr,
+                sizeof(uint16_t) * 4);
+            int weightsBufferView = CreateBufferView(weights.data(), weights.size(), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr, 4);
+
+            tinygltf::Accessor jointsAccessor;
+            jointsAccessor.bufferView = jointsBufferView;
+            jointsAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+            jointsAccessor.count = vertexCount;
+            jointsAccessor.type = TINYGLTF_TYPE_VEC4;
+
+            int jointsAccessorIndex = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(jointsAccessor);
+            primitive.attributes["JOINTS_0"] = jointsAccessorIndex;
+
+            tinygltf::Accessor weightsAccessor;
+            weightsAccessor.bufferView = weightsBufferView;
+            weightsAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+            weightsAccessor.normalized = true;
+            weightsAccessor.count = vertexCount;
+            weightsAccessor.type = TINYGLTF_TYPE_VEC4;
+
+            int weightsAccessorIndex = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(weightsAccessor);
+            primitive.attributes["WEIGHTS_0"] = weightsAccessorIndex;
         }
+    }
 
-        std::string json_string((std::istreambuf_iterator<char>(file)),
-            std::istreambuf_iterator<char>());
-
-        // Clean up temp file
-        std::remove(tempFile.c_str());
+    // Morph targets of an uncompressed primitive, from the position deltas in extras. Deltas within morphTolerance are
+    // dropped, so a target where most vertices stay put becomes a sparse accessor of the ones that move. The rest is
+    // quantized to normalized bytes or shorts (KHR_mesh_quantization) when that keeps them within morphTolerance too
+    void AddMorphTargets(tinygltf::Primitive& primitive, size_t vertexCount, const std::vector<float>& extras, const VertexExtras& layout)
+    {
+        size_t stride = layout.Stride();
+        for (int target = 0; target < layout.morphTargets; target++)
+        {
+            size_t offset = layout.MorphOffset() + static_cast<size_t>(target) * 3;
+            std::vector<uint32_t> moved;
+            float largest = 0.0f;
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                const float* delta = &extras[i * stride + offset];
+                float size = std::max({ std::fabs(delta[0]), std::fabs(delta[1]), std::fabs(delta[2]) });
+                if (size > morphTolerance)
+                {
+                    moved.push_back(static_cast<uint32_t>(i));
+                    largest = std::max(largest, size);
+                }
+            }
 
-        return json_string;
-    }
-};
+            // a normalized value can't go past 1, and rounds to half a step off at most
+            int componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+            size_t componentSize = sizeof(float);
+            float steps = 1.0f;
+            if (largest <= 1.0f && 0.5f / 127.0f <= morphTolerance)
+            {
+                componentType = TINYGLTF_COMPONENT_TYPE_BYTE;
+                componentSize = sizeof(int8_t);
+                steps = 127.0f;
+            }
+            else if (largest <= 1.0f && 0.5f / 32767.0f <= morphTolerance)
+            {
+                componentType = TINYGLTF_COMPONENT_TYPE_SHORT;
+                componentSize = sizeof(int16_t);
+                steps = 32767.0f;
+            }
+
+            // a dense attribute starts every element on 4 bytes, sparse values are packed
+            size_t elementSize = componentSize * 3;
+            size_t denseStride = (elementSize + 3) / 4 * 4;
+            size_t indexSize = vertexCount <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+            bool sparse = moved.size() * (indexSize + elementSize) < vertexCount * denseStride;
+
+            // the deltas as they go into the buffer, with their bounds in the same units
+            size_t count = sparse ? moved.size() : vertexCount;
+            size_t valueStride = sparse ? elementSize : denseStride;
+            std::vector<unsigned char> values(count * valueStride, 0);
+            // the vertices that don't move are zeros, also the ones a sparse accessor leaves out
+            std::vector<double> minValues;
+            std::vector<double> maxValues;
+            if (moved.size() < vertexCount)
+            {
+                minValues.assign(3, 0.0);
+                maxValues.assign(3, 0.0);
+            }
+            for (size_t m = 0; m < moved.size(); m++)
+            {
+                const float* delta = &extras[moved[m] * stride + offset];
+                unsigned char* out = &values[(sparse ? m : moved[m]) * valueStride];
+                for (int i = 0; i < 3; i++)
+                {
+                    double value = delta[i];
+                    if (componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
+                    {
+                        std::memcpy(out + i * sizeof(float), &delta[i], sizeof(float));
+                    }
+                    else
+                    {
+                        value = std::lround(std::clamp(delta[i], -1.0f, 1.0f) * steps);
+                        if (componentType == TINYGLTF_COMPONENT_TYPE_BYTE)
+                        {
+                            out[i] = static_cast<unsigned char>(static_cast<int8_t>(value));
+                        }
+                        else
+                        {
+                            int16_t component = static_cast<int16_t>(value);
+                            std::memcpy(out + i * sizeof(int16_t), &component, sizeof(int16_t));
+                        }
+                    }
+                    if (minValues.size() <= static_cast<size_t>(i))
+                    {
+                        minValues.push_back(value);
+                        maxValues.push_back(value);
+                    }
+                    minValues[i] = std::min(minValues[i], value);
+                    maxValues[i] = std::max(maxValues[i], value);
+                }
+            }
+
+            tinygltf::Accessor deltaAccessor;
+            deltaAccessor.componentType = componentType;
+            deltaAccessor.normalized = componentType != TINYGLTF_COMPONENT_TYPE_FLOAT;
+            deltaAccessor.count = vertexCount;
+            deltaAccessor.type = TINYGLTF_TYPE_VEC3;
+            deltaAccessor.minValues = minValues;
+            deltaAccessor.maxValues = maxValues;
+            if (moved.empty())
+            {
+                // no bufferView is all zeros
+            }
+            else if (sparse)
+            {
+                std::vector<unsigned char> indices(moved.size() * indexSize);
+                for (size_t m = 0; m < moved.size(); m++)
+                {
+                    if (indexSize == sizeof(uint16_t))
+                    {
+                        uint16_t index = static_cast<uint16_t>(moved[m]);
+                        std::memcpy(&indices[m * indexSize], &index, indexSize);
+                    }
+                    else
+                    {
+                        std::memcpy(&indices[m * indexSize], &moved[m], indexSize);
+                    }
+                }
+                deltaAccessor.sparse.isSparse = true;
+                deltaAccessor.sparse.count = static_cast<int>(moved.size());
+                deltaAccessor.sparse.indices.bufferView = CreateBufferView(indices.data(), indices.size());
+                deltaAccessor.sparse.indices.componentType = indexSize == sizeof(uint16_t) ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT :
+                    TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+                deltaAccessor.sparse.values.bufferView = CreateBufferView(values.data(), values.size());
+            }
+            else
+            {
+                deltaAccessor.bufferView = CreateBufferView(values.data(), values.size(), TINYGLTF_TARGET_ARRAY_BUFFER, nullptr, denseStride);
+            }
+            meshQuantization = meshQuantization || deltaAccessor.normalized;
+
+            int deltaAccessorIndex = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(deltaAccessor);
+            primitive.targets.push_back({ { "POSITION", deltaAccessorIndex } });
+        }
+    }
+
+    // Add a node
+    int AddNode(const Node& node) 
+    {
+        tinygltf::Node gltfNode;
+        gltfNode.name = node.name;
+
+        // Transform matrix
+        if (!node.animated)
+        {
+            gltfNode.matrix = {
+                node.transform[0], node.transform[1], node.transform[2], node.transform[3],
+                node.transform[4], node.transform[5], node.transform[6], node.transform[7],
+                node.transform[8], node.transform[9], node.transform[10], node.transform[11],
+                node.transform[12], node.transform[13], node.transform[14], node.transform[15]
+            };
+        }
+
+        // Mesh reference
+        if (node.meshIndex >= 0) {
+            gltfNode.mesh = node.meshIndex;
+        }
+        gltfNode.skin = node.skin;
+
+        // Children
+        gltfNode.children = node.children;
+
+        int nodeIndex = static_cast<int>(model.nodes.size());
+        model.nodes.push_back(gltfNode);
+
+        // Add to scene
+        model.scenes[0].nodes.push_back(nodeIndex);
+
+        return nodeIndex;
+    }
+
+    // Nodes of the skin's joints in their rest pose and the skin itself, the root joints go into the scene.
+    // jointNodes gets the node of every joint for the animation channels. Returns the skin's index
+    int AddSkin(const std::string& name, const SkinData& skin, std::vector<int>& jointNodes)
+    {
+        int firstNode = static_cast<int>(model.nodes.size());
+        jointNodes.clear();
+        for (size_t j = 0; j < skin.joints.size(); j++)
+        {
+            const JointData& joint = skin.joints[j];
+            tinygltf::Node gltfNode;
+            gltfNode.name = joint.name;
+            // only what differs from the default, most bones are just moved and turned
+            if (joint.translation[0] != 0.0f || joint.translation[1] != 0.0f || joint.translation[2] != 0.0f)
+            {
+                gltfNode.translation = { joint.translation[0], joint.translation[1], joint.translation[2] };
+            }
+            if (joint.rotation[0] != 0.0f || joint.rotation[1] != 0.0f || joint.rotation[2] != 0.0f || joint.rotation[3] != 1.0f)
+            {
+                gltfNode.rotation = { joint.rotation[0], joint.rotation[1], joint.rotation[2], joint.rotation[3] };
+            }
+            if (joint.scale[0] != 1.0f || joint.scale[1] != 1.0f || joint.scale[2] != 1.0f)
+            {
+                gltfNode.scale = { joint.scale[0], joint.scale[1], joint.scale[2] };
+            }
+            jointNodes.push_back(firstNode + static_cast<int>(j));
+            model.nodes.push_back(std::move(gltfNode));
+        }
+        for (size_t j = 0; j < skin.joints.size(); j++)
+        {
+            int parent = skin.joints[j].parent;
+            if (parent >= 0)
+            {
+                model.nodes[firstNode + parent].children.push_back(jointNodes[j]);
+            }
+            else
+            {
+                model.scenes[0].nodes.push_back(jointNodes[j]);
+            }
+        }
+
+        tinygltf::Skin gltfSkin;
+        gltfSkin.name = name;
+        gltfSkin.joints = jointNodes;
+        if (skin.inverseBindMatrices.size() == skin.joints.size() * 16)
+        {
+            int matrixBufferView = CreateBufferView(skin.inverseBindMatrices.data(), skin.inverseBindMatrices.size() * sizeof(float));
+
+            tinygltf::Accessor matrixAccessor;
+            matrixAccessor.bufferView = matrixBufferView;
+            matrixAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+            matrixAccessor.count = skin.joints.size();
+            matrixAccessor.type = TINYGLTF_TYPE_MAT4;
+
+            gltfSkin.inverseBindMatrices = static_cast<int>(model.accessors.size());
+            model.accessors.push_back(matrixAccessor);
+        }
+
+        int skinIndex = static_cast<int>(model.skins.size());
+        model.skins.push_back(std::move(gltfSkin));
+        return skinIndex;
+    }
+
+    // Adds the sampler and channel of one animated property of node to the animation called name.
+    // With quantize a rotation's keys are normalized shorts, the core spec allows that for rotations only
+    void AddAnimationChannel(const std::string& name, const AnimationChannelData& channel, int node, bool quantize)
+    {
+        int components = KeyComponents(channel);
+        size_t count = std::min(channel.times.size(), channel.values.size() / components);
+        if (count == 0 || node < 0)
+        {
+            return;
+        }
+
+        auto found = animationIndices.find(name);
+        if (found == animationIndices.end())
+        {
+            found = animationIndices.emplace(name, static_cast<int>(model.animations.size())).first;
+            model.animations.emplace_back();
+            model.animations.back().name = name;
+        }
+        tinygltf::Animation& animation = model.animations[found->second];
+
+        // Key times
+        int inputBufferView = CreateBufferView(channel.times.data(), count * sizeof(float));
+
+        tinygltf::Accessor inputAccessor;
+        inputAccessor.bufferView = inputBufferView;
+        inputAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+        inputAccessor.count = count;
+        inputAccessor.type = TINYGLTF_TYPE_SCALAR;
+        inputAccessor.minValues = { channel.times[0] };
+        inputAccessor.maxValues = { channel.times[count - 1] };
+
+        int inputAccessorIndex = static_cast<int>(model.accessors.size());
+        model.accessors.push_back(inputAccessor);
+
+        // Key values
+        tinygltf::Accessor outputAccessor;
+        if (quantize && components == 4)
+        {
+            std::vector<int16_t> rotations(count * 4);
+            for (size_t i = 0; i < rotations.size(); i++)
+            {
+                rotations[i] = static_cast<int16_t>(std::lround(std::clamp(channel.values[i], -1.0f, 1.0f) * 32767.0f));
+            }
+            outputAccessor.bufferView = CreateBufferView(rotations.data(), rotations.size() * sizeof(int16_t));
+            outputAccessor.componentType = TINYGLTF_COMPONENT_TYPE_SHORT;
+            outputAccessor.normalized = true;
+        }
+        else
+        {
+            outputAccessor.bufferView = CreateBufferView(channel.values.data(), count * components * sizeof(float));
+            outputAccessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+        }
+        outputAccessor.count = count;
+        outputAccessor.type = components == 4 ? TINYGLTF_TYPE_VEC4 : TINYGLTF_TYPE_VEC3;
+
+        int outputAccessorIndex = static_cast<int>(model.accessors.size());
+        model.accessors.push_back(outputAccessor);
+
+        tinygltf::AnimationSampler sampler;
+        sampler.input = inputAccessorIndex;
+        sampler.output = outputAccessorIndex;
+        sampler.interpolation = channel.interpolation;
+
+        tinygltf::AnimationChannel gltfChannel;
+        gltfChannel.sampler = static_cast<int>(animation.samplers.size());
+        gltfChannel.target_node = node;
+        gltfChannel.target_path = channel.path;
+
+        animation.samplers.push_back(std::move(sampler));
+        animation.channels.push_back(std::move(gltfChannel));
+    }
+
+    // Set up default sampler
+    void SetupDefaultSampler() 
+    {
+        if (model.samplers.empty()) 
+        {
+            tinygltf::Sampler sampler;
+            sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+            sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR;
+            sampler.wrapS = TINYGLTF_TEXTURE_WRAP_REPEAT;
+            sampler.wrapT = TINYGLTF_TEXTURE_WRAP_REPEAT;
+            model.samplers.push_back(sampler);
+        }
+    }
+    void DeclareExtensions() 
+    {
+        model.extensionsUsed.push_back("KHR_draco_mesh_compression");
+        model.extensionsRequired.push_back("KHR_draco_mesh_compression");
+        if (meshQuantization)
+        {
+            model.extensionsUsed.push_back("KHR_mesh_quantization");
+            model.extensionsRequired.push_back("KHR_mesh_quantization");
+        }
+    }
+    // Export to file
+    bool ExportToFile(const std::string& filename, bool binary = false) 
+    {
+        if (binary && embedImages)
+        {
+            EmbedImages();
+        }
+        if (loadOrder)
+        {
+            LayOutForLoading();
+        }
+        if (streamingJson && mapBuffer && model.buffers.size() == 1 && plannedBufferSizes[0] > 0)
+        {
+            return ExportMapped(filename, binary);
+        }
+
+        WriteBufferViews();
+        SetupDefaultSampler();
+        DeclareExtensions();
+
+        if (streamingJson)
+        {
+            PROFILE_SCOPE("WriteGltfFile");
+            GltfWriteOptions options;
+            options.binary = binary;
+            options.compact = compactJson;
+
+            std::vector<std::string> writtenFiles;
+            bool success = WriteGltfFile(model, filename, options, writtenFiles, fileWriter);
+            for (const auto& path : writtenFiles)
+            {
+                if (progress)
+                {
+                    progress->TrackFile(path);
+                }
+                if (path != filename)
+                {
+                    bufferFiles.push_back(path);
+                }
+            }
+            // the textures and buffers still in the writer's queue have to be on disk before we are done
+            return FinishFileWrites() && success;
+        }
+
+        // the old way through tinygltf's json document, buffers end up base64 encoded in the json.
+        // Kept around to compare against
+        PROFILE_SCOPE("WriteGltfSceneToFile");
+        tinygltf::TinyGLTF gltf;
+
+        bool texturesWritten = FinishFileWrites();
+        if (binary) {
+            return gltf.WriteGltfSceneToFile(&model, filename, true, true, !compactJson, true) && texturesWritten;
+        }
+        else {
+            return gltf.WriteGltfSceneToFile(&model, filename, true, true, !compactJson, false) && texturesWritten;
+        }
+    }
+
+    // ExportToFile for big scenes: the buffer goes straight from the meshes into the mapped .bin or .glb,
+    // the OS pages it out as it fills up so it never has to fit in memory as a whole
+    bool ExportMapped(const std::string& filename, bool binary)
+    {
+        PROFILE_FUNCTION();
+        SetupDefaultSampler();
+        DeclareExtensions();
+
+        GltfWriteOptions options;
+        options.binary = binary;
+        options.compact = compactJson;
+
+        std::vector<std::string> writtenFiles;
+        bool success = WriteMappedGltfFile(model, filename, options, plannedBufferSizes[0],
+            [this](unsigned char* destination) { WriteBufferViews(destination); }, writtenFiles);
+        for (const auto& path : writtenFiles)
+        {
+            if (progress)
+            {
+                progress->TrackFile(path);
+            }
+            if (path != filename)
+            {
+                bufferFiles.push_back(path);
+            }
+        }
+        return FinishFileWrites() && success;
+    }
+
+    bool FinishFileWrites()
+    {
+        PROFILE_FUNCTION();
+        return !fileWriter || fileWriter->Finish();
+    }
+
+    // The kept textures go into the buffer: images point at a bufferView instead of a file,
+    // planned like the meshes so they are copied in once
+    void EmbedImages()
+    {
+        std::vector<MemoryFile> textures;
+        {
+            std::lock_guard<std::mutex> lock(memoryTexturesMutex);
+            textures.swap(memoryTextures);
+        }
+        for (auto& image : model.images)
+        {
+            auto texture = std::find_if(textures.begin(), textures.end(), [&](const MemoryFile& file) { return file.name == image.uri; });
+            if (texture != textures.end())
+            {
+                image.bufferView = CreateBufferView(texture->data, texture->size, 0, texture->owner);
+                image.uri.clear();
+            }
+        }
+    }
+
+    // Export to memory: the .glb, or the .gltf with its .bin files and the textures, named after filename.
+    // A glb gets the textures in its BIN chunk, so it is the only file.
+    bool ExportToMemory(const std::string& filename, bool binary, std::vector<MemoryFile>& files)
+    {
+        PROFILE_FUNCTION();
+        if (binary)
+        {
+            EmbedImages();
+        }
+        std::vector<MemoryFile> textures;
+        {
+            std::lock_guard<std::mutex> lock(memoryTexturesMutex);
+            textures.swap(memoryTextures);
+        }
+
+        if (loadOrder)
+        {
+            LayOutForLoading();
+        }
+        WriteBufferViews();
+        SetupDefaultSampler();
+        DeclareExtensions();
+
+        size_t lastSlash = filename.find_last_of("/\\");
+        std::string name = lastSlash != std::string::npos ? filename.substr(lastSlash + 1) : filename;
+
+        if (binary)
+        {
+            auto glb = std::make_shared<std::vector<unsigned char>>();
+            if (!WriteGlb(model, compactJson, *glb))
+            {
+                return false;
+            }
+            files.push_back({ name, glb->data(), glb->size(), glb });
+            return true;
+        }
+
+        std::vector<std::string> bufferUris = BufferFileUris(model, filename, false);
+        auto json = std::make_shared<std::string>();
+        WriteGltfJson(model, *json, compactJson, bufferUris);
+        files.push_back({ name, reinterpret_cast<const unsigned char*>(json->data()), json->size(), json });
+
+        // the buffers are handed over as they are, the next export allocates new ones
+        for (size_t i = 0; i < model.buffers.size(); i++)
+        {
+            auto data = std::make_shared<std::vector<unsigned char>>(std::move(model.buffers[i].data));
+            files.push_back({ bufferUris[i], data->data(), data->size(), data });
+        }
+        files.insert(files.end(), std::make_move_iterator(textures.begin()), std::make_move_iterator(textures.end()));
+        return true;
+    }
+
+    // Export to string (JSON format only), with the buffer embedded as base64
+    std::string ExportToString() 
+    {
+        WriteBufferViews();
+        SetupDefaultSampler();
+
+        std::vector<std::string> bufferUris;
+        for (const auto& buffer : model.buffers)
+        {
+            bufferUris.push_back("data:application/octet-stream;base64," +
+                tinygltf::base64_encode(buffer.data.data(), static_cast<unsigned int>(buffer.data.size())));
+        }
+
+        std::string json;
+        WriteGltfJson(model, json, compactJson, bufferUris);
+        return json;
+    }
+};
 
 template <typename T>
 std::vector<T> NumpyArrayToVector(py::array_t<T>& arrIn)
@@ -822,197 +2505,1764 @@ std::vector<T> NumpyArrayToVector(py::array_t<T>& arrIn)
         num_vertices *= dim;
     }
 
-    vecOut.reserve(num_vertices);
+    // one bulk copy out of the numpy buffer
+    vecOut.assign(data, data + num_vertices);
+    return vecOut;
+}
+
+std::vector<Vertex> StoreInVertex(
+    const std::vector<float>& positions,
+    const std::vector<float>& normals,
+    const std::vector<float>& uvs,
+    const std::vector<uint32_t>& indices,
+    const ExportProgress* progress)
+{
+    std::vector<Vertex> vertices;
+    StoreInVertex(positions, normals, uvs, indices, vertices, progress);
+    return vertices;
+}
+
+// Number of face corners the mesh data has, with a warning when there are fewer indices than normals
+static size_t FaceCornerCount(ArrayView<float> normals, ArrayView<uint32_t> indices)
+{
+    size_t num_face_vertices = normals.size() / 3;
+
+    // Bounds check on indices
+    if (num_face_vertices > indices.size()) {
+        std::cerr << "Index i=" << indices.size() << " out of bounds for indices" << std::endl;
+        num_face_vertices = indices.size();
+    }
+    return num_face_vertices;
+}
+
+// Turns face corners [first, first + count) into vertices, vertices[0] is corner first
+static void StoreCornersInVertices(
+    ArrayView<float> positions,
+    ArrayView<float> normals,
+    ArrayView<float> uvs,
+    ArrayView<uint32_t> indices,
+    size_t first,
+    size_t count,
+    bool hasUVs,
+    Vertex* vertices,
+    const ExportProgress* progress)
+{
+    std::atomic<size_t> badPositions{ 0 };
+
+    // Every face corner is independent so the corners get split over the scheduler workers
+    GetScheduler().ParallelFor(count, 16384, [&](size_t begin, size_t end)
+    {
+        if (progress) {
+            progress->ThrowIfCancelled();
+        }
+
+        for (size_t i = first + begin; i < first + end; i++)
+        {
+            Vertex& v = vertices[i - first];
+            uint32_t pos_index = indices[i];
+
+            // positions
+            if (pos_index * 3 + 2 >= positions.size()) {
+                badPositions++;
+                v = Vertex{};
+                continue;
+            }
+
+            // We switch Y and Z because blender is Z-Up whilst gltf is Y-Up
+            // Y also becomes inverted to avoid a mirrored mesh
+
+            v.position[0] = positions[pos_index * 3 + 0];
+            v.position[1] = positions[pos_index * 3 + 2];
+            v.position[2] = -positions[pos_index * 3 + 1];
+
+            // normals
+            v.normal[0] = normals[i * 3 + 0];
+            v.normal[1] = normals[i * 3 + 2];
+            v.normal[2] = -normals[i * 3 + 1];
+
+            // UV 
+            if (hasUVs) {
+                v.texcoord[0] = uvs[i * 2 + 0];
+                v.texcoord[1] = uvs[i * 2 + 1];
+            }
+            else {
+                v.texcoord[0] = 0.0f;
+                v.texcoord[1] = 0.0f;
+            }
+        }
+    });
 
-    for (size_t i = 0; i < num_vertices; i++)
+    if (badPositions > 0) {
+        std::cerr << badPositions << " position indices out of bounds, written as zero vertices" << std::endl;
+    }
+}
+
+void StoreInVertex(
+    const std::vector<float>& positions,
+    const std::vector<float>& normals,
+    const std::vector<float>& uvs,
+    const std::vector<uint32_t>& indices,
+    std::vector<Vertex>& vertices,
+    const ExportProgress* progress)
+{
+    PROFILE_FUNCTION();
+    size_t num_face_vertices = FaceCornerCount(normals, indices);
+
+    // resize instead of a new vector so a reused vector keeps its memory
+    vertices.resize(num_face_vertices);
+    bool hasUVs = !uvs.empty() && (uvs.size() >= num_face_vertices * 2);
+    StoreCornersInVertices(positions, normals, uvs, indices, 0, num_face_vertices, hasUVs, vertices.data(), progress);
+}
+
+// The object's positions, normals, uvs and indices, wherever they are
+static MeshArrays Arrays(const ObjectData& object)
+{
+    if (object.borrowed.owner)
+    {
+        return object.borrowed;
+    }
+    return { object.positions, object.normals, object.uvs, object.indices, nullptr };
+}
+
+// The color and the extra uv sets the object has for every face corner. Uv sets stop at the first one that falls short
+static VertexExtras ExtrasLayout(const ObjectData& object)
+{
+    MeshArrays arrays = Arrays(object);
+    size_t num_face_vertices = FaceCornerCount(arrays.normals, arrays.indices);
+    VertexExtras layout;
+    layout.color = num_face_vertices > 0 && object.colors.size() >= num_face_vertices * 4;
+    while (num_face_vertices > 0 && static_cast<size_t>(layout.uvSets) < object.uvSets.size() &&
+        object.uvSets[layout.uvSets].size() >= num_face_vertices * 2)
+    {
+        layout.uvSets++;
+    }
+    layout.skin = num_face_vertices > 0 && object.joints.size() >= num_face_vertices * 4 && object.weights.size() >= num_face_vertices * 4;
+    layout.morphTargets = num_face_vertices > 0 ? static_cast<int>(object.morphTargets.size()) : 0;
+    return layout;
+}
+
+// Extras of face corners [first, first + count), layout.Stride() floats per corner
+static void StoreCornerExtras(
+    const ObjectData& object,
+    const VertexExtras& layout,
+    size_t first,
+    size_t count,
+    float* extras)
+{
+    size_t stride = layout.Stride();
+    MeshArrays arrays = Arrays(object);
+    GetScheduler().ParallelFor(count, 16384, [&](size_t begin, size_t end)
+    {
+        for (size_t i = first + begin; i < first + end; i++)
+        {
+            float* out = extras + (i - first) * stride;
+            if (layout.color)
+            {
+                std::copy(&object.colors[i * 4], &object.colors[i * 4] + 4, out);
+                out += 4;
+            }
+            for (int set = 0; set < layout.uvSets; set++)
+            {
+                out[0] = object.uvSets[set][i * 2 + 0];
+                out[1] = object.uvSets[set][i * 2 + 1];
+                out += 2;
+            }
+            if (layout.skin)
+            {
+                // joint indices fit a float exactly
+                std::copy(&object.joints[i * 4], &object.joints[i * 4] + 4, out);
+                std::copy(&object.weights[i * 4], &object.weights[i * 4] + 4, out + 4);
+                out += 8;
+            }
+            // the deltas turned to Y-up like the positions, a corner with a bad position doesn't move
+            size_t p = static_cast<size_t>(arrays.indices[i]) * 3;
+            for (int target = 0; target < layout.morphTargets; target++, out += 3)
+            {
+                const std::vector<float>& moved = object.morphTargets[target].positions;
+                bool valid = p + 2 < arrays.positions.size();
+                out[0] = valid ? moved[p + 0] - arrays.positions[p + 0] : 0.0f;
+                out[1] = valid ? moved[p + 2] - arrays.positions[p + 2] : 0.0f;
+                out[2] = valid ? arrays.positions[p + 1] - moved[p + 1] : 0.0f;
+            }
+        }
+    });
+}
+
+// Points [first, first + count) of a point cloud turned to Y-up vertices, plus their rgba in colors when it isn't null.
+// Points without normals get a zero normal, it doesn't get exported
+static void StorePoints(const ObjectData& cloud, size_t first, size_t count, Vertex* vertices, float* colors)
+{
+    bool hasNormals = cloud.normals.size() == cloud.positions.size();
+    for (size_t i = first; i < first + count; i++)
+    {
+        Vertex& v = vertices[i - first];
+        const float* p = &cloud.positions[i * 3];
+        v.position[0] = p[0];
+        v.position[1] = p[2];
+        v.position[2] = -p[1];
+        const float* n = hasNormals ? &cloud.normals[i * 3] : nullptr;
+        v.normal[0] = n ? n[0] : 0.0f;
+        v.normal[1] = n ? n[2] : 0.0f;
+        v.normal[2] = n ? -n[1] : 0.0f;
+        v.texcoord[0] = 0.0f;
+        v.texcoord[1] = 0.0f;
+        if (colors)
+        {
+            std::copy(&cloud.colors[i * 4], &cloud.colors[i * 4] + 4, colors + (i - first) * 4);
+        }
+    }
+}
+
+// Out-of-core version for meshes too big to expand at once: the corners are converted a window at a time and
+// go straight into the chunker's buckets on disk. A borrowed object's windows come straight out of the numpy arrays
+static bool StoreInChunks(
+    const ObjectData& object,
+    const VertexExtras& extrasLayout,
+    MeshChunker& chunker,
+    size_t windowCorners,
+    const ExportProgress* progress)
+{
+    PROFILE_FUNCTION();
+    MeshArrays arrays = Arrays(object);
+    ArrayView<float> positions = arrays.positions;
+    ArrayView<float> normals = arrays.normals;
+    ArrayView<float> uvs = arrays.uvs;
+    ArrayView<uint32_t> indices = arrays.indices;
+    size_t num_face_vertices = FaceCornerCount(normals, indices);
+    num_face_vertices -= num_face_vertices % 3;
+    bool hasUVs = !uvs.empty() && (uvs.size() >= num_face_vertices * 2);
+
+    // bounds in gltf space, same swap as in StoreCornersInVertices
+    float boundsMin[3] = { 0.0f, 0.0f, 0.0f };
+    float boundsMax[3] = { 0.0f, 0.0f, 0.0f };
+    for (size_t p = 0; p + 2 < positions.size(); p += 3)
+    {
+        float position[3] = { positions[p], positions[p + 2], -positions[p + 1] };
+        for (int i = 0; i < 3; i++)
+        {
+            boundsMin[i] = p == 0 ? position[i] : std::min(boundsMin[i], position[i]);
+            boundsMax[i] = p == 0 ? position[i] : std::max(boundsMax[i], position[i]);
+        }
+    }
+    if (!chunker.Begin(boundsMin, boundsMax, num_face_vertices / 3))
+    {
+        return false;
+    }
+
+    windowCorners = std::max<size_t>(3, windowCorners - windowCorners % 3);
+    std::vector<Vertex> window(std::min(windowCorners, num_face_vertices));
+    std::vector<float> windowExtras(window.size() * extrasLayout.Stride());
+    for (size_t first = 0; first < num_face_vertices; first += windowCorners)
+    {
+        size_t count = std::min(windowCorners, num_face_vertices - first);
+        StoreCornersInVertices(positions, normals, uvs, indices, first, count, hasUVs, window.data(), progress);
+        StoreCornerExtras(object, extrasLayout, first, count, windowExtras.data());
+        if (!chunker.AddTriangles(window.data(), windowExtras.data(), count))
+        {
+            return false;
+        }
+    }
+    return chunker.EndInput();
+}
+
+// Blender is Z-up, glTF Y-up: the same turn StoreInVertex gives the positions, (x, y, z) becomes (x, z, -y)
+static void TranslationToYUp(float* t)
+{
+    float y = t[1];
+    t[1] = t[2];
+    t[2] = -y;
+}
+
+// the rotation's axis turns like a position, the angle stays
+static void RotationToYUp(float* q)
+{
+    TranslationToYUp(q);
+}
+
+static void ScaleToYUp(float* s)
+{
+    std::swap(s[1], s[2]);
+}
+
+// turn * m * turn^-1, column major
+static void MatrixToYUp(float* m)
+{
+    const float turn[16] = { 1,0,0,0, 0,0,-1,0, 0,1,0,0, 0,0,0,1 };
+    const float back[16] = { 1,0,0,0, 0,0,1,0, 0,-1,0,0, 0,0,0,1 };
+    auto multiply = [](const float* a, const float* b, float* out) {
+        for (int col = 0; col < 4; col++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                float sum = 0.0f;
+                for (int k = 0; k < 4; k++)
+                {
+                    sum += a[k * 4 + row] * b[col * 4 + k];
+                }
+                out[col * 4 + row] = sum;
+            }
+        }
+    };
+    float turned[16];
+    multiply(turn, m, turned);
+    multiply(turned, back, m);
+}
+
+// Copies up to count floats of a python sequence into out
+static void CopyFloats(const py::handle& values, float* out, size_t count)
+{
+    py::array_t<float> array = values.cast<py::array_t<float>>();
+    std::vector<float> copied = NumpyArrayToVector(array);
+    std::copy_n(copied.begin(), std::min(count, copied.size()), out);
+}
+
+// Optional armature of the object: "joints"/"weights" per face corner and a "skin" dict with the joints
+// ({name, parent, translation, rotation, scale}) and their inverse bind matrices, in blender's axes like the positions.
+// A skin that doesn't add up is dropped
+static void IngestSkin(const py::dict& mesh_data, ObjectData& object)
+{
+    if (!mesh_data.contains("skin") || mesh_data["skin"].is_none() || !mesh_data.contains("joints") || !mesh_data.contains("weights"))
+    {
+        return;
+    }
+    py::dict skin = mesh_data["skin"].cast<py::dict>();
+    for (const auto& item : skin["joints"].cast<py::list>())
+    {
+        py::dict jointDict = item.cast<py::dict>();
+        JointData joint;
+        joint.name = jointDict["name"].cast<std::string>();
+        joint.parent = jointDict.contains("parent") && !jointDict["parent"].is_none() ? jointDict["parent"].cast<int>() : -1;
+        if (jointDict.contains("translation"))
+        {
+            CopyFloats(jointDict["translation"], joint.translation, 3);
+            TranslationToYUp(joint.translation);
+        }
+        if (jointDict.contains("rotation"))
+        {
+            CopyFloats(jointDict["rotation"], joint.rotation, 4);
+            RotationToYUp(joint.rotation);
+        }
+        if (jointDict.contains("scale"))
+        {
+            CopyFloats(jointDict["scale"], joint.scale, 3);
+            ScaleToYUp(joint.scale);
+        }
+        object.skin.joints.push_back(std::move(joint));
+    }
+    if (skin.contains("inverse_bind_matrices") && !skin["inverse_bind_matrices"].is_none())
+    {
+        py::array_t<float> matrices = skin["inverse_bind_matrices"].cast<py::array_t<float>>();
+        object.skin.inverseBindMatrices = NumpyArrayToVector(matrices);
+        for (size_t m = 0; m + 16 <= object.skin.inverseBindMatrices.size(); m += 16)
+        {
+            MatrixToYUp(&object.skin.inverseBindMatrices[m]);
+        }
+    }
+    py::array_t<uint16_t> joints = mesh_data["joints"].cast<py::array_t<uint16_t>>();
+    py::array_t<float> weights = mesh_data["weights"].cast<py::array_t<float>>();
+    object.joints = NumpyArrayToVector(joints);
+    object.weights = NumpyArrayToVector(weights);
+
+    size_t jointCount = object.skin.joints.size();
+    bool valid = jointCount > 0 && object.joints.size() == object.weights.size();
+    for (size_t j = 0; j < jointCount && valid; j++)
+    {
+        // parents first, so the joint nodes can be linked up in one go
+        valid = object.skin.joints[j].parent < static_cast<int>(j);
+    }
+    for (size_t i = 0; i < object.joints.size() && valid; i++)
+    {
+        valid = object.joints[i] < jointCount;
+    }
+    if (!valid)
+    {
+        std::cerr << "Skin of " << object.name << " has joints out of order or out of range, exported without it" << std::endl;
+        object.skin = SkinData();
+        object.joints.clear();
+        object.weights.clear();
+        return;
+    }
+    if (!object.skin.inverseBindMatrices.empty() && object.skin.inverseBindMatrices.size() != jointCount * 16)
+    {
+        std::cerr << "Skin of " << object.name << " needs 16 inverse bind matrix values per joint, using identities" << std::endl;
+        object.skin.inverseBindMatrices.clear();
+    }
+}
+
+// Optional "animations": a list of {name, channels}, a channel is {joint, path, interpolation, times, values}.
+// Channels whose keys don't add up are dropped
+static void IngestAnimations(const py::dict& mesh_data, ObjectData& object)
+{
+    if (!mesh_data.contains("animations") || mesh_data["animations"].is_none())
+    {
+        return;
+    }
+    for (const auto& item : mesh_data["animations"].cast<py::list>())
+    {
+        py::dict animationDict = item.cast<py::dict>();
+        AnimationData animation;
+        animation.name = animationDict["name"].cast<std::string>();
+        for (const auto& channelItem : animationDict["channels"].cast<py::list>())
+        {
+            py::dict channelDict = channelItem.cast<py::dict>();
+            AnimationChannelData channel;
+            channel.joint = channelDict.contains("joint") && !channelDict["joint"].is_none() ? channelDict["joint"].cast<int>() : -1;
+            channel.path = channelDict["path"].cast<std::string>();
+            if (channelDict.contains("interpolation"))
+            {
+                channel.interpolation = channelDict["interpolation"].cast<std::string>();
+            }
+            py::array_t<float> times = channelDict["times"].cast<py::array_t<float>>();
+            py::array_t<float> values = channelDict["values"].cast<py::array_t<float>>();
+            channel.times = NumpyArrayToVector(times);
+            channel.values = NumpyArrayToVector(values);
+
+            size_t components = static_cast<size_t>(KeyComponents(channel));
+            bool valid = (channel.path == "translation" || channel.path == "rotation" || channel.path == "scale") &&
+                (channel.interpolation == "LINEAR" || channel.interpolation == "STEP") &&
+                !channel.times.empty() && channel.values.size() == channel.times.size() * components &&
+                channel.joint < static_cast<int>(object.skin.joints.size());
+            for (size_t k = 1; k < channel.times.size() && valid; k++)
+            {
+                valid = channel.times[k] > channel.times[k - 1];
+            }
+            if (!valid)
+            {
+                std::cerr << "Dropped a " << channel.path << " channel of animation " << animation.name << " on " << object.name
+                    << ": its target, interpolation or keys don't add up" << std::endl;
+                continue;
+            }
+            for (size_t k = 0; k < channel.values.size(); k += components)
+            {
+                float* key = &channel.values[k];
+                if (channel.path == "rotation")
+                {
+                    RotationToYUp(key);
+                }
+                else if (channel.path == "scale")
+                {
+                    ScaleToYUp(key);
+                }
+                else
+                {
+                    TranslationToYUp(key);
+                }
+            }
+            animation.channels.push_back(std::move(channel));
+        }
+        if (!animation.channels.empty())
+        {
+            object.animations.push_back(std::move(animation));
+        }
+    }
+}
+
+// Optional "morph_targets": a list of {name, positions}, the positions like "vertices". A target with a
+// different number of positions is dropped
+static void IngestMorphTargets(const py::dict& mesh_data, ObjectData& object)
+{
+    if (!mesh_data.contains("morph_targets") || mesh_data["morph_targets"].is_none())
+    {
+        return;
+    }
+    size_t positionCount = Arrays(object).positions.size();
+    for (const auto& item : mesh_data["morph_targets"].cast<py::list>())
+    {
+        py::dict targetDict = item.cast<py::dict>();
+        MorphTargetData target;
+        target.name = targetDict["name"].cast<std::string>();
+        py::array_t<float> positions = targetDict["positions"].cast<py::array_t<float>>();
+        target.positions = NumpyArrayToVector(positions);
+        if (target.positions.size() != positionCount)
+        {
+            std::cerr << "Morph target " << target.name << " of " << object.name << " has " << target.positions.size() / 3
+                << " positions instead of " << positionCount / 3 << ", dropped" << std::endl;
+            continue;
+        }
+        object.morphTargets.push_back(std::move(target));
+    }
+}
+
+// Arrays let go of without the GIL, they wait here for the next call from python
+static std::mutex releasedArraysMutex;
+static std::vector<PyObject*> releasedArrays;
+
+// Keeps a python object alive for an export, which may be done with it on a worker that can't take the GIL:
+// python could be holding the GIL while it waits for that worker
+static std::shared_ptr<const void> KeepAlive(py::object object)
+{
+    return std::shared_ptr<const void>(object.release().ptr(), [](const void* pointer) {
+        PyObject* released = static_cast<PyObject*>(const_cast<void*>(pointer));
+        if (PyGILState_Check())
+        {
+            Py_DECREF(released);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(releasedArraysMutex);
+        releasedArrays.push_back(released);
+    });
+}
+
+void ReleaseFinishedArrays()
+{
+    std::vector<PyObject*> released;
+    {
+        std::lock_guard<std::mutex> lock(releasedArraysMutex);
+        released.swap(releasedArrays);
+    }
+    for (PyObject* object : released)
+    {
+        Py_DECREF(object);
+    }
+}
+
+template <typename T>
+static ArrayView<T> NumpyArrayView(const py::array_t<T>& array)
+{
+    return ArrayView<T>(array.data(), static_cast<size_t>(array.size()));
+}
+
+ObjectData IngestBlenderData(const py::dict& mesh_data, const py::list& textures, size_t borrowTriangles)
+{
+    PROFILE_FUNCTION();
+    ReleaseFinishedArrays();
+    ObjectData object;
+
+    // Process mesh data: 
+    
+    auto vertices = mesh_data["vertices"].cast<py::array_t<float>>();
+    auto normals = mesh_data["normals"].cast<py::array_t<float>>();
+    auto indices = mesh_data["indices"].cast<py::array_t<uint32_t>>();
+
+    // Handle optional UVs
+    py::array_t<float> uvs;
+    if (!mesh_data["uvs"].is_none()) {
+        uvs = mesh_data["uvs"].cast<py::array_t<float>>();
+    }
+
+    if (borrowTriangles > 0 && static_cast<size_t>(indices.size()) / 3 > borrowTriangles)
+    {
+        // goes into chunks a window at a time, a copy of the whole mesh would only double what it takes
+        object.borrowed.positions = NumpyArrayView(vertices);
+        object.borrowed.normals = NumpyArrayView(normals);
+        object.borrowed.indices = NumpyArrayView(indices);
+        object.borrowed.uvs = NumpyArrayView(uvs);
+        object.borrowed.owner = KeepAlive(py::make_tuple(vertices, normals, indices, uvs));
+    }
+    else
+    {
+        object.positions = NumpyArrayToVector(vertices);
+        object.normals = NumpyArrayToVector(normals);
+        object.indices = NumpyArrayToVector(indices);
+        object.uvs = NumpyArrayToVector(uvs);
+    }
+    object.name = mesh_data["name"].cast<std::string>();
+
+    // Optional color (rgba per face corner) and extra uv sets (a list, TEXCOORD_1 and up)
+    if (mesh_data.contains("colors") && !mesh_data["colors"].is_none()) {
+        py::array_t<float> colors = mesh_data["colors"].cast<py::array_t<float>>();
+        object.colors = NumpyArrayToVector(colors);
+    }
+    if (mesh_data.contains("uv_sets") && !mesh_data["uv_sets"].is_none()) {
+        for (const auto& set : mesh_data["uv_sets"].cast<py::list>()) {
+            py::array_t<float> uvSet = set.cast<py::array_t<float>>();
+            object.uvSets.push_back(NumpyArrayToVector(uvSet));
+        }
+    }
+    IngestSkin(mesh_data, object);
+    IngestAnimations(mesh_data, object);
+    IngestMorphTargets(mesh_data, object);
+    
+    // Process all the textures
+    for (size_t i = 0; i < textures.size(); i++) 
+    {
+        // Cast it to a dict so we can lookup the type
+        py::dict tex = textures[i].cast<py::dict>();
+        std::string type = tex["type"].cast<std::string>();
+
+        TextureData texData;
+        texData.type = type;
+        texData.name = tex["name"].cast<std::string>();
+
+        if (type == "file") {
+            texData.filepath = tex["path"].cast<std::string>();
+        }
+        else if (type == "packed") 
+        {
+            py::array_t<uint8_t> pixel_data = tex["data"].cast<py::array_t<uint8_t>>();
+            auto buf = pixel_data.request();
+
+            texData.data = std::vector<uint8_t>(
+                static_cast<uint8_t*>(buf.ptr),
+                static_cast<uint8_t*>(buf.ptr) + buf.size
+            );
+            texData.width = tex["width"].cast<int>();
+            texData.height = tex["height"].cast<int>();
+            texData.channels = tex["channels"].cast<int>();
+        }
+
+        object.textures.push_back(std::move(texData));
+    }
+
+    return object;
+}
+
+// Frees the memory itself, clear() would keep it
+template <typename T>
+static void FreeBuffer(std::vector<T>& buffer)
+{
+    std::vector<T>().swap(buffer);
+}
+
+void InitImageEncoding()
+{
+    // standard is set to 8. It's a global of stb, exporters are made on several threads at once (tiles)
+    stbi_write_png_compression_level = 9;
+}
+
+ObjectData IngestPointCloud(const py::dict& point_data)
+{
+    PROFILE_FUNCTION();
+    ObjectData cloud;
+    cloud.points = true;
+    cloud.name = point_data["name"].cast<std::string>();
+    py::array_t<float> positions = point_data["vertices"].cast<py::array_t<float>>();
+    cloud.positions = NumpyArrayToVector(positions);
+    size_t count = cloud.positions.size() / 3;
+    cloud.positions.resize(count * 3);
+
+    if (point_data.contains("normals") && !point_data["normals"].is_none())
+    {
+        py::array_t<float> normals = point_data["normals"].cast<py::array_t<float>>();
+        cloud.normals = NumpyArrayToVector(normals);
+        if (cloud.normals.size() != count * 3)
+        {
+            std::cerr << "Point cloud " << cloud.name << " has " << cloud.normals.size() / 3 << " normals for " << count
+                << " points, they are left out" << std::endl;
+            FreeBuffer(cloud.normals);
+        }
+    }
+
+    // scanners mostly give rgb, the model wants rgba like the mesh colors
+    if (point_data.contains("colors") && !point_data["colors"].is_none())
+    {
+        py::array_t<float> colors = point_data["colors"].cast<py::array_t<float>>();
+        cloud.colors = NumpyArrayToVector(colors);
+        if (cloud.colors.size() == count * 3 && count > 0)
+        {
+            cloud.colors.resize(count * 4);
+            for (size_t i = count; i-- > 0;)
+            {
+                cloud.colors[i * 4 + 3] = 1.0f;
+                for (int c = 2; c >= 0; c--)
+                {
+                    cloud.colors[i * 4 + c] = cloud.colors[i * 3 + c];
+                }
+            }
+        }
+        else if (cloud.colors.size() != count * 4)
+        {
+            std::cerr << "Point cloud " << cloud.name << " has colors that aren't rgb or rgba per point, they are left out" << std::endl;
+            FreeBuffer(cloud.colors);
+        }
+    }
+    return cloud;
+}
+
+// Bytes of the mesh data copied out of python
+static size_t InputBytes(const ObjectData& object)
+{
+    size_t floats = object.positions.size() + object.normals.size() + object.uvs.size() + object.colors.size() + object.weights.size();
+    for (const auto& set : object.uvSets)
+    {
+        floats += set.size();
+    }
+    for (const auto& target : object.morphTargets)
+    {
+        floats += target.positions.size();
+    }
+    return floats * sizeof(float) + object.joints.size() * sizeof(uint16_t) + object.indices.size() * sizeof(uint32_t);
+}
+
+// What a texture stage keeps alive: the decoded or packed pixels plus room for the encoded file
+static size_t EstimateTextureBytes(const TextureData& texture)
+{
+    size_t pixelBytes = texture.data.size();
+    if (texture.type == "file")
+    {
+        // only reads the header
+        MappedFile source;
+        TextureProbe probe;
+        if (source.OpenRead(texture.filepath) && ProbeTexture(source.Data(), source.Size(), probe))
+        {
+            pixelBytes = static_cast<size_t>(probe.width) * probe.height * probe.channels;
+        }
+    }
+    else if (texture.type == "encoded")
+    {
+        TextureProbe probe;
+        if (ProbeTexture(texture.data.data(), texture.data.size(), probe))
+        {
+            pixelBytes = texture.data.size() + static_cast<size_t>(probe.width) * probe.height * probe.channels;
+        }
+    }
+    return pixelBytes + pixelBytes / 2;
+}
+
+// Encoded texture kept by the session, so the next export can skip decoding and encoding it
+struct CachedTexture
+{
+    tinygltf::Image image; // everything but the uri
+    std::vector<uint8_t> bytes;
+};
+
+// Assembled and compressed mesh. Built once by the object's tasks, then only shared:
+// the pending object, the mesh cache and AddMesh all look at the same buffers.
+struct MeshBuffers
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<float> tangents; // 4 per vertex, only for normal mapped objects
+    VertexExtras extrasLayout;
+    std::vector<float> extras; // extrasLayout.Stride() per vertex
+    DracoBuffer dracoData;
+    MeshInfo info; // only filled by chunks, they drop their vertices once they are compressed
+};
+
+struct ExportSession::PendingObject
+{
+    ObjectData data;
+    Mesh mesh; // only the description, the data is in buffers
+    std::shared_ptr<MeshBuffers> building; // owned by the assembly and draco tasks
+    std::shared_ptr<const MeshBuffers> buffers; // finished, possibly shared with the cache
+    std::unique_ptr<MeshChunker> chunker; // only for objects split into chunks, owned by their tasks
+    std::vector<std::shared_ptr<const MeshBuffers>> chunks; // one primitive each, instead of buffers
+    uint64_t meshKey = 0;
+    int textureOffset = 0; // index of the first texture of this object in the exporter
+    std::vector<EncodedTexture> encodedTextures; // sized up front, tasks only write their own entry
+    std::vector<TaskHandle> tasks;
+
+    // clear() instead of new objects so the vectors keep their memory for the next export
+    void Recycle()
+    {
+        data.name.clear();
+        data.positions.clear();
+        data.normals.clear();
+        data.uvs.clear();
+        data.colors.clear();
+        data.uvSets.clear();
+        data.joints.clear();
+        data.weights.clear();
+        data.indices.clear();
+        data.skin = SkinData();
+        data.animations.clear();
+        data.morphTargets.clear();
+        data.textures.clear();
+        data.material = MaterialData();
+        data.points = false;
+        data.instances.clear();
+        data.borrowed = MeshArrays();
+        mesh.name.clear();
+        mesh.materialIndex = -1;
+        mesh.primitiveMode = TINYGLTF_MODE_TRIANGLES;
+        mesh.normals = true;
+        mesh.targetNames.clear();
+        building.reset();
+        buffers.reset();
+        chunker.reset();
+        chunks.clear();
+        meshKey = 0;
+        encodedTextures.clear();
+        tasks.clear();
+    }
+};
+
+ExportSession::ExportSession(ExportSettings exportSettings)
+    : exporter(std::make_unique<GLTFExporter>())
+    , textureCache(std::make_shared<ExportCache<CachedTexture>>(512ull * 1024 * 1024))
+    , meshCache(512ull * 1024 * 1024)
+{
+    Begin(std::move(exportSettings));
+}
+
+ExportSession::~ExportSession()
+{
+    // tasks point into the pending objects, so they can't go away before the tasks are done
+    for (const auto& object : objects)
+    {
+        try
+        {
+            GetScheduler().WaitAll(object->tasks);
+        }
+        catch (...)
+        {
+        }
+    }
+}
+
+void ExportSession::Begin(ExportSettings exportSettings)
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (running || (!finished && !objects.empty()))
+    {
+        throw std::runtime_error("Begin called while the previous export is still running");
+    }
+
+    settings = std::move(exportSettings);
+    exporter->Reset();
+    exporter->SetExportDirectory(settings.exportDir);
+    exporter->SetUseJpg(settings.useJpg, settings.jpgLevel);
+    exporter->SetProgress(&progress);
+    exporter->SetJsonOptions(settings.streamingJson, settings.compactJson);
+    exporter->SetInMemory(settings.inMemory);
+    // a glb file holds its textures like the in memory one, so exports into the same directory can't overwrite
+    // each other's 0.png. Tiles are glbs too but share the texture files next to them
+    exporter->SetEmbedImages(IsGlbPath(settings.filepath) && !settings.tiling);
+    exporter->SetMapBuffer(settings.mapBuffer);
+    // a glb has one BIN chunk, every other buffer would end up next to it as a .bin anyway
+    exporter->SetBufferPerMesh(settings.bufferPerMesh && !IsGlbPath(settings.filepath));
+    exporter->SetLoadOrder(settings.loadOrder);
+    exporter->SetMorphTolerance(settings.morphTolerance);
+    exporter->SetTexturePassthrough(settings.passthroughTextures, settings.keepJpeg);
+    exporter->SetFileWriter(settings.inMemory ? nullptr : &fileWriter);
+    fileWriter.SetDirectIo(settings.directIo);
+
+    for (auto& object : objects)
+    {
+        object->Recycle();
+        spareObjects.push_back(std::move(object));
+    }
+    objects.clear();
+    lastCommit = nullptr;
+    textureCount = 0;
+    memoryFiles.clear();
+    finished = false;
+    {
+        std::lock_guard<std::mutex> lock(cleanupMutex);
+        cleanupCounts = CleanupCounts();
+    }
+
+    if (settings.tiling && settings.memoryBudget != 0)
+    {
+        std::cerr << "Memory budget only covers the encoding of a tiled export, the finished meshes stay in memory until the tiles are written" << std::endl;
+    }
+    budget.SetLimit(settings.memoryBudget);
+    budget.ResetPeak();
+    // under a budget the arenas only keep a part of it between tasks
+    arenas.SetRetainLimit(settings.memoryBudget != 0 ? settings.memoryBudget / 4 : SIZE_MAX);
+
+    progress.Reset();
+    // write and zip
+    progress.AddSteps(2);
+}
+
+void ExportSession::SetCacheLimits(size_t textureBytes, size_t meshBytes)
+{
+    textureCache->SetLimit(textureBytes);
+    meshCache.SetLimit(meshBytes);
+}
+
+void ExportSession::ClearCaches()
+{
+    textureCache->Clear();
+    meshCache.Clear();
+}
+
+std::map<std::string, size_t> ExportSession::MemoryStats() const
+{
+    return {
+        { "budget_bytes", budget.Limit() },
+        { "used_bytes", budget.Used() },
+        { "peak_bytes", budget.Peak() },
+    };
+}
+
+std::map<std::string, size_t> ExportSession::CacheStats() const
+{
+    return {
+        { "texture_hits", textureCache->Hits() },
+        { "texture_misses", textureCache->Misses() },
+        { "texture_bytes", textureCache->UsedBytes() },
+        { "mesh_hits", meshCache.Hits() },
+        { "mesh_misses", meshCache.Misses() },
+        { "mesh_bytes", meshCache.UsedBytes() },
+    };
+}
+
+std::map<std::string, size_t> ExportSession::CleanupStats() const
+{
+    std::lock_guard<std::mutex> lock(cleanupMutex);
+    return {
+        { "degenerate_faces", cleanupCounts.degenerateFaces },
+        { "duplicate_faces", cleanupCounts.duplicateFaces },
+        { "unused_vertices", cleanupCounts.unusedVertices },
+        { "non_finite_values", cleanupCounts.nonFiniteValues },
+    };
+}
+
+void ExportSession::Clean(MeshBuffers& mesh)
+{
+    if (!settings.cleanup)
+    {
+        return;
+    }
+    CleanupCounts counts = CleanMesh(mesh.vertices, mesh.indices, mesh.extras, mesh.extrasLayout.Stride());
+    std::lock_guard<std::mutex> lock(cleanupMutex);
+    cleanupCounts += counts;
+}
+
+uint64_t ExportSession::TextureKey(const TextureData& texture) const
+{
+    uint64_t hash = HashValue(settings.useJpg, HashValue(settings.jpgLevel, HashBytes(nullptr, 0)));
+    hash = HashValue(settings.passthroughTextures, HashValue(settings.keepJpeg, hash));
+    if (texture.type == "file")
+    {
+        // the same file that wasn't touched since the last export
+        std::error_code error;
+        auto size = std::filesystem::file_size(texture.filepath, error);
+        auto time = std::filesystem::last_write_time(texture.filepath, error);
+        if (error)
+        {
+            return 0;
+        }
+        hash = HashString(texture.filepath, hash);
+        hash = HashValue(size, hash);
+        return HashValue(time.time_since_epoch().count(), hash);
+    }
+
+    hash = HashValue(texture.width, HashValue(texture.height, HashValue(texture.channels, hash)));
+    return HashBytes(texture.data.data(), texture.data.size(), hash);
+}
+
+static bool NeedsTangents(const ExportSettings& settings, const ObjectData& object)
+{
+    int normalTexture = object.material.normalTexture;
+    return settings.tangents && normalTexture >= 0 && normalTexture < static_cast<int>(object.textures.size());
+}
+
+uint64_t ExportSession::MeshKey(const ObjectData& object) const
+{
+    uint64_t hash = HashValue(settings.useDraco, HashValue(settings.dracoLevel, HashBytes(nullptr, 0)));
+    hash = HashValue(NeedsTangents(settings, object), hash);
+    hash = HashValue(settings.cleanup, hash);
+    hash = HashBytes(object.positions.data(), object.positions.size() * sizeof(float), hash);
+    hash = HashBytes(object.normals.data(), object.normals.size() * sizeof(float), hash);
+    hash = HashBytes(object.uvs.data(), object.uvs.size() * sizeof(float), hash);
+    hash = HashBytes(object.colors.data(), object.colors.size() * sizeof(float), hash);
+    hash = HashBytes(object.joints.data(), object.joints.size() * sizeof(uint16_t), hash);
+    hash = HashBytes(object.weights.data(), object.weights.size() * sizeof(float), hash);
+    for (const auto& target : object.morphTargets)
+    {
+        hash = HashBytes(target.positions.data(), target.positions.size() * sizeof(float), hash);
+    }
+    for (const auto& set : object.uvSets)
     {
-        vecOut.push_back(data[i]);
+        hash = HashBytes(set.data(), set.size() * sizeof(float), hash);
     }
-    return vecOut;
+    return HashBytes(object.indices.data(), object.indices.size() * sizeof(uint32_t), hash);
 }
 
-std::vector<Vertex> StoreInVertex(
-    const std::vector<float>& positions,
-    const std::vector<float>& normals,
-    const std::vector<float>& uvs,
-    const std::vector<uint32_t>& indices)
+void ExportSession::AddObject(ObjectData object)
 {
     PROFILE_FUNCTION();
-    size_t num_face_vertices = normals.size() / 3;
-    std::vector<Vertex> vertices;
-    vertices.reserve(num_face_vertices);
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (finished)
+    {
+        throw std::runtime_error("AddObject called on a finished export session, call Begin first");
+    }
 
-    bool hasUVs = !uvs.empty() && (uvs.size() >= num_face_vertices * 2);
+    TaskScheduler& scheduler = GetScheduler();
+
+    std::unique_ptr<PendingObject> pending;
+    if (!spareObjects.empty())
+    {
+        pending = std::move(spareObjects.back());
+        spareObjects.pop_back();
+    }
+    else
+    {
+        pending = std::make_unique<PendingObject>();
+    }
 
-    for (size_t i = 0; i < num_face_vertices; i++)
+    PendingObject* obj = pending.get();
+    obj->data = std::move(object);
+    obj->textureOffset = textureCount;
+    obj->encodedTextures.resize(obj->data.textures.size());
+    textureCount += static_cast<int>(obj->data.textures.size());
+    // pushed right away, so the destructor also waits for an object that got stuck waiting on the budget
+    objects.push_back(std::move(pending));
+
+    // one step per texture, assembly, draco and adding it to the model
+    progress.AddSteps(obj->data.textures.size() + 3);
+
+    // Object graph:
+    //   texture encodes (or cache hits) ---------------------+
+    //   vertex assembly -> draco (or one cache hit) ---------+--> commit to the model
+    //   commit of the previous object -----------------------+
+    //
+    // Every stage waits for its memory before it is submitted. Textures go first, so whatever
+    // we wait on can always be freed by work that is already queued.
+    for (size_t i = 0; i < obj->data.textures.size(); i++)
     {
-        // Bounds check on indices
-        if (i >= indices.size()) {
-            std::cerr << "Index i=" << i << " out of bounds for indices" << std::endl;
-            break;
+        auto lease = std::make_shared<MemoryLease>(budget, EstimateTextureBytes(obj->data.textures[i]), &progress);
+        obj->tasks.push_back(scheduler.Submit([this, obj, i, lease] {
+            TextureData& texture = obj->data.textures[i];
+            EncodedTexture& encoded = obj->encodedTextures[i];
+            int idx = obj->textureOffset + static_cast<int>(i);
+
+            uint64_t key = TextureKey(texture);
+            std::shared_ptr<const CachedTexture> cached = key ? textureCache->Find(key) : nullptr;
+            if (!cached)
+            {
+                // decode and encode buffers are scratch, only the encoded vector outlives the scope
+                ArenaScope arenaScope(arenas);
+                auto entry = std::make_shared<CachedTexture>();
+                if (exporter->EncodeTextureToMemory(texture, entry->image, entry->bytes))
+                {
+                    size_t bytes = entry->bytes.size();
+                    cached = entry;
+                    if (key)
+                    {
+                        textureCache->Insert(key, entry, bytes);
+                    }
+                }
+            }
+
+            if (cached)
+            {
+                encoded.image = cached->image;
+                encoded.ok = exporter->WriteTextureFile(idx, encoded.image, cached->bytes, cached);
+            }
+            encoded.attempted = true;
+
+            // the file is written, the packed pixels aren't needed anymore
+            FreeBuffer(texture.data);
+            cached.reset();
+            lease->Release();
+            progress.Advance();
+        }));
+    }
+
+    obj->mesh.name = obj->data.name;
+    obj->mesh.useDracoCompression = settings.useDraco;
+    obj->mesh.dracoCompressionLevel = settings.dracoLevel;
+
+    if (obj->data.points)
+    {
+        if (settings.tiling)
+        {
+            // the tiles are simplified triangles, a cloud has none
+            std::cerr << "Tiled export leaves out point cloud " << obj->data.name << std::endl;
         }
+        obj->mesh.primitiveMode = TINYGLTF_MODE_POINTS;
+        obj->mesh.normals = !obj->data.normals.empty();
+
+        // with draco only the chunks in flight have vertices, a vertex copy each for the encoder. Without it they all stay
+        size_t points = obj->data.positions.size() / 3;
+        size_t pointBytes = sizeof(Vertex) + (obj->data.colors.empty() ? 0 : 4 * sizeof(float));
+        size_t chunkPoints = settings.pointChunk > 0 ? std::min(points, settings.pointChunk) : points;
+        size_t workers = static_cast<size_t>(std::max(1, scheduler.GetThreadCount()));
+        size_t workBytes = settings.useDraco ? chunkPoints * pointBytes * 2 * workers : points * pointBytes;
+        auto meshLease = std::make_shared<MemoryLease>(budget, InputBytes(obj->data) + std::min(workBytes, points * pointBytes * 2), &progress);
+        obj->tasks.push_back(SubmitPointCloud(obj, meshLease));
+        SubmitCommit(obj, meshLease);
+        return;
+    }
 
-        Vertex v{};
-        uint32_t pos_index = indices[i];
+    if (settings.tiling && (!obj->data.skin.joints.empty() || !obj->data.animations.empty() || !obj->data.morphTargets.empty()))
+    {
+        // tiles are a static scene, and their simplified meshes would average the joint indices
+        std::cerr << "Tiled export leaves out the skin, animations and morph targets of " << obj->data.name << std::endl;
+        obj->data.skin = SkinData();
+        FreeBuffer(obj->data.joints);
+        FreeBuffer(obj->data.weights);
+        obj->data.animations.clear();
+        obj->data.morphTargets.clear();
+    }
+    if (!obj->data.morphTargets.empty())
+    {
+        // draco puts the vertices in an order of its own, the target accessors couldn't follow it
+        obj->mesh.useDracoCompression = false;
+        for (const auto& target : obj->data.morphTargets)
+        {
+            obj->mesh.targetNames.push_back(target.name);
+        }
+    }
+    if (!obj->data.animations.empty() && settings.animationTolerance > 0.0f)
+    {
+        // only touches the animations, the mesh tasks don't look at those
+        obj->tasks.push_back(scheduler.Submit([this, obj] {
+            for (auto& animation : obj->data.animations)
+            {
+                for (auto& channel : animation.channels)
+                {
+                    ReduceKeyframes(channel, settings.animationTolerance);
+                }
+            }
+        }));
+    }
 
-        // positions
-        if (pos_index * 3 + 2 >= positions.size()) {
-            std::cerr << "Position index " << pos_index << " out of bounds" << std::endl;
-            continue;
+    const ObjectData& input = obj->data;
+    size_t inputBytes = InputBytes(input);
+    VertexExtras extrasLayout = ExtrasLayout(input);
+    size_t extraBytes = extrasLayout.Stride() * sizeof(float);
+    if (settings.chunkTriangles > 0 && Arrays(input).indices.size() / 3 > settings.chunkTriangles)
+    {
+        // The whole mesh never gets expanded: a window of corners at a time, then one chunk per worker.
+        // What is left of the lease after the input is freed covers the chunks in flight
+        size_t chunkCorners = settings.chunkTriangles * 3;
+        size_t chunkBytes = chunkCorners * (2 * (sizeof(Vertex) + extraBytes) + sizeof(uint32_t)) + (settings.useDraco ? chunkCorners * (sizeof(Vertex) + extraBytes) : 0);
+        if (NeedsTangents(settings, input))
+        {
+            chunkBytes += chunkCorners * 4 * sizeof(float);
         }
+        size_t workers = static_cast<size_t>(std::max(1, scheduler.GetThreadCount()));
+        auto meshLease = std::make_shared<MemoryLease>(budget, inputBytes + chunkBytes * workers, &progress);
+        std::vector<TaskHandle> meshTasks = SubmitChunkedMesh(obj, meshLease);
+        obj->tasks.insert(obj->tasks.end(), meshTasks.begin(), meshTasks.end());
+        SubmitCommit(obj, meshLease);
+        return;
+    }
+
+    if (input.borrowed.owner)
+    {
+        // only a chunked export reads the numpy arrays in place, reading them needs no GIL
+        ObjectData& data = obj->data;
+        data.positions.assign(data.borrowed.positions.data(), data.borrowed.positions.data() + data.borrowed.positions.size());
+        data.normals.assign(data.borrowed.normals.data(), data.borrowed.normals.data() + data.borrowed.normals.size());
+        data.uvs.assign(data.borrowed.uvs.data(), data.borrowed.uvs.data() + data.borrowed.uvs.size());
+        data.indices.assign(data.borrowed.indices.data(), data.borrowed.indices.data() + data.borrowed.indices.size());
+        data.borrowed = MeshArrays();
+        inputBytes = InputBytes(input);
+    }
 
-        // We switch Y and Z because blender is Z-Up whilst gltf is Y-Up
-        // Y also becomes inverted to avoid a mirrored mesh
+    size_t vertexBytes = input.indices.size() * (sizeof(Vertex) + extraBytes + sizeof(uint32_t) + (NeedsTangents(settings, input) ? 4 * sizeof(float) : 0));
+    // draco builds its own copy of the mesh while encoding
+    size_t dracoBytes = settings.useDraco ? vertexBytes : 0;
+    auto meshLease = std::make_shared<MemoryLease>(budget, inputBytes + vertexBytes + dracoBytes, &progress);
 
-        v.position[0] = positions[pos_index * 3 + 0];
-        v.position[1] = positions[pos_index * 3 + 2];
-        v.position[2] = -positions[pos_index * 3 + 1];
+    TaskHandle assembleTask = scheduler.Submit([this, obj, meshLease, inputBytes, extrasLayout] {
+        ObjectData& data = obj->data;
 
-        // normals
-        if (i * 3 + 2 >= normals.size()) {
-            std::cerr << "Normal index " << i << " out of bounds" << std::endl;
-            v.normal[0] = v.normal[1] = v.normal[2] = 0.0f;
+        obj->meshKey = MeshKey(data);
+        if (auto cached = meshCache.Find(obj->meshKey))
+        {
+            // just share the cached buffers
+            obj->buffers = std::move(cached);
         }
-        else {
-            v.normal[0] = normals[i * 3 + 0];
-            v.normal[1] = normals[i * 3 + 2];
-            v.normal[2] = -normals[i * 3 + 1];
+        else
+        {
+            auto built = std::make_shared<MeshBuffers>();
+            StoreInVertex(data.positions, data.normals, data.uvs, data.indices, built->vertices, &progress);
+            built->extrasLayout = extrasLayout;
+            built->extras.resize(built->vertices.size() * extrasLayout.Stride());
+            StoreCornerExtras(data, extrasLayout, 0, built->vertices.size(), built->extras.data());
+
+            built->indices.resize(built->vertices.size());
+            std::iota(built->indices.begin(), built->indices.end(), 0u);
+            Clean(*built);
+            if (NeedsTangents(settings, data))
+            {
+                GenerateTangents(built->vertices, built->indices, built->extras, extrasLayout.Stride(), built->tangents);
+            }
+            obj->building = std::move(built);
         }
 
-        // UV 
-        if (hasUVs && i * 2 + 1 < uvs.size()) {
-            v.texcoord[0] = uvs[i * 2 + 0];
-            v.texcoord[1] = uvs[i * 2 + 1];
+        // everything is in the vertices now
+        FreeBuffer(data.positions);
+        FreeBuffer(data.normals);
+        FreeBuffer(data.uvs);
+        FreeBuffer(data.colors);
+        FreeBuffer(data.uvSets);
+        FreeBuffer(data.joints);
+        FreeBuffer(data.weights);
+        FreeBuffer(data.morphTargets);
+        FreeBuffer(data.indices);
+        meshLease->Release(inputBytes);
+        progress.Advance();
+    });
+
+    obj->tasks.push_back(scheduler.Submit([this, obj, meshLease, dracoBytes] {
+        if (!obj->building)
+        {
+            // came from the cache
+            progress.Advance();
+            return;
         }
-        else {
-            v.texcoord[0] = 0.0f;
-            v.texcoord[1] = 0.0f;
+
+        MeshBuffers& built = *obj->building;
+        if (obj->mesh.useDracoCompression)
+        {
+            built.dracoData = exporter->CompressMesh(built.vertices, built.indices, obj->mesh.dracoCompressionLevel, &built.tangents,
+                &built.extras, built.extrasLayout);
         }
+        meshLease->Release(dracoBytes);
 
-        vertices.push_back(v);
-    }
+        // the cache shares the buffers, nothing gets copied
+        size_t bytes = built.vertices.size() * sizeof(Vertex) + built.indices.size() * sizeof(uint32_t) +
+            (built.tangents.size() + built.extras.size()) * sizeof(float) + built.dracoData.size();
+        obj->buffers = std::move(obj->building);
+        meshCache.Insert(obj->meshKey, obj->buffers, bytes);
+        progress.Advance();
+    }, { assembleTask }));
 
-    return vertices;
+    SubmitCommit(obj, meshLease);
 }
 
-void ReadBlenderData(const py::dict& mesh_data, const std::string& exportDir, const std::string& filepath, py::list textures, bool useDraco, int dracoLevel, bool useJpg, int jpgLevel, bool zip)
+std::vector<TaskHandle> ExportSession::SubmitChunkedMesh(PendingObject* obj, std::shared_ptr<MemoryLease> meshLease)
 {
-    PROFILE_FUNCTION();
-    GLTFExporter exporter;
-    exporter.SetExportDirectory(exportDir);
-    exporter.SetUseJpg(useJpg, jpgLevel);
-
+    TaskScheduler& scheduler = GetScheduler();
+    const ObjectData& input = obj->data;
+    size_t inputBytes = InputBytes(input);
+    VertexExtras extrasLayout = ExtrasLayout(input);
+
+    // every chunked object gets its own directory, also between processes exporting at the same time
+    static std::atomic<uint64_t> chunkedObjects{ 0 };
+    std::filesystem::path directory = settings.chunkDir.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(settings.chunkDir);
+    directory /= "gltfcomp_chunks_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "_" + std::to_string(chunkedObjects++);
+    obj->chunker = std::make_unique<MeshChunker>(directory.string(), settings.chunkTriangles, extrasLayout.Stride());
+
+    // these are never cached, hashing a mesh this size would cost about as much as exporting it
+    TaskHandle partitionTask = scheduler.Submit([this, obj, meshLease, inputBytes, extrasLayout] {
+        ObjectData& data = obj->data;
+        if (!StoreInChunks(data, extrasLayout, *obj->chunker, settings.chunkTriangles * 3, &progress))
+        {
+            throw std::runtime_error("couldn't split " + data.name + " into chunks");
+        }
 
-    // Process mesh data: 
-    
-    auto vertices = mesh_data["vertices"].cast<py::array_t<float>>();
-    auto normals = mesh_data["normals"].cast<py::array_t<float>>();
-    auto indices = mesh_data["indices"].cast<py::array_t<uint32_t>>();
+        // everything is in the chunk files now
+        data.borrowed = MeshArrays();
+        FreeBuffer(data.positions);
+        FreeBuffer(data.normals);
+        FreeBuffer(data.uvs);
+        FreeBuffer(data.colors);
+        FreeBuffer(data.uvSets);
+        FreeBuffer(data.joints);
+        FreeBuffer(data.weights);
+        FreeBuffer(data.morphTargets);
+        FreeBuffer(data.indices);
+        meshLease->Release(inputBytes);
+        progress.Advance();
+    });
+
+    TaskHandle chunkTask = scheduler.Submit([this, obj, extrasLayout] {
+        MeshChunker& chunker = *obj->chunker;
+        bool tangents = NeedsTangents(settings, obj->data);
+        obj->chunks.resize(chunker.ChunkCount());
+        std::atomic<bool> failed{ false };
+
+        // one chunk per worker at a time, that's all the memory this mesh ever needs
+        GetScheduler().ParallelFor(chunker.ChunkCount(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                progress.ThrowIfCancelled();
+                auto built = std::make_shared<MeshBuffers>();
+                built->extrasLayout = extrasLayout;
+                if (!chunker.ReadChunk(i, built->vertices, built->indices, built->extras))
+                {
+                    failed = true;
+                    return;
+                }
+                Clean(*built);
+                if (tangents)
+                {
+                    GenerateTangents(built->vertices, built->indices, built->extras, extrasLayout.Stride(), built->tangents);
+                }
 
-    // Handle optional UVs
-    py::array_t<float> uvs;
-    if (!mesh_data["uvs"].is_none()) {
-        uvs = mesh_data["uvs"].cast<py::array_t<float>>();
-    }
+                if (obj->mesh.useDracoCompression)
+                {
+                    built->dracoData = exporter->CompressMesh(built->vertices, built->indices, obj->mesh.dracoCompressionLevel, &built->tangents,
+                        &built->extras, built->extrasLayout);
+                    // the tiles still need the vertices to simplify
+                    if (!built->dracoData.empty() && !settings.tiling)
+                    {
+                        // the draco data is all the model needs
+                        built->info = DescribeMesh(built->vertices, built->indices);
+                        built->info.tangents = !built->tangents.empty();
+                        FreeBuffer(built->vertices);
+                        FreeBuffer(built->indices);
+                        FreeBuffer(built->tangents);
+                        FreeBuffer(built->extras);
+                    }
+                }
+                obj->chunks[i] = std::move(built);
+            }
+        });
 
-    std::vector<float> vecVertices = NumpyArrayToVector(vertices);
-    std::vector<float> vecNormals = NumpyArrayToVector(normals);
-    std::vector<uint32_t> vecIndices = NumpyArrayToVector(indices);
-    std::vector<float> vecUvs = NumpyArrayToVector(uvs);
-    std::vector <Vertex> vertexData = StoreInVertex(vecVertices, vecNormals, vecUvs, vecIndices);
-    
-    
-    // Process all the textures
-    for (size_t i = 0; i < textures.size(); i++) 
-    {
-        // Cast it to a dict so we can lookup the type
-        py::dict tex = textures[i].cast<py::dict>();
-        std::string type = tex["type"].cast<std::string>();
+        obj->chunker.reset();
+        if (failed)
+        {
+            throw std::runtime_error("couldn't read the chunks of " + obj->data.name);
+        }
+        progress.Advance();
+    }, { partitionTask });
 
-        TextureData texData;
-        texData.type = type;
-        texData.name = tex["name"].cast<std::string>();
+    return { partitionTask, chunkTask };
+}
 
-        if (type == "file") {
-            texData.filepath = tex["path"].cast<std::string>();
+TaskHandle ExportSession::SubmitPointCloud(PendingObject* obj, std::shared_ptr<MemoryLease> meshLease)
+{
+    size_t inputBytes = InputBytes(obj->data);
+    // no cache either, like the chunked meshes
+    return GetScheduler().Submit([this, obj, meshLease, inputBytes] {
+        ObjectData& cloud = obj->data;
+        size_t points = cloud.positions.size() / 3;
+        size_t chunkPoints = settings.pointChunk > 0 ? settings.pointChunk : std::max<size_t>(points, 1);
+        size_t chunkCount = (points + chunkPoints - 1) / chunkPoints;
+        VertexExtras extrasLayout;
+        extrasLayout.color = !cloud.colors.empty();
+
+        if (chunkCount == 0)
+        {
+            std::cerr << "Point cloud " << cloud.name << " has no points" << std::endl;
+            obj->buffers = std::make_shared<MeshBuffers>();
         }
-        else if (type == "packed") 
+        obj->chunks.resize(chunkCount);
+
+        // The chunks only read the input, so every worker converts and encodes chunks of its own.
+        // They are slices in the scanner's order, which is close together in space for the k-d tree
+        GetScheduler().ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
         {
-            py::array_t<uint8_t> pixel_data = tex["data"].cast<py::array_t<uint8_t>>();
-            auto buf = pixel_data.request();
+            for (size_t c = begin; c < end; c++)
+            {
+                progress.ThrowIfCancelled();
+                size_t first = c * chunkPoints;
+                size_t count = std::min(chunkPoints, points - first);
+                auto built = std::make_shared<MeshBuffers>();
+                built->extrasLayout = extrasLayout;
+                built->vertices.resize(count);
+                built->extras.resize(extrasLayout.color ? count * 4 : 0);
+                StorePoints(cloud, first, count, built->vertices.data(), extrasLayout.color ? built->extras.data() : nullptr);
+
+                if (obj->mesh.useDracoCompression)
+                {
+                    built->dracoData = exporter->CompressPointCloud(built->vertices, obj->mesh.normals, &built->extras, extrasLayout,
+                        settings.pointBits, obj->mesh.dracoCompressionLevel);
+                    if (!built->dracoData.empty())
+                    {
+                        // the draco data is all the model needs
+                        built->info = DescribeMesh(built->vertices, built->indices);
+                        FreeBuffer(built->vertices);
+                        FreeBuffer(built->extras);
+                    }
+                }
+                obj->chunks[c] = std::move(built);
+            }
+        });
+
+        // everything is in the chunks now
+        FreeBuffer(cloud.positions);
+        FreeBuffer(cloud.normals);
+        FreeBuffer(cloud.colors);
+        meshLease->Release(inputBytes);
+        // the assembly and draco steps of AddObject, a cloud does both in one go
+        progress.Advance();
+        progress.Advance();
+    });
+}
 
-            texData.data = std::vector<uint8_t>(
-                static_cast<uint8_t*>(buf.ptr),
-                static_cast<uint8_t*>(buf.ptr) + buf.size
-            );
-            texData.width = tex["width"].cast<int>();
-            texData.height = tex["height"].cast<int>();
-            texData.channels = tex["channels"].cast<int>();
+void ExportSession::SubmitCommit(PendingObject* obj, std::shared_ptr<MemoryLease> meshLease)
+{
+    // Objects are committed one at a time in the order they were added, so texture, material
+    // and mesh indices come out the same as a serial export
+    std::vector<TaskHandle> commitDependencies = obj->tasks;
+    commitDependencies.push_back(lastCommit);
+    lastCommit = GetScheduler().Submit([this, obj, meshLease] {
+        progress.ThrowIfCancelled();
+        if (settings.tiling)
+        {
+            // WriteTiles takes the objects as they are, they keep their buffers until then. The lease goes
+            // anyway: nothing is written before Finish, so holding it would block AddObject for good once
+            // the finished meshes fill the budget. A tiled export is only budgeted while it encodes
+            meshLease->Release();
+            progress.Advance();
+            return;
         }
+        CommitObject(*obj);
+
+        // The exporter holds on to the buffers until it writes the model's buffer. That's the output
+        // of the export, which the budget doesn't count (it never counted the model's buffer either).
+        obj->buffers.reset();
+        obj->chunks.clear();
+        meshLease->Release();
+        progress.Advance();
+    }, commitDependencies);
+    obj->tasks.push_back(lastCommit);
+}
+
+// Material of an object whose textures were pushed to the exporter starting at textureOffset
+static Material ObjectMaterial(const MaterialData& material, size_t textureCount, int textureOffset)
+{
+    // Create material with optional texture
+    Material mat;
+    mat.name = material.name;
+    std::copy(material.baseColor, material.baseColor + 4, mat.baseColor);
+    mat.metallicFactor = material.metallic;
+    mat.roughnessFactor = material.roughness;
+
+    // AddMaterial will call AddTexture internally, so map the object's own texture slots to exporter indices
+    auto objectTexture = [&](int slot) {
+        return slot >= 0 && slot < static_cast<int>(textureCount) ? textureOffset + slot : -1;
+    };
+    mat.baseColorTexture = objectTexture(material.baseColorTexture);
+    mat.normalTexture = objectTexture(material.normalTexture);
+    mat.metallicRoughnessTexture = objectTexture(material.metallicRoughnessTexture);
+    mat.occlusionTexture = objectTexture(material.occlusionTexture);
+    mat.emissiveTexture = objectTexture(material.emissiveTexture);
+    std::copy(material.emissive, material.emissive + 3, mat.emissive);
+    mat.normalScale = material.normalScale;
+    mat.occlusionStrength = material.occlusionStrength;
+    mat.alphaMode = material.alphaMode;
+    mat.alphaCutoff = material.alphaCutoff;
+    mat.doubleSided = material.doubleSided;
+    mat.baseColorTexCoord = material.baseColorTexCoord;
+    mat.normalTexCoord = material.normalTexCoord;
+    mat.metallicRoughnessTexCoord = material.metallicRoughnessTexCoord;
+    mat.occlusionTexCoord = material.occlusionTexCoord;
+    mat.emissiveTexCoord = material.emissiveTexCoord;
+    return mat;
+}
+
+void ExportSession::CommitObject(PendingObject& object)
+{
+    PROFILE_FUNCTION();
+    size_t textureCount = object.data.textures.size();
+    for (size_t i = 0; i < textureCount; i++)
+    {
+        // the object is done with them, the exporter takes them over
+        exporter->PushEncodedTexture(std::move(object.data.textures[i]), std::move(object.encodedTextures[i]));
+    }
+    object.mesh.materialIndex = exporter->AddMaterial(ObjectMaterial(object.data.material, textureCount, object.textureOffset));
 
-        exporter.PushTextures(texData);
+    // the exporter keeps the buffers alive until it writes them into the model's buffer
+    int meshIndex = -1;
+    if (!object.chunks.empty())
+    {
+        std::vector<MeshPart> parts;
+        for (const auto& chunk : object.chunks)
+        {
+            const MeshInfo* info = chunk->vertices.empty() && !chunk->dracoData.empty() ? &chunk->info : nullptr;
+            parts.push_back({ &chunk->vertices, &chunk->indices, &chunk->dracoData, info, chunk, &chunk->tangents, chunk->extrasLayout, &chunk->extras });
+        }
+        meshIndex = exporter->AddMesh(object.mesh, parts);
+    }
+    else
+    {
+        const MeshBuffers& buffers = *object.buffers;
+        meshIndex = exporter->AddMesh(object.mesh, { { &buffers.vertices, &buffers.indices, &buffers.dracoData, nullptr, object.buffers,
+            &buffers.tangents, buffers.extrasLayout, &buffers.extras } });
     }
 
+    // a skin needs the joints and weights in the mesh, without them the armature is left out
+    const MeshBuffers* firstPart = object.chunks.empty() ? object.buffers.get() : object.chunks[0].get();
+    std::vector<int> jointNodes;
+    Node node;
+    node.name = object.data.name;
+    node.meshIndex = meshIndex;
+    if (!object.data.skin.joints.empty() && firstPart && firstPart->extrasLayout.skin)
+    {
+        node.skin = exporter->AddSkin(object.data.name, object.data.skin, jointNodes);
+    }
+    for (const auto& animation : object.data.animations)
+    {
+        for (const auto& channel : animation.channels)
+        {
+            node.animated = node.animated || channel.joint < 0;
+        }
+    }
+    int nodeIndex = -1;
+    if (object.data.instances.empty())
+    {
+        nodeIndex = exporter->AddNode(node);
+    }
+    for (const auto& instance : object.data.instances)
+    {
+        // the mesh is in the file once, every instance is a node pointing at it
+        Node instanceNode = node;
+        instanceNode.name = instance.name;
+        std::copy(instance.transform, instance.transform + 16, instanceNode.transform);
+        int instanceIndex = exporter->AddNode(instanceNode);
+        nodeIndex = nodeIndex < 0 ? instanceIndex : nodeIndex;
+    }
 
+    for (const auto& animation : object.data.animations)
+    {
+        for (const auto& channel : animation.channels)
+        {
+            int target = channel.joint < 0 ? nodeIndex : channel.joint < static_cast<int>(jointNodes.size()) ? jointNodes[channel.joint] : -1;
+            exporter->AddAnimationChannel(animation.name, channel, target, settings.quantizeAnimation);
+        }
+    }
+}
 
-    auto materials = mesh_data["materials"].cast<std::vector<py::dict>>();
-    auto name = mesh_data["name"].cast<std::string>();
+bool ExportSession::WriteTiles()
+{
+    PROFILE_FUNCTION();
+    // a coarse tile is simplified on a grid of this many cells along its octree cell
+    const int tileGridCells = 64;
 
-    std::vector<uint32_t> newIndices;
-    newIndices.reserve(vertexData.size());
-    for (size_t i = 0; i < vertexData.size(); i++) {
-        newIndices.push_back(static_cast<uint32_t>(i));
+    // what goes into the tiles: the objects, a chunked object with every chunk on its own
+    struct Piece
+    {
+        const PendingObject* object;
+        std::shared_ptr<const MeshBuffers> buffers;
+    };
+    std::vector<Piece> pieces;
+    std::vector<TileItem> items;
+    for (const auto& object : objects)
+    {
+        std::vector<std::shared_ptr<const MeshBuffers>> parts = object->chunks;
+        if (object->buffers)
+        {
+            parts.push_back(object->buffers);
+        }
+        for (auto& part : parts)
+        {
+            MeshInfo info = DescribeMesh(part->vertices, part->indices);
+            if (info.boundsMin.empty() || part->indices.empty())
+            {
+                continue;
+            }
+            TileItem item;
+            for (int i = 0; i < 3; i++)
+            {
+                item.boundsMin[i] = static_cast<float>(info.boundsMin[i]);
+                item.boundsMax[i] = static_cast<float>(info.boundsMax[i]);
+            }
+            item.triangles = part->indices.size() / 3;
+            items.push_back(item);
+            pieces.push_back({ object.get(), std::move(part) });
+        }
+    }
+    if (pieces.empty())
+    {
+        std::cerr << "Nothing to put in the tiles" << std::endl;
+        return false;
     }
 
+    std::vector<TileNode> nodes = BuildTileOctree(items, settings.tileTriangles, settings.tileDepth);
+    std::vector<TilesetTile> tiles(nodes.size());
+    std::atomic<bool> failed{ false };
 
-    // Create material with optional texture
-    Material mat;
-    mat.name = "TestMaterial";
-    mat.metallicFactor = 0.0f;
-    mat.roughnessFactor = 0.8f;
+    // every tile is a small export of its own, they don't share anything but the texture files
+    GetScheduler().ParallelFor(nodes.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t t = begin; t < end; t++)
+        {
+            progress.ThrowIfCancelled();
+            const TileNode& node = nodes[t];
+            TilesetTile& tile = tiles[t];
+            float cellSize = node.cellSize / tileGridCells;
+
+            // glTF is y-up, the tileset z-up
+            double centre[3];
+            double half[3];
+            for (int i = 0; i < 3; i++)
+            {
+                centre[i] = (static_cast<double>(node.boundsMin[i]) + node.boundsMax[i]) * 0.5;
+                half[i] = (static_cast<double>(node.boundsMax[i]) - node.boundsMin[i]) * 0.5;
+            }
+            double box[12] = { centre[0], -centre[2], centre[1], half[0], 0, 0, 0, half[2], 0, 0, 0, half[1] };
+            std::copy(box, box + 12, tile.box);
+            tile.geometricError = node.IsLeaf() ? 0.0 : cellSize * std::sqrt(3.0);
+            tile.children = node.children;
+            tile.uri = "tile_" + std::to_string(t) + ".glb";
+
+            GLTFExporter tileExporter;
+            tileExporter.SetExportDirectory(settings.exportDir);
+            tileExporter.SetJsonOptions(true, settings.compactJson);
+            tileExporter.SetProgress(&progress);
+
+            std::unordered_map<const PendingObject*, int> materials;
+            int textureCount = 0;
+            for (size_t item : node.items)
+            {
+                const Piece& piece = pieces[item];
+                const PendingObject& object = *piece.object;
 
-    mat.baseColorTexture = 0;  // AddMaterial will call AddTexture internally
-    mat.normalTexture = 1;
-    mat.metallicRoughnessTexture = 2;
-    int materialIndex = exporter.AddMaterial(mat);
+                // the texture files are already written next to the tiles, the images only point at them
+                auto material = materials.find(&object);
+                if (material == materials.end())
+                {
+                    for (size_t i = 0; i < object.data.textures.size(); i++)
+                    {
+                        tileExporter.PushEncodedTexture(object.data.textures[i], object.encodedTextures[i]);
+                    }
+                    int materialIndex = tileExporter.AddMaterial(ObjectMaterial(object.data.material, object.data.textures.size(), textureCount));
+                    textureCount += static_cast<int>(object.data.textures.size());
+                    material = materials.emplace(&object, materialIndex).first;
+                }
+
+                Mesh mesh;
+                mesh.name = object.mesh.name;
+                mesh.materialIndex = material->second;
+                mesh.useDracoCompression = object.mesh.useDracoCompression;
+                mesh.dracoCompressionLevel = object.mesh.dracoCompressionLevel;
+
+                std::shared_ptr<const MeshBuffers> buffers = piece.buffers;
+                if (!node.IsLeaf())
+                {
+                    auto simplified = std::make_shared<MeshBuffers>();
+                    simplified->extrasLayout = buffers->extrasLayout;
+                    ClusterVertices(buffers->vertices, buffers->indices, buffers->extras, buffers->extrasLayout.Stride(), node.cellMin, cellSize,
+                        simplified->vertices, simplified->indices, simplified->extras);
+                    if (simplified->indices.empty())
+                    {
+                        continue; // smaller than a cell
+                    }
+                    if (!buffers->tangents.empty())
+                    {
+                        GenerateTangents(simplified->vertices, simplified->indices, simplified->extras, simplified->extrasLayout.Stride(),
+                            simplified->tangents);
+                    }
+                    if (mesh.useDracoCompression)
+                    {
+                        simplified->dracoData = tileExporter.CompressMesh(simplified->vertices, simplified->indices, mesh.dracoCompressionLevel,
+                            &simplified->tangents, &simplified->extras, simplified->extrasLayout);
+                    }
+                    buffers = std::move(simplified);
+                }
 
-    Mesh mesh;
-    mesh.name = name;
-    mesh.vertices = vertexData;
-    mesh.indices = newIndices;
-    mesh.materialIndex = materialIndex;
-    mesh.useDracoCompression = useDraco;
-    mesh.dracoCompressionLevel = dracoLevel;
+                Node gltfNode;
+                gltfNode.name = object.data.name;
+                gltfNode.meshIndex = tileExporter.AddMesh(mesh, { { &buffers->vertices, &buffers->indices, &buffers->dracoData, nullptr, buffers,
+                    &buffers->tangents, buffers->extrasLayout, &buffers->extras } });
+                tileExporter.AddNode(gltfNode);
+            }
 
-    int meshIndex = exporter.AddMesh(mesh);
+            if (!tileExporter.ExportToFile((std::filesystem::path(settings.exportDir) / tile.uri).string(), true))
+            {
+                failed = true;
+            }
+        }
+    });
 
-    Node node;
-    node.name = name;
-    node.meshIndex = meshIndex;
-    exporter.AddNode(node);
+    // what a viewer that doesn't show the root at all gets wrong: all of it
+    const TileNode& root = nodes[0];
+    double diagonal = 0.0;
+    for (int i = 0; i < 3; i++)
+    {
+        double extent = static_cast<double>(root.boundsMax[i]) - root.boundsMin[i];
+        diagonal += extent * extent;
+    }
 
-    // Export to file
-    std::cout << "Attempting to export to file..." << std::endl;
+    std::string tilesetPath = (std::filesystem::path(settings.exportDir) / "tileset.json").string();
+    progress.TrackFile(tilesetPath);
+    return WriteTilesetFile(tiles, std::sqrt(diagonal), tilesetPath, settings.compactJson) && !failed;
+}
 
-    bool success = exporter.ExportToFile(filepath, false);  // Use the provided filepath
+void ExportSession::Seal()
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (finished)
+    {
+        throw std::runtime_error("export session was already finished");
+    }
+    finished = true;
+    // a background job may still be in Finish when python calls Begin again
+    running = true;
+    sealed = true;
+}
 
-    if (success) {
-        std::cout << "GLTF exported successfully to: " << filepath << std::endl;
+bool ExportSession::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (finished)
+        {
+            throw std::runtime_error("export session was already finished");
+        }
+        finished = true;
+        running = true;
     }
-    else {
-        std::cout << "Failed to export GLTF to: " << filepath << std::endl;
+    return RunFinish();
+}
+
+bool ExportSession::FinishSealed()
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!sealed)
+        {
+            throw std::runtime_error("FinishSealed called without Seal");
+        }
+        sealed = false;
     }
+    return RunFinish();
+}
+
+bool ExportSession::RunFinish()
+{
+    PROFILE_FUNCTION();
+    struct RunningGuard
+    {
+        ExportSession& session;
+        ~RunningGuard()
+        {
+            // the arenas go back in one go, every task is done by now
+            session.arenas.Release();
+            session.running = false;
+        }
+    } runningGuard{ *this };
 
+    // Export graph:
+    //   last object commit (all objects are in the model by then) -> write file -> zip
+    TaskScheduler& scheduler = GetScheduler();
 
-    if (zip)
+    // the commits already wait for everything, except an object AddObject gave up on halfway
+    std::vector<TaskHandle> writeDependencies = { lastCommit };
+    for (const auto& object : objects)
     {
-        std::vector<std::string> texturePaths;
-        for (size_t i = 0; i < textures.size(); i++) {
-            std::string ext = useJpg ? ".jpg" : ".png";
-            std::string texFilePath = exportDir + std::string("\\") + std::to_string(i) + ext;
-            texturePaths.push_back(texFilePath);
+        writeDependencies.insert(writeDependencies.end(), object->tasks.begin(), object->tasks.end());
+    }
+
+    bool success = false;
+    TaskHandle writeTask = scheduler.Submit([this, &success] {
+        progress.ThrowIfCancelled();
+
+        if (settings.inMemory)
+        {
+            success = exporter->ExportToMemory(settings.filepath, IsGlbPath(settings.filepath), memoryFiles);
+            progress.Advance();
+            return;
+        }
+        if (settings.tiling)
+        {
+            success = WriteTiles();
+            progress.Advance();
+            return;
+        }
+
+        // Export to file
+        std::cout << "Attempting to export to file..." << std::endl;
+
+        progress.TrackFile(settings.filepath);
+        success = exporter->ExportToFile(settings.filepath, IsGlbPath(settings.filepath));  // Use the provided filepath
+
+        if (success) {
+            std::cout << "GLTF exported successfully to: " << settings.filepath << std::endl;
+        }
+        else {
+            std::cout << "Failed to export GLTF to: " << settings.filepath << std::endl;
+        }
+        progress.Advance();
+    }, writeDependencies);
+
+    TaskHandle zipTask = scheduler.Submit([this, &success] {
+        if (!settings.zip || !success || settings.inMemory || settings.tiling)
+        {
+            progress.Advance();
+            return;
         }
-        std::string zipPath = filepath;
+        progress.ThrowIfCancelled();
+
+        // a glb has its textures inside, nothing was written next to it
+        std::vector<std::string> texturePaths = exporter->TextureFiles();
+        // the .bin files go in next to the textures
+        const std::vector<std::string>& bufferFiles = exporter->BufferFiles();
+        texturePaths.insert(texturePaths.end(), bufferFiles.begin(), bufferFiles.end());
+        std::string zipPath = settings.filepath;
         size_t lastDot = zipPath.find_last_of('.');
         if (lastDot != std::string::npos) {
             zipPath = zipPath.substr(0, lastDot) + ".zip";
@@ -1021,15 +4271,65 @@ void ReadBlenderData(const py::dict& mesh_data, const std::string& exportDir, co
             zipPath += ".zip";
         }
 
-        if (exporter.CompressToZip(filepath, zipPath, texturePaths))
+        progress.TrackFile(zipPath);
+        if (exporter->CompressToZip(settings.filepath, zipPath, texturePaths))
         {
             // Remove remaining files
-            std::remove(filepath.c_str());
+            std::remove(settings.filepath.c_str());
             for (const auto& texPath : texturePaths) {
                 std::remove(texPath.c_str());
             }
         }
+        else
+        {
+            // the files stay as they are, only the half written zip goes
+            std::remove(zipPath.c_str());
+            success = false;
+        }
+        progress.Advance();
+    }, { writeTask });
+
+    try
+    {
+        scheduler.Wait(zipTask);
+    }
+    catch (const ExportCancelled&)
+    {
+        // zip is the last node of the graph, so every task is finished by now. Only the I/O thread may
+        // still be busy, the files it hasn't started on are dropped
+        fileWriter.Discard();
+        fileWriter.Finish();
+        progress.RemoveTrackedFiles();
+        std::cout << "Export cancelled: " << settings.filepath << std::endl;
+        return false;
+    }
+    catch (...)
+    {
+        fileWriter.Discard();
+        fileWriter.Finish();
+        progress.RemoveTrackedFiles();
+        throw;
     }
 
+    return success;
+}
 
+void ReadBlenderData(const py::dict& mesh_data, const std::string& exportDir, const std::string& filepath, py::list textures, bool useDraco, int dracoLevel, bool useJpg, int jpgLevel, bool zip)
+{
+    PROFILE_FUNCTION();
+    ExportSettings settings;
+    settings.exportDir = exportDir;
+    settings.filepath = filepath;
+    settings.useDraco = useDraco;
+    settings.dracoLevel = dracoLevel;
+    settings.useJpg = useJpg;
+    settings.jpgLevel = jpgLevel;
+    settings.zip = zip;
+
+    ExportSession session(settings);
+    session.AddObject(IngestBlenderData(mesh_data, textures));
+
+    // Everything python related is copied out above, let the UI thread breathe while we work
+    py::gil_scoped_release releaseGil;
+    session.Finish();
 }
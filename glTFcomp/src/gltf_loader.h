@@ -1,15 +1,358 @@
+#pragma once
+
 #include "../external/pybind11/include/pybind11/numpy.h"
 #include <pybind11/pytypes.h>  // for py::dict, py::list, py::str, etc.
 
+#include "export_arena.h"
+#include "export_cache.h"
+#include "export_progress.h"
+#include "file_writer.h"
+#include "memory_budget.h"
+#include "task_scheduler.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 namespace py = pybind11;
-struct Vertex;
+class GLTFExporter;
+struct CachedTexture;
+struct MeshBuffers;
+
+struct TextureData
+{
+    std::string type;
+    std::string filepath; // if filepath texture
+    std::vector<uint8_t> data; // if packed texture, the png/jpeg file if encoded texture
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::string name;
+};
+
+struct Vertex
+{
+    float position[3];
+    float normal[3];
+    float texcoord[2];
+};
+
+// Attributes a mesh can have on top of Vertex. They are kept in an array of their own next to the vertices,
+// Stride() floats per vertex: rgba if there is a color, then u and v of every extra uv set,
+// then 4 joint indices and their 4 weights for a skinned mesh, then the position delta of every morph target
+struct VertexExtras
+{
+    bool color = false; // COLOR_0
+    int uvSets = 0; // TEXCOORD_1 and up
+    bool skin = false; // JOINTS_0 and WEIGHTS_0
+    int morphTargets = 0; // POSITION of the primitive's targets
+    size_t SkinOffset() const { return (color ? 4 : 0) + static_cast<size_t>(uvSets) * 2; }
+    size_t MorphOffset() const { return SkinOffset() + (skin ? 8 : 0); }
+    size_t Stride() const { return MorphOffset() + static_cast<size_t>(morphTargets) * 3; }
+};
+
+// Bone of an object's armature with its rest pose relative to its parent
+struct JointData
+{
+    std::string name;
+    int parent = -1; // index in SkinData::joints, -1 for a root
+    float translation[3] = { 0.0f, 0.0f, 0.0f };
+    float rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f }; // quaternion, xyzw like glTF
+    float scale[3] = { 1.0f, 1.0f, 1.0f };
+};
+
+// A node showing an object's mesh, for a mesh that is shown more than once
+struct InstanceData
+{
+    std::string name;
+    float transform[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 }; // column major, in glTF's y-up
+};
+
+struct SkinData
+{
+    std::vector<JointData> joints; // parents come before their children
+    std::vector<float> inverseBindMatrices; // 16 per joint, column major
+};
+
+// Shape key of an object: where its positions go, the deltas to the object's own positions are worked out natively
+struct MorphTargetData
+{
+    std::string name;
+    std::vector<float> positions; // like ObjectData::positions
+};
+
+// Keys of one animated property
+struct AnimationChannelData
+{
+    int joint = -1; // index in SkinData::joints, -1 for the object's own node
+    std::string path; // translation, rotation or scale
+    std::string interpolation = "LINEAR"; // LINEAR or STEP
+    std::vector<float> times; // seconds
+    std::vector<float> values; // 3 per key, 4 for a rotation
+};
+
+// Animations with the same name end up in one glTF animation, so an action that moves several objects stays together
+struct AnimationData
+{
+    std::string name;
+    std::vector<AnimationChannelData> channels;
+};
+
+// Factors and texture slots of an object's material. The defaults are what every blender object gets
+struct MaterialData
+{
+    std::string name = "TestMaterial";
+    float baseColor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    float metallic = 0.0f;
+    float roughness = 0.8f;
+    // indices in ObjectData::textures, -1 or past the end for none. Blender objects have them in this order
+    int baseColorTexture = 0;
+    int normalTexture = 1;
+    int metallicRoughnessTexture = 2;
+    // the rest only comes from glTF files that get re-exported, see OptimizeGltf
+    int occlusionTexture = -1;
+    int emissiveTexture = -1;
+    float emissive[3] = { 0.0f, 0.0f, 0.0f };
+    float normalScale = 1.0f;
+    float occlusionStrength = 1.0f;
+    std::string alphaMode = "OPAQUE";
+    float alphaCutoff = 0.5f;
+    bool doubleSided = false;
+    // uv set of each texture slot, 0 = the object's uvs, n = uvSets[n - 1]
+    int baseColorTexCoord = 0;
+    int normalTexCoord = 0;
+    int metallicRoughnessTexCoord = 0;
+    int occlusionTexCoord = 0;
+    int emissiveTexCoord = 0;
+};
+
+// Export options coming from the blender export dialog
+struct ExportSettings
+{
+    std::string exportDir;
+    std::string filepath;
+    bool useDraco = true;
+    int dracoLevel = 7;
+    bool useJpg = true;
+    int jpgLevel = 100;
+    bool zip = false;
+    size_t memoryBudget = 0; // bytes the export may keep in flight, 0 = no limit. With tiling only the encoding is counted,
+                             // the finished meshes all stay in memory until the tiles are written
+    bool streamingJson = true; // false = write through tinygltf's json document (base64 buffer), for comparing
+    bool compactJson = true; // no indentation or newlines in the json
+    bool directIo = false; // big files skip the page cache (O_DIRECT on linux)
+    bool passthroughTextures = true; // png/jpeg files already in the output format are copied as they are, without decoding
+    bool keepJpeg = false; // with passthrough a jpeg stays a jpeg when png is asked for, a lossless copy of it is only bigger
+    bool mapBuffer = false; // copy the buffer straight into the memory-mapped .bin/.glb, for scenes bigger than RAM
+    bool bufferPerMesh = false; // every mesh in a .bin of its own so a viewer can fetch only the meshes it shows, .gltf only
+    bool loadOrder = false; // small views, then meshes, then images, small to big, with their byte ranges in extras.byteRanges
+    bool tangents = true; // MikkTSpace tangents for normal mapped objects, so viewers don't have to generate them on load
+    float animationTolerance = 0.0001f; // keys that linear interpolation gets within this of are dropped, 0 keeps every key
+    bool quantizeAnimation = false; // rotation keys as normalized shorts instead of floats
+    float morphTolerance = 0.0001f; // morph deltas within this are dropped, and quantized deltas stay within it
+    int pointBits = 16; // position quantization of draco point clouds, the normals get 10 bits like meshes
+    size_t pointChunk = 1000000; // points per primitive, bigger clouds are encoded in chunks of this many in parallel
+    bool cleanup = true; // degenerate and duplicate faces, unused vertices and NaNs are taken out before compressing, see CleanMesh
+    size_t chunkTriangles = 0; // objects with more triangles are split into welded spatial chunks on disk, 0 = never
+    std::string chunkDir; // where the chunks go, empty = the system's temp directory
+    bool tiling = false; // octree of glb tiles plus a tileset.json in exportDir instead of the one file, not in memory
+    size_t tileTriangles = 200000; // a tile with more gets split
+    int tileDepth = 8; // deepest octree level
+    bool inMemory = false; // keep the gltf/glb, buffers and textures in memory instead of writing files, zip is ignored
+};
+
+// What the mesh cleanup took out or fixed, see CleanMesh
+struct CleanupCounts
+{
+    size_t degenerateFaces = 0;
+    size_t duplicateFaces = 0;
+    size_t unusedVertices = 0;
+    size_t nonFiniteValues = 0;
+
+    CleanupCounts& operator+=(const CleanupCounts& other)
+    {
+        degenerateFaces += other.degenerateFaces;
+        duplicateFaces += other.duplicateFaces;
+        unusedVertices += other.unusedVertices;
+        nonFiniteValues += other.nonFiniteValues;
+        return *this;
+    }
+};
+
+// One file of an in-memory export, named like it would be on disk. The bytes stay valid as long as owner lives
+struct MemoryFile
+{
+    std::string name;
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<const void> owner;
+};
+
+// Read-only values in a vector of ours or in memory someone else keeps alive, indexed like the vector
+template <typename T>
+class ArrayView
+{
+public:
+    ArrayView() = default;
+    ArrayView(const T* data, size_t size) : values(data), count(size) {}
+    ArrayView(const std::vector<T>& vector) : values(vector.data()), count(vector.size()) {}
+
+    const T* data() const { return values; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return values[i]; }
+
+private:
+    const T* values = nullptr;
+    size_t count = 0;
+};
+
+// The numpy arrays of an object too big to copy out of python, read in place by the chunked export.
+// owner keeps them alive and may be let go of without the GIL, see ReleaseFinishedArrays
+struct MeshArrays
+{
+    ArrayView<float> positions;
+    ArrayView<float> normals;
+    ArrayView<float> uvs;
+    ArrayView<uint32_t> indices;
+    std::shared_ptr<const void> owner;
+};
+
+// One blender object copied out of the python dicts, so the export can run without holding the GIL
+struct ObjectData
+{
+    std::string name;
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<float> colors; // rgba per face corner, optional
+    std::vector<std::vector<float>> uvSets; // TEXCOORD_1 and up, uv per face corner
+    std::vector<uint16_t> joints; // 4 per face corner, indices in skin.joints, optional
+    std::vector<float> weights; // 4 per face corner, with the joints
+    std::vector<uint32_t> indices;
+    SkinData skin;
+    std::vector<AnimationData> animations;
+    std::vector<MorphTargetData> morphTargets;
+    std::vector<TextureData> textures;
+    MaterialData material;
+    bool points = false; // a point cloud: positions, normals and colors per point, no indices, see IngestPointCloud
+    std::vector<InstanceData> instances; // a node each for the one mesh, empty = one node named after the object. Not for tiling
+    MeshArrays borrowed; // instead of positions, normals, uvs and indices when its owner is set
+};
+
 template <typename T>
 std::vector<T> NumpyArrayToVector(const py::array_t<T>& arrIn);
 std::vector<Vertex> StoreInVertex(
-    const std::vector<float>& positions,   
-    const std::vector<float>& normals,    
-    const std::vector<float>& uvs,         
-    const std::vector<uint32_t>& indices);
-void ReadBlenderData(const py::dict& mesh_data, const std::string& exportDir, 
-    const std::string& filepath, py::list textures, bool useDraco, 
+    const std::vector<float>& positions,
+    const std::vector<float>& normals,
+    const std::vector<float>& uvs,
+    const std::vector<uint32_t>& indices,
+    const ExportProgress* progress = nullptr);
+// Same, but fills a vector that may be reused from an earlier export
+void StoreInVertex(
+    const std::vector<float>& positions,
+    const std::vector<float>& normals,
+    const std::vector<float>& uvs,
+    const std::vector<uint32_t>& indices,
+    std::vector<Vertex>& vertices,
+    const ExportProgress* progress = nullptr);
+// Needs the GIL, copies the mesh dict and texture list into native data. An object with more than borrowTriangles
+// triangles keeps its positions, normals, uvs and indices in the numpy arrays instead, 0 = always copy
+ObjectData IngestBlenderData(const py::dict& mesh_data, const py::list& textures, size_t borrowTriangles = 0);
+// Lets go of the numpy arrays exports were done with while they ran without the GIL, needs the GIL
+void ReleaseFinishedArrays();
+// Same for scan data: vertices, optional normals and colors (rgb or rgba) per point, no faces
+ObjectData IngestPointCloud(const py::dict& point_data);
+// Settings of the image encoders that are globals of stb, once when the module loads before any export runs
+void InitImageEncoding();
+
+// Streams objects into one export: every added object is compressed on the scheduler right away,
+// while the caller extracts the next one. Finish joins everything and writes the file.
+// A session can be kept around and reused with Begin: its exporter, scratch buffers and the
+// texture/mesh caches stay warm, so re-exporting mostly unchanged scenes skips the encoding.
+// With a memory budget set, AddObject blocks until the object's estimated working memory fits.
+// Files are written on a separate I/O thread while the workers keep encoding.
+// Doesn't touch python, so it can run without the GIL.
+class ExportSession
+{
+public:
+    explicit ExportSession(ExportSettings settings);
+    ~ExportSession();
+
+    ExportSession(const ExportSession&) = delete;
+    ExportSession& operator=(const ExportSession&) = delete;
+
+    // Starts the next export, only allowed once the previous one finished (or before anything was added)
+    void Begin(ExportSettings settings);
+    // Point clouds come in here as well and become a POINTS primitive per ExportSettings::pointChunk points
+    void AddObject(ObjectData object);
+    // Returns false on failure or cancellation
+    bool Finish();
+    // For a Finish that runs on another thread: Seal on the calling thread refuses AddObject, Begin and Finish from
+    // then on, like a started Finish does, and FinishSealed does the rest on the other one. Seal throws when the
+    // session was already finished
+    void Seal();
+    bool FinishSealed();
+    // Files of the last in-memory export, handed over once: the .glb, or the .gltf followed by its .bin and textures
+    std::vector<MemoryFile> TakeMemoryFiles() { std::vector<MemoryFile> files; files.swap(memoryFiles); return files; }
+    void Cancel() { progress.Cancel(); }
+    const ExportProgress& Progress() const { return progress; }
+    const ExportSettings& Settings() const { return settings; }
+
+    void SetCacheLimits(size_t textureBytes, size_t meshBytes);
+    void ClearCaches();
+    // Use the texture cache of another session from now on, so sessions exporting side by side share their encoded textures
+    void ShareTextureCache(const ExportSession& other) { textureCache = other.textureCache; }
+    std::map<std::string, size_t> CacheStats() const;
+    std::map<std::string, size_t> MemoryStats() const;
+    // What the cleanup took out of the meshes of this export, meshes from the cache were cleaned by an earlier one
+    std::map<std::string, size_t> CleanupStats() const;
+
+private:
+    struct PendingObject;
+
+    uint64_t TextureKey(const TextureData& texture) const;
+    uint64_t MeshKey(const ObjectData& object) const;
+    // Finish after the session got marked finished
+    bool RunFinish();
+    // Mesh tasks of an object too big to expand in memory: partition into chunks on disk, then weld and compress chunk by chunk
+    std::vector<TaskHandle> SubmitChunkedMesh(PendingObject* object, std::shared_ptr<MemoryLease> meshLease);
+    // Mesh task of a point cloud: its chunks are converted and draco encoded in parallel, straight from the input
+    TaskHandle SubmitPointCloud(PendingObject* object, std::shared_ptr<MemoryLease> meshLease);
+    // Commits the object once its tasks and the previous commit are done, the lease goes with it
+    void SubmitCommit(PendingObject* object, std::shared_ptr<MemoryLease> meshLease);
+    // Adds the object's textures, material, mesh and node to the model
+    void CommitObject(PendingObject& object);
+    // Tiled export of the committed objects, see ExportSettings::tiling
+    bool WriteTiles();
+    // CleanMesh when the settings ask for it, its counts go into the export's
+    void Clean(MeshBuffers& mesh);
+
+    ExportSettings settings;
+    ExportProgress progress;
+    std::unique_ptr<GLTFExporter> exporter;
+    std::vector<std::unique_ptr<PendingObject>> objects;
+    std::vector<std::unique_ptr<PendingObject>> spareObjects; // recycled with their buffers by Begin
+    TaskHandle lastCommit; // objects are committed to the model in order
+    int textureCount = 0;
+    std::vector<MemoryFile> memoryFiles;
+    // Begin, AddObject and the start of Finish/Seal hold it, so python can't add to an export a job is finishing
+    std::mutex stateMutex;
+    std::atomic<bool> finished{ false };
+    std::atomic<bool> running{ false };
+    bool sealed = false; // Seal was called, FinishSealed hasn't started yet
+    mutable std::mutex cleanupMutex;
+    CleanupCounts cleanupCounts;
+
+    std::shared_ptr<ExportCache<CachedTexture>> textureCache;
+    ExportCache<MeshBuffers> meshCache;
+    MemoryBudget budget;
+    ExportArenas arenas; // scratch memory of the texture tasks
+    AsyncFileWriter fileWriter; // textures and buffers are written on its I/O thread
+};
+void ReadBlenderData(const py::dict& mesh_data, const std::string& exportDir,
+    const std::string& filepath, py::list textures, bool useDraco,
     int dracoLevel, bool useJpg, int jpgLevel, bool zip);
@@ -0,0 +1,673 @@
+#include "gltf_optimizer.h"
+
+//tinygltf, the implementation and draco decoding are in gltf_loader.cpp
+#include "../external/tinygltf/tiny_gltf.h"
+
+//stl
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <numeric>
+
+namespace
+{
+    // column major like glTF
+    using Matrix = std::array<double, 16>;
+    const Matrix identityMatrix = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+    Matrix Multiply(const Matrix& a, const Matrix& b)
+    {
+        Matrix out{};
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    out[c * 4 + r] += a[k * 4 + r] * b[c * 4 + k];
+                }
+            }
+        }
+        return out;
+    }
+
+    Matrix NodeMatrix(const tinygltf::Node& node)
+    {
+        Matrix m = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+        if (node.matrix.size() == 16)
+        {
+            std::copy(node.matrix.begin(), node.matrix.end(), m.begin());
+            return m;
+        }
+        // T * R * S
+        double q[4] = { 0, 0, 0, 1 };
+        double s[3] = { 1, 1, 1 };
+        std::copy_n(node.rotation.begin(), std::min<size_t>(node.rotation.size(), 4), q);
+        std::copy_n(node.scale.begin(), std::min<size_t>(node.scale.size(), 3), s);
+        double x = q[0], y = q[1], z = q[2], w = q[3];
+        double r[9] = {
+            1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+            2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+            2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y),
+        };
+        for (int c = 0; c < 3; c++)
+        {
+            for (int row = 0; row < 3; row++)
+            {
+                m[c * 4 + row] = r[c * 3 + row] * s[c];
+            }
+        }
+        for (int i = 0; i < 3 && i < static_cast<int>(node.translation.size()); i++)
+        {
+            m[12 + i] = node.translation[i];
+        }
+        return m;
+    }
+
+    // Floats of an accessor, normalized integers scaled the way glTF says, sparse values applied
+    std::vector<float> ReadAccessor(const tinygltf::Model& model, int index, int& components)
+    {
+        std::vector<float> out;
+        components = 0;
+        if (index < 0 || index >= static_cast<int>(model.accessors.size()))
+        {
+            return out;
+        }
+        const tinygltf::Accessor& accessor = model.accessors[index];
+        components = tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+        int componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+        if (components <= 0 || componentSize <= 0)
+        {
+            components = 0;
+            return out;
+        }
+        out.assign(accessor.count * components, 0.0f);
+
+        auto convert = [&](const unsigned char* data) {
+            switch (accessor.componentType)
+            {
+            case TINYGLTF_COMPONENT_TYPE_FLOAT: { float v; std::memcpy(&v, data, 4); return v; }
+            case TINYGLTF_COMPONENT_TYPE_BYTE: { int8_t v; std::memcpy(&v, data, 1); return accessor.normalized ? std::max(v / 127.0f, -1.0f) : v; }
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: { uint8_t v = *data; return accessor.normalized ? v / 255.0f : v; }
+            case TINYGLTF_COMPONENT_TYPE_SHORT: { int16_t v; std::memcpy(&v, data, 2); return accessor.normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16_t v; std::memcpy(&v, data, 2); return accessor.normalized ? v / 65535.0f : v; }
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: { uint32_t v; std::memcpy(&v, data, 4); return static_cast<float>(v); }
+            default: return 0.0f;
+            }
+        };
+        // reads count elements of a view into out, at the indices from element() if given
+        auto readView = [&](int viewIndex, size_t byteOffset, size_t stride, size_t count, const std::function<size_t(size_t)>& element) {
+            if (viewIndex < 0 || viewIndex >= static_cast<int>(model.bufferViews.size()))
+            {
+                return false;
+            }
+            const tinygltf::BufferView& view = model.bufferViews[viewIndex];
+            const tinygltf::Buffer& buffer = model.buffers[view.buffer];
+            size_t begin = view.byteOffset + byteOffset;
+            size_t end = count > 0 ? begin + (count - 1) * stride + componentSize * components : begin;
+            if (end > buffer.data.size() || end > view.byteOffset + view.byteLength)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t target = element ? element(i) : i;
+                if (target >= accessor.count)
+                {
+                    continue;
+                }
+                for (int c = 0; c < components; c++)
+                {
+                    out[target * components + c] = convert(&buffer.data[begin + i * stride + c * componentSize]);
+                }
+            }
+            return true;
+        };
+
+        if (accessor.bufferView >= 0)
+        {
+            int stride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+            if (stride <= 0 || !readView(accessor.bufferView, accessor.byteOffset, stride, accessor.count, nullptr))
+            {
+                std::cerr << "Accessor " << index << " doesn't fit its buffer view" << std::endl;
+                components = 0;
+                return {};
+            }
+        }
+        if (accessor.sparse.isSparse)
+        {
+            const auto& sparse = accessor.sparse;
+            size_t count = static_cast<size_t>(sparse.count);
+            std::vector<size_t> targets(count);
+            const tinygltf::BufferView& indexView = model.bufferViews[sparse.indices.bufferView];
+            const auto& indexData = model.buffers[indexView.buffer].data;
+            int indexSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(sparse.indices.componentType));
+            size_t indexBegin = indexView.byteOffset + sparse.indices.byteOffset;
+            if (indexSize <= 0 || indexBegin + count * indexSize > indexData.size())
+            {
+                std::cerr << "Sparse indices of accessor " << index << " don't fit their buffer" << std::endl;
+                return out;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t value = 0;
+                std::memcpy(&value, &indexData[indexBegin + i * indexSize], indexSize);
+                targets[i] = value;
+            }
+            readView(sparse.values.bufferView, sparse.values.byteOffset, componentSize * components, count,
+                [&](size_t i) { return targets[i]; });
+        }
+        return out;
+    }
+
+    std::vector<uint32_t> ReadIndices(const tinygltf::Model& model, const tinygltf::Primitive& primitive, size_t vertexCount)
+    {
+        std::vector<uint32_t> indices;
+        if (primitive.indices < 0)
+        {
+            indices.resize(vertexCount);
+            std::iota(indices.begin(), indices.end(), 0u);
+            return indices;
+        }
+        // read as integers, through ReadAccessor's floats anything past 2^24 would come out rounded
+        if (primitive.indices >= static_cast<int>(model.accessors.size()))
+        {
+            return indices;
+        }
+        const tinygltf::Accessor& accessor = model.accessors[primitive.indices];
+        int indexSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+        bool integer = accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE ||
+            accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT || accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+        if (!integer || accessor.type != TINYGLTF_TYPE_SCALAR || accessor.bufferView < 0 ||
+            accessor.bufferView >= static_cast<int>(model.bufferViews.size()))
+        {
+            std::cerr << "Index accessor " << primitive.indices << " isn't unsigned integers in a buffer view" << std::endl;
+            return indices;
+        }
+        const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+        const auto& data = model.buffers[view.buffer].data;
+        int stride = accessor.ByteStride(view);
+        size_t begin = view.byteOffset + accessor.byteOffset;
+        size_t end = accessor.count > 0 ? begin + (accessor.count - 1) * stride + indexSize : begin;
+        if (stride <= 0 || end > data.size() || end > view.byteOffset + view.byteLength)
+        {
+            std::cerr << "Accessor " << primitive.indices << " doesn't fit its buffer view" << std::endl;
+            return indices;
+        }
+        indices.resize(accessor.count);
+        for (size_t i = 0; i < accessor.count; i++)
+        {
+            uint32_t value = 0;
+            std::memcpy(&value, &data[begin + i * stride], indexSize);
+            indices[i] = value;
+        }
+        return indices;
+    }
+
+    // Triangle lists out of strips and fans, the winding of every other strip triangle turned back
+    std::vector<uint32_t> ToTriangles(const std::vector<uint32_t>& indices, int mode)
+    {
+        if (mode == TINYGLTF_MODE_TRIANGLES)
+        {
+            return indices;
+        }
+        std::vector<uint32_t> triangles;
+        for (size_t i = 2; i < indices.size(); i++)
+        {
+            if (mode == TINYGLTF_MODE_TRIANGLE_STRIP)
+            {
+                bool odd = i % 2 == 1;
+                triangles.insert(triangles.end(), { indices[i - 2], indices[odd ? i : i - 1], indices[odd ? i - 1 : i] });
+            }
+            else
+            {
+                triangles.insert(triangles.end(), { indices[0], indices[i - 1], indices[i] });
+            }
+        }
+        return triangles;
+    }
+
+    // glTF y-up to blender z-up, the ingest turns it back
+    void ToZUp(float* v)
+    {
+        float y = v[1];
+        v[1] = -v[2];
+        v[2] = y;
+    }
+
+    class SceneReader
+    {
+    public:
+        SceneReader(const tinygltf::Model& model, const std::string& baseDir, bool bakeInstances)
+            : model(model), baseDir(baseDir), bakeInstances(bakeInstances) {}
+
+        // Every primitive of a mesh becomes one object in the mesh's own space, each node showing it an instance of it
+        // with the node's world transform. With bakeInstances every node gets objects of its own with the transform baked in
+        void AddNode(int nodeIndex, const Matrix& parent, std::vector<ObjectData>& objects, int depth)
+        {
+            if (nodeIndex < 0 || nodeIndex >= static_cast<int>(model.nodes.size()) || depth > 256)
+            {
+                return;
+            }
+            const tinygltf::Node& node = model.nodes[nodeIndex];
+            Matrix world = Multiply(parent, NodeMatrix(node));
+            if (node.mesh >= 0 && node.mesh < static_cast<int>(model.meshes.size()))
+            {
+                const tinygltf::Mesh& mesh = model.meshes[node.mesh];
+                std::string name = !node.name.empty() ? node.name : !mesh.name.empty() ? mesh.name : "Mesh" + std::to_string(node.mesh);
+                if (node.skin >= 0 || !mesh.weights.empty())
+                {
+                    std::cerr << name << ": skins and morph targets aren't re-exported, the mesh goes out in its rest pose" << std::endl;
+                }
+                for (size_t p = 0; p < mesh.primitives.size(); p++)
+                {
+                    std::string objectName = mesh.primitives.size() > 1 ? name + "_" + std::to_string(p) : name;
+                    if (bakeInstances)
+                    {
+                        ObjectData object;
+                        object.name = objectName;
+                        if (ReadPrimitive(mesh.primitives[p], world, object))
+                        {
+                            objects.push_back(std::move(object));
+                        }
+                        continue;
+                    }
+
+                    // read the first time a node shows it, -1 when it can't be exported
+                    auto key = std::make_pair(node.mesh, p);
+                    auto found = meshObjects.find(key);
+                    if (found == meshObjects.end())
+                    {
+                        ObjectData object;
+                        object.name = objectName;
+                        int index = -1;
+                        if (ReadPrimitive(mesh.primitives[p], identityMatrix, object))
+                        {
+                            index = static_cast<int>(objects.size());
+                            objects.push_back(std::move(object));
+                        }
+                        found = meshObjects.emplace(key, index).first;
+                    }
+                    if (found->second >= 0)
+                    {
+                        InstanceData instance;
+                        instance.name = objectName;
+                        std::copy(world.begin(), world.end(), instance.transform);
+                        objects[found->second].instances.push_back(std::move(instance));
+                    }
+                }
+            }
+            for (int child : node.children)
+            {
+                AddNode(child, world, objects, depth + 1);
+            }
+        }
+
+    private:
+        bool ReadPrimitive(const tinygltf::Primitive& primitive, const Matrix& world, ObjectData& object)
+        {
+            int mode = primitive.mode < 0 ? TINYGLTF_MODE_TRIANGLES : primitive.mode;
+            bool points = mode == TINYGLTF_MODE_POINTS;
+            if (!points && mode != TINYGLTF_MODE_TRIANGLES && mode != TINYGLTF_MODE_TRIANGLE_STRIP && mode != TINYGLTF_MODE_TRIANGLE_FAN)
+            {
+                std::cerr << object.name << ": lines aren't exported" << std::endl;
+                return false;
+            }
+            auto attribute = [&](const char* name, int& components) {
+                auto it = primitive.attributes.find(name);
+                return it == primitive.attributes.end() ? std::vector<float>() : ReadAccessor(model, it->second, components);
+            };
+
+            int components = 0;
+            std::vector<float> positions = attribute("POSITION", components);
+            if (components != 3 || positions.empty())
+            {
+                std::cerr << object.name << " has no positions" << std::endl;
+                return false;
+            }
+            size_t vertexCount = positions.size() / 3;
+
+            // the normal matrix is the cofactor matrix, turned around when the transform mirrors
+            double det = world[0] * (world[5] * world[10] - world[9] * world[6]) - world[4] * (world[1] * world[10] - world[9] * world[2]) +
+                world[8] * (world[1] * world[6] - world[5] * world[2]);
+            double sign = det < 0.0 ? -1.0 : 1.0;
+            double normalMatrix[9];
+            for (int c = 0; c < 3; c++)
+            {
+                for (int r = 0; r < 3; r++)
+                {
+                    int c1 = (c + 1) % 3, c2 = (c + 2) % 3, r1 = (r + 1) % 3, r2 = (r + 2) % 3;
+                    normalMatrix[c * 3 + r] = sign * (world[c1 * 4 + r1] * world[c2 * 4 + r2] - world[c1 * 4 + r2] * world[c2 * 4 + r1]);
+                }
+            }
+            for (size_t v = 0; v < vertexCount; v++)
+            {
+                float* p = &positions[v * 3];
+                double out[3];
+                for (int r = 0; r < 3; r++)
+                {
+                    out[r] = world[r] * p[0] + world[4 + r] * p[1] + world[8 + r] * p[2] + world[12 + r];
+                }
+                for (int r = 0; r < 3; r++)
+                {
+                    p[r] = static_cast<float>(out[r]);
+                }
+                ToZUp(p);
+            }
+
+            int normalComponents = 0;
+            std::vector<float> normals = attribute("NORMAL", normalComponents);
+            if (normalComponents == 3 && normals.size() == positions.size())
+            {
+                for (size_t v = 0; v < vertexCount; v++)
+                {
+                    float* n = &normals[v * 3];
+                    double out[3];
+                    double length = 0.0;
+                    for (int r = 0; r < 3; r++)
+                    {
+                        out[r] = normalMatrix[r] * n[0] + normalMatrix[3 + r] * n[1] + normalMatrix[6 + r] * n[2];
+                        length += out[r] * out[r];
+                    }
+                    length = std::sqrt(length);
+                    for (int r = 0; r < 3; r++)
+                    {
+                        n[r] = length > 0.0 ? static_cast<float>(out[r] / length) : 0.0f;
+                    }
+                    ToZUp(n);
+                }
+            }
+            else
+            {
+                normals.clear();
+            }
+
+            int colorComponents = 0;
+            std::vector<float> colors = attribute("COLOR_0", colorComponents);
+            if ((colorComponents != 3 && colorComponents != 4) || colors.size() / colorComponents != vertexCount)
+            {
+                colors.clear();
+            }
+
+            if (points)
+            {
+                object.points = true;
+                object.positions = std::move(positions);
+                object.normals = std::move(normals);
+                for (size_t v = 0; v < vertexCount && !colors.empty(); v++)
+                {
+                    object.colors.insert(object.colors.end(), &colors[v * colorComponents], &colors[v * colorComponents] + 3);
+                    object.colors.push_back(colorComponents == 4 ? colors[v * 4 + 3] : 1.0f);
+                }
+                return true;
+            }
+
+            std::vector<uint32_t> indices = ToTriangles(ReadIndices(model, primitive, vertexCount), mode);
+            indices.resize(indices.size() / 3 * 3);
+            if (det < 0.0)
+            {
+                // a mirroring transform turns the faces inside out, the winding turns them back
+                for (size_t t = 0; t < indices.size(); t += 3)
+                {
+                    std::swap(indices[t + 1], indices[t + 2]);
+                }
+            }
+
+            // the pipeline takes everything but the positions per face corner
+            std::vector<std::vector<float>> uvSets;
+            for (int set = 0;; set++)
+            {
+                int uvComponents = 0;
+                std::vector<float> uvs = attribute(("TEXCOORD_" + std::to_string(set)).c_str(), uvComponents);
+                if (uvComponents != 2 || uvs.size() != vertexCount * 2)
+                {
+                    break;
+                }
+                std::vector<float> corners(indices.size() * 2);
+                for (size_t i = 0; i < indices.size(); i++)
+                {
+                    uint32_t v = std::min<uint32_t>(indices[i], static_cast<uint32_t>(vertexCount - 1));
+                    // glTF has v going down, blender up
+                    corners[i * 2] = uvs[v * 2];
+                    corners[i * 2 + 1] = 1.0f - uvs[v * 2 + 1];
+                }
+                uvSets.push_back(std::move(corners));
+            }
+
+            object.normals.resize(indices.size() * 3);
+            for (size_t t = 0; t < indices.size(); t += 3)
+            {
+                const uint32_t* face = &indices[t];
+                bool inRange = face[0] < vertexCount && face[1] < vertexCount && face[2] < vertexCount;
+                float faceNormal[3] = { 0.0f, 0.0f, 1.0f };
+                if (normals.empty() && inRange)
+                {
+                    // flat shading, what a viewer does for a mesh without normals
+                    const float* a = &positions[face[0] * 3];
+                    const float* b = &positions[face[1] * 3];
+                    const float* c = &positions[face[2] * 3];
+                    float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                    float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                    float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+                    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    for (int i = 0; i < 3 && length > 0.0f; i++)
+                    {
+                        faceNormal[i] = n[i] / length;
+                    }
+                }
+                for (int c = 0; c < 3; c++)
+                {
+                    const float* n = !normals.empty() && face[c] < vertexCount ? &normals[face[c] * 3] : faceNormal;
+                    std::copy(n, n + 3, &object.normals[(t + c) * 3]);
+                }
+            }
+            if (!colors.empty())
+            {
+                object.colors.resize(indices.size() * 4);
+                for (size_t i = 0; i < indices.size(); i++)
+                {
+                    uint32_t v = std::min<uint32_t>(indices[i], static_cast<uint32_t>(vertexCount - 1));
+                    std::copy_n(&colors[v * colorComponents], 3, &object.colors[i * 4]);
+                    object.colors[i * 4 + 3] = colorComponents == 4 ? colors[v * 4 + 3] : 1.0f;
+                }
+            }
+            if (!uvSets.empty())
+            {
+                object.uvs = std::move(uvSets[0]);
+                object.uvSets.assign(std::make_move_iterator(uvSets.begin() + 1), std::make_move_iterator(uvSets.end()));
+            }
+            object.positions = std::move(positions);
+            object.indices = std::move(indices);
+            ReadMaterial(primitive.material, object);
+            return true;
+        }
+
+        void ReadMaterial(int materialIndex, ObjectData& object)
+        {
+            if (materialIndex < 0 || materialIndex >= static_cast<int>(model.materials.size()))
+            {
+                return;
+            }
+            const tinygltf::Material& source = model.materials[materialIndex];
+            MaterialData& material = object.material;
+            material.name = source.name;
+            const auto& pbr = source.pbrMetallicRoughness;
+            for (int i = 0; i < 4 && i < static_cast<int>(pbr.baseColorFactor.size()); i++)
+            {
+                material.baseColor[i] = static_cast<float>(pbr.baseColorFactor[i]);
+            }
+            material.metallic = static_cast<float>(pbr.metallicFactor);
+            material.roughness = static_cast<float>(pbr.roughnessFactor);
+            for (int i = 0; i < 3 && i < static_cast<int>(source.emissiveFactor.size()); i++)
+            {
+                material.emissive[i] = static_cast<float>(source.emissiveFactor[i]);
+            }
+            material.normalScale = static_cast<float>(source.normalTexture.scale);
+            material.occlusionStrength = static_cast<float>(source.occlusionTexture.strength);
+            material.alphaMode = source.alphaMode;
+            material.alphaCutoff = static_cast<float>(source.alphaCutoff);
+            material.doubleSided = source.doubleSided;
+
+            // a texture in several slots (occlusion packed into the metallic roughness map) goes in once
+            std::map<int, int> added;
+            size_t uvSetCount = object.uvs.empty() ? 0 : 1 + object.uvSets.size();
+            auto texture = [&](int textureIndex, int texCoord, int& objectTexCoord) {
+                objectTexCoord = texCoord;
+                if (textureIndex >= 0 && (texCoord < 0 || static_cast<size_t>(texCoord) >= uvSetCount))
+                {
+                    std::cerr << object.name << ": uv set " << texCoord << " of texture " << textureIndex << " isn't there, it gets the first one" << std::endl;
+                    objectTexCoord = 0;
+                }
+                auto found = added.find(textureIndex);
+                if (found != added.end())
+                {
+                    return found->second;
+                }
+                return added[textureIndex] = AddTexture(textureIndex, object);
+            };
+            material.baseColorTexture = texture(pbr.baseColorTexture.index, pbr.baseColorTexture.texCoord, material.baseColorTexCoord);
+            material.normalTexture = texture(source.normalTexture.index, source.normalTexture.texCoord, material.normalTexCoord);
+            material.metallicRoughnessTexture = texture(pbr.metallicRoughnessTexture.index, pbr.metallicRoughnessTexture.texCoord,
+                material.metallicRoughnessTexCoord);
+            material.occlusionTexture = texture(source.occlusionTexture.index, source.occlusionTexture.texCoord, material.occlusionTexCoord);
+            material.emissiveTexture = texture(source.emissiveTexture.index, source.emissiveTexture.texCoord, material.emissiveTexCoord);
+        }
+
+        // Index of the texture's image in object.textures, -1 if there is none or it can't be read
+        int AddTexture(int textureIndex, ObjectData& object)
+        {
+            if (textureIndex < 0 || textureIndex >= static_cast<int>(model.textures.size()))
+            {
+                return -1;
+            }
+            int source = model.textures[textureIndex].source;
+            if (source < 0 || source >= static_cast<int>(model.images.size()))
+            {
+                return -1;
+            }
+            const tinygltf::Image& image = model.images[source];
+            TextureData texture;
+            texture.name = !image.name.empty() ? image.name : "image" + std::to_string(source);
+            if (!image.uri.empty() && image.image.empty())
+            {
+                // a file next to the model, it goes through like a blender file texture (and may be passed through as it is)
+                std::string decoded;
+                tinygltf::URIDecode(image.uri, &decoded, nullptr);
+                texture.type = "file";
+                texture.filepath = (std::filesystem::path(baseDir) / decoded).string();
+            }
+            else if (image.as_is && !image.image.empty())
+            {
+                // the png or jpeg of a buffer view or data uri, the export probes it like a file and only decodes it
+                // when it has to be re-encoded
+                texture.type = "encoded";
+                texture.data = image.image;
+            }
+            else
+            {
+                std::cerr << "Image " << texture.name << " couldn't be read, left out" << std::endl;
+                return -1;
+            }
+            object.textures.push_back(std::move(texture));
+            return static_cast<int>(object.textures.size()) - 1;
+        }
+
+        const tinygltf::Model& model;
+        std::string baseDir;
+        bool bakeInstances;
+        std::map<std::pair<int, size_t>, int> meshObjects; // (mesh, primitive) to its object
+    };
+
+    // Nothing is decoded here: files are only kept as their uri and embedded images as their encoded bytes,
+    // the export reads both itself
+    bool LoadImage(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*)
+    {
+        if (image->uri.empty())
+        {
+            image->image.assign(bytes, bytes + size);
+            image->as_is = true;
+        }
+        return true;
+    }
+}
+
+bool OptimizeGltf(const std::string& input, const std::string& output, ExportSettings settings)
+{
+    ExportSession session(settings);
+    return OptimizeGltf(input, output, std::move(settings), session);
+}
+
+bool OptimizeGltf(const std::string& input, const std::string& output, ExportSettings settings, ExportSession& session)
+{
+    tinygltf::TinyGLTF loader;
+    loader.SetImageLoader(LoadImage, nullptr);
+    tinygltf::Model model;
+    std::string err;
+    std::string warn;
+    std::string extension = std::filesystem::path(input).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    bool loaded = extension == ".glb" ? loader.LoadBinaryFromFile(&model, &err, &warn, input) : loader.LoadASCIIFromFile(&model, &err, &warn, input);
+    if (!warn.empty())
+    {
+        std::cerr << input << ": " << warn << std::endl;
+    }
+    if (!loaded)
+    {
+        std::cerr << "Couldn't load " << input << ": " << err << std::endl;
+        return false;
+    }
+
+    std::filesystem::path outputPath(output);
+    settings.filepath = output;
+    settings.exportDir = outputPath.has_parent_path() ? outputPath.parent_path().string() : ".";
+    std::error_code error;
+    std::filesystem::create_directories(settings.exportDir, error);
+
+    std::vector<ObjectData> objects;
+    // the tiles are cut out of the geometry where it is shown
+    SceneReader reader(model, std::filesystem::path(input).parent_path().string(), settings.tiling);
+    int scene = model.defaultScene >= 0 ? model.defaultScene : 0;
+    if (scene < static_cast<int>(model.scenes.size()))
+    {
+        for (int node : model.scenes[scene].nodes)
+        {
+            reader.AddNode(node, identityMatrix, objects, 0);
+        }
+    }
+    else
+    {
+        // no scene, every root node then
+        std::vector<bool> isChild(model.nodes.size(), false);
+        for (const auto& node : model.nodes)
+        {
+            for (int child : node.children)
+            {
+                if (child >= 0 && child < static_cast<int>(isChild.size()))
+                {
+                    isChild[child] = true;
+                }
+            }
+        }
+        for (size_t n = 0; n < model.nodes.size(); n++)
+        {
+            if (!isChild[n])
+            {
+                reader.AddNode(static_cast<int>(n), identityMatrix, objects, 0);
+            }
+        }
+    }
+    // the objects have copies of everything, the model isn't needed while they export
+    model = tinygltf::Model();
+
+    session.Begin(std::move(settings));
+    for (auto& object : objects)
+    {
+        session.AddObject(std::move(object));
+    }
+    return session.Finish();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <string>
+
+// Re-exports an existing .gltf or .glb through the same pipeline as the blender objects. tinygltf loads it and decodes
+// its draco data, then every primitive of a mesh in the scene becomes an object: cleaned, draco compressed and its
+// textures re-encoded like an exported object, its material kept (factors, alpha, emissive and occlusion, uv sets of
+// the textures). A mesh is written once with a node for every node showing it, at that node's world transform; the
+// hierarchy itself is flattened. A tiled export bakes the transforms into the meshes instead.
+// Skins, animations and morph targets are left out. output decides between .gltf and .glb, settings.filepath and
+// exportDir are set from it. Returns false when the input can't be loaded or the export fails
+bool OptimizeGltf(const std::string& input, const std::string& output, ExportSettings settings);
+// Same with a session of the caller, so its exporter and caches are reused over many files
+bool OptimizeGltf(const std::string& input, const std::string& output, ExportSettings settings, ExportSession& session);
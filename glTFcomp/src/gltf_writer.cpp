@@ -0,0 +1,1278 @@
+#include "gltf_writer.h"
+#include "file_writer.h"
+
+//tinygltf
+#include "../external/tinygltf/tiny_gltf.h"
+
+//stl
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string_view>
+
+namespace
+{
+    // Appends json to a string, and hands the string over to the stream whenever it gets big,
+    // so writing a huge scene never holds more than a small piece of the document
+    class JsonWriter
+    {
+    public:
+        JsonWriter(std::string& buffer, std::ostream* stream, bool compact)
+            : out(buffer), stream(stream), compact(compact)
+        {
+        }
+
+        void BeginObject() { Separate(); out += '{'; first.push_back(true); }
+        void EndObject() { Close('}'); }
+        void BeginArray() { Separate(); out += '['; first.push_back(true); }
+        void EndArray() { Close(']'); }
+
+        void Key(std::string_view key)
+        {
+            Separate();
+            WriteString(key);
+            out += compact ? ":" : ": ";
+            afterKey = true;
+        }
+
+        void String(std::string_view value) { Separate(); WriteString(value); }
+        void Bool(bool value) { Separate(); out += value ? "true" : "false"; }
+        void Null() { Separate(); out += "null"; }
+
+        template <typename T>
+        void Integer(T value)
+        {
+            Separate();
+            char digits[24];
+            auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            out.append(digits, result.ptr);
+        }
+
+        void Number(double value)
+        {
+            Separate();
+            // json has no inf or nan, nlohmann writes those as null too
+            if (!std::isfinite(value))
+            {
+                out += "null";
+                return;
+            }
+
+            // shortest text that reads back as the same double
+            char digits[32];
+            auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            out.append(digits, result.ptr);
+            if (std::find_if(digits, result.ptr, [](char c) { return c == '.' || c == 'e'; }) == result.ptr)
+            {
+                out += ".0"; // keep it a float, like tinygltf did
+            }
+        }
+
+        void Flush()
+        {
+            if (stream)
+            {
+                stream->write(out.data(), static_cast<std::streamsize>(out.size()));
+                out.clear();
+            }
+        }
+
+    private:
+        // comma and newline in front of every value except the first one of an object or array
+        void Separate()
+        {
+            if (afterKey)
+            {
+                afterKey = false;
+                return;
+            }
+            if (first.empty())
+            {
+                return;
+            }
+            if (!first.back())
+            {
+                out += ',';
+            }
+            first.back() = false;
+            Newline();
+
+            if (out.size() >= flushSize)
+            {
+                Flush();
+            }
+        }
+
+        void Close(char bracket)
+        {
+            bool empty = first.back();
+            first.pop_back();
+            if (!empty)
+            {
+                Newline();
+            }
+            out += bracket;
+        }
+
+        void Newline()
+        {
+            if (!compact)
+            {
+                out += '\n';
+                out.append(first.size() * 2, ' ');
+            }
+        }
+
+        void WriteString(std::string_view value)
+        {
+            static const char hex[] = "0123456789abcdef";
+            out += '"';
+            size_t start = 0;
+            for (size_t i = 0; i < value.size(); i++)
+            {
+                unsigned char c = static_cast<unsigned char>(value[i]);
+                if (c >= 0x20 && c != '"' && c != '\\')
+                {
+                    continue; // utf-8 goes through as is
+                }
+
+                out.append(value.data() + start, i - start);
+                start = i + 1;
+                switch (c)
+                {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xF];
+                    break;
+                }
+            }
+            out.append(value.data() + start, value.size() - start);
+            out += '"';
+        }
+
+        static constexpr size_t flushSize = 64 * 1024;
+
+        std::string& out;
+        std::ostream* stream;
+        bool compact;
+        bool afterKey = false;
+        std::vector<bool> first; // per open object/array: nothing written in it yet
+    };
+
+    bool DoubleEqual(double a, double b)
+    {
+        return TINYGLTF_DOUBLE_EQUAL(a, b);
+    }
+
+    // Everything below follows tinygltf's Serialize* functions: same properties, same defaults left out
+
+    // Null and binary values have no json, tinygltf skips them
+    bool HasJson(const tinygltf::Value& value)
+    {
+        return value.Type() != tinygltf::NULL_TYPE && value.Type() != tinygltf::BINARY_TYPE;
+    }
+
+    void WriteValue(JsonWriter& json, const tinygltf::Value& value)
+    {
+        switch (value.Type())
+        {
+        case tinygltf::REAL_TYPE:
+            json.Number(value.Get<double>());
+            break;
+        case tinygltf::INT_TYPE:
+            json.Integer(value.Get<int>());
+            break;
+        case tinygltf::BOOL_TYPE:
+            json.Bool(value.Get<bool>());
+            break;
+        case tinygltf::STRING_TYPE:
+            json.String(value.Get<std::string>());
+            break;
+        case tinygltf::ARRAY_TYPE:
+            json.BeginArray();
+            for (size_t i = 0; i < value.ArrayLen(); i++)
+            {
+                if (HasJson(value.Get(i)))
+                {
+                    WriteValue(json, value.Get(i));
+                }
+            }
+            json.EndArray();
+            break;
+        case tinygltf::OBJECT_TYPE:
+            json.BeginObject();
+            for (const auto& member : value.Get<tinygltf::Value::Object>())
+            {
+                if (HasJson(member.second))
+                {
+                    json.Key(member.first);
+                    WriteValue(json, member.second);
+                }
+            }
+            json.EndObject();
+            break;
+        default:
+            json.Null();
+            break;
+        }
+    }
+
+    void WriteExtensionMap(JsonWriter& json, const tinygltf::ExtensionMap& extensions)
+    {
+        if (extensions.empty())
+        {
+            return;
+        }
+
+        json.Key("extensions");
+        json.BeginObject();
+        for (const auto& extension : extensions)
+        {
+            if (extension.first.empty())
+            {
+                continue;
+            }
+            json.Key(extension.first);
+            // an extension without values still has to show up, as an empty object
+            if (HasJson(extension.second))
+            {
+                WriteValue(json, extension.second);
+            }
+            else
+            {
+                json.BeginObject();
+                json.EndObject();
+            }
+        }
+        json.EndObject();
+    }
+
+    void WriteExtras(JsonWriter& json, const tinygltf::Value& extras)
+    {
+        if (HasJson(extras))
+        {
+            json.Key("extras");
+            WriteValue(json, extras);
+        }
+    }
+
+    template <typename T>
+    void WriteExtrasAndExtensions(JsonWriter& json, const T& object)
+    {
+        WriteExtensionMap(json, object.extensions);
+        WriteExtras(json, object.extras);
+    }
+
+    void WriteName(JsonWriter& json, const std::string& name)
+    {
+        if (!name.empty())
+        {
+            json.Key("name");
+            json.String(name);
+        }
+    }
+
+    template <typename T>
+    void WriteIntegerArray(JsonWriter& json, const char* key, const std::vector<T>& values)
+    {
+        if (values.empty())
+        {
+            return;
+        }
+        json.Key(key);
+        json.BeginArray();
+        for (T value : values)
+        {
+            json.Integer(value);
+        }
+        json.EndArray();
+    }
+
+    void WriteNumberArray(JsonWriter& json, const char* key, const std::vector<double>& values)
+    {
+        if (values.empty())
+        {
+            return;
+        }
+        json.Key(key);
+        json.BeginArray();
+        for (double value : values)
+        {
+            json.Number(value);
+        }
+        json.EndArray();
+    }
+
+    const char* AccessorTypeName(int type)
+    {
+        switch (type)
+        {
+        case TINYGLTF_TYPE_SCALAR: return "SCALAR";
+        case TINYGLTF_TYPE_VEC2: return "VEC2";
+        case TINYGLTF_TYPE_VEC3: return "VEC3";
+        case TINYGLTF_TYPE_VEC4: return "VEC4";
+        case TINYGLTF_TYPE_MAT2: return "MAT2";
+        case TINYGLTF_TYPE_MAT3: return "MAT3";
+        case TINYGLTF_TYPE_MAT4: return "MAT4";
+        default: return "";
+        }
+    }
+
+    void WriteAccessor(JsonWriter& json, const tinygltf::Accessor& accessor)
+    {
+        json.BeginObject();
+        if (accessor.bufferView >= 0)
+        {
+            json.Key("bufferView");
+            json.Integer(accessor.bufferView);
+        }
+        if (accessor.byteOffset != 0)
+        {
+            json.Key("byteOffset");
+            json.Integer(accessor.byteOffset);
+        }
+        json.Key("componentType");
+        json.Integer(accessor.componentType);
+        json.Key("count");
+        json.Integer(accessor.count);
+
+        if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.componentType == TINYGLTF_COMPONENT_TYPE_DOUBLE)
+        {
+            WriteNumberArray(json, "min", accessor.minValues);
+            WriteNumberArray(json, "max", accessor.maxValues);
+        }
+        else
+        {
+            // integer components get integer bounds
+            std::vector<int> minValues(accessor.minValues.begin(), accessor.minValues.end());
+            std::vector<int> maxValues(accessor.maxValues.begin(), accessor.maxValues.end());
+            WriteIntegerArray(json, "min", minValues);
+            WriteIntegerArray(json, "max", maxValues);
+        }
+
+        if (accessor.normalized)
+        {
+            json.Key("normalized");
+            json.Bool(true);
+        }
+        json.Key("type");
+        json.String(AccessorTypeName(accessor.type));
+        WriteName(json, accessor.name);
+        WriteExtrasAndExtensions(json, accessor);
+
+        if (accessor.sparse.isSparse)
+        {
+            json.Key("sparse");
+            json.BeginObject();
+            json.Key("count");
+            json.Integer(accessor.sparse.count);
+
+            json.Key("indices");
+            json.BeginObject();
+            json.Key("bufferView");
+            json.Integer(accessor.sparse.indices.bufferView);
+            json.Key("byteOffset");
+            json.Integer(accessor.sparse.indices.byteOffset);
+            json.Key("componentType");
+            json.Integer(accessor.sparse.indices.componentType);
+            WriteExtrasAndExtensions(json, accessor.sparse.indices);
+            json.EndObject();
+
+            json.Key("values");
+            json.BeginObject();
+            json.Key("bufferView");
+            json.Integer(accessor.sparse.values.bufferView);
+            json.Key("byteOffset");
+            json.Integer(accessor.sparse.values.byteOffset);
+            WriteExtrasAndExtensions(json, accessor.sparse.values);
+            json.EndObject();
+
+            WriteExtrasAndExtensions(json, accessor.sparse);
+            json.EndObject();
+        }
+        json.EndObject();
+    }
+
+    void WriteAnimation(JsonWriter& json, const tinygltf::Animation& animation)
+    {
+        json.BeginObject();
+        WriteName(json, animation.name);
+
+        json.Key("channels");
+        json.BeginArray();
+        for (const auto& channel : animation.channels)
+        {
+            json.BeginObject();
+            json.Key("sampler");
+            json.Integer(channel.sampler);
+            json.Key("target");
+            json.BeginObject();
+            if (channel.target_node >= 0)
+            {
+                json.Key("node");
+                json.Integer(channel.target_node);
+            }
+            json.Key("path");
+            json.String(channel.target_path);
+            WriteExtensionMap(json, channel.target_extensions);
+            WriteExtras(json, channel.target_extras);
+            json.EndObject();
+            WriteExtrasAndExtensions(json, channel);
+            json.EndObject();
+        }
+        json.EndArray();
+
+        json.Key("samplers");
+        json.BeginArray();
+        for (const auto& sampler : animation.samplers)
+        {
+            json.BeginObject();
+            json.Key("input");
+            json.Integer(sampler.input);
+            json.Key("output");
+            json.Integer(sampler.output);
+            json.Key("interpolation");
+            json.String(sampler.interpolation);
+            WriteExtrasAndExtensions(json, sampler);
+            json.EndObject();
+        }
+        json.EndArray();
+
+        WriteExtrasAndExtensions(json, animation);
+        json.EndObject();
+    }
+
+    void WriteAsset(JsonWriter& json, const tinygltf::Asset& asset)
+    {
+        json.BeginObject();
+        if (!asset.generator.empty())
+        {
+            json.Key("generator");
+            json.String(asset.generator);
+        }
+        if (!asset.copyright.empty())
+        {
+            json.Key("copyright");
+            json.String(asset.copyright);
+        }
+        json.Key("version");
+        json.String(asset.version.empty() ? "2.0" : asset.version);
+        WriteExtrasAndExtensions(json, asset);
+        json.EndObject();
+    }
+
+    void WriteBuffer(JsonWriter& json, const tinygltf::Buffer& buffer, const std::string& uri, size_t byteLength)
+    {
+        json.BeginObject();
+        json.Key("byteLength");
+        json.Integer(byteLength);
+        if (!uri.empty())
+        {
+            json.Key("uri");
+            json.String(uri);
+        }
+        WriteName(json, buffer.name);
+        WriteExtrasAndExtensions(json, buffer);
+        json.EndObject();
+    }
+
+    void WriteBufferView(JsonWriter& json, const tinygltf::BufferView& bufferView)
+    {
+        json.BeginObject();
+        json.Key("buffer");
+        json.Integer(bufferView.buffer);
+        json.Key("byteLength");
+        json.Integer(bufferView.byteLength);
+        if (bufferView.byteStride >= 4)
+        {
+            json.Key("byteStride");
+            json.Integer(bufferView.byteStride);
+        }
+        if (bufferView.byteOffset > 0)
+        {
+            json.Key("byteOffset");
+            json.Integer(bufferView.byteOffset);
+        }
+        if (bufferView.target == TINYGLTF_TARGET_ARRAY_BUFFER || bufferView.target == TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER)
+        {
+            json.Key("target");
+            json.Integer(bufferView.target);
+        }
+        WriteName(json, bufferView.name);
+        WriteExtrasAndExtensions(json, bufferView);
+        json.EndObject();
+    }
+
+    void WriteCamera(JsonWriter& json, const tinygltf::Camera& camera)
+    {
+        json.BeginObject();
+        json.Key("type");
+        json.String(camera.type);
+        WriteName(json, camera.name);
+        if (camera.type == "orthographic")
+        {
+            json.Key("orthographic");
+            json.BeginObject();
+            json.Key("zfar");
+            json.Number(camera.orthographic.zfar);
+            json.Key("znear");
+            json.Number(camera.orthographic.znear);
+            json.Key("xmag");
+            json.Number(camera.orthographic.xmag);
+            json.Key("ymag");
+            json.Number(camera.orthographic.ymag);
+            WriteExtrasAndExtensions(json, camera.orthographic);
+            json.EndObject();
+        }
+        else if (camera.type == "perspective")
+        {
+            json.Key("perspective");
+            json.BeginObject();
+            json.Key("zfar");
+            json.Number(camera.perspective.zfar);
+            json.Key("znear");
+            json.Number(camera.perspective.znear);
+            if (camera.perspective.aspectRatio > 0)
+            {
+                json.Key("aspectRatio");
+                json.Number(camera.perspective.aspectRatio);
+            }
+            if (camera.perspective.yfov > 0)
+            {
+                json.Key("yfov");
+                json.Number(camera.perspective.yfov);
+            }
+            WriteExtrasAndExtensions(json, camera.perspective);
+            json.EndObject();
+        }
+        WriteExtrasAndExtensions(json, camera);
+        json.EndObject();
+    }
+
+    void WriteImage(JsonWriter& json, const tinygltf::Image& image)
+    {
+        json.BeginObject();
+        // without a uri the image lives in a bufferView
+        if (image.uri.empty())
+        {
+            json.Key("mimeType");
+            json.String(image.mimeType);
+            json.Key("bufferView");
+            json.Integer(image.bufferView);
+        }
+        else
+        {
+            json.Key("uri");
+            json.String(image.uri);
+        }
+        WriteName(json, image.name);
+        WriteExtrasAndExtensions(json, image);
+        json.EndObject();
+    }
+
+    template <typename TextureInfo>
+    void WriteTextureInfoStart(JsonWriter& json, const char* key, const TextureInfo& info)
+    {
+        json.Key(key);
+        json.BeginObject();
+        json.Key("index");
+        json.Integer(info.index);
+        if (info.texCoord != 0)
+        {
+            json.Key("texCoord");
+            json.Integer(info.texCoord);
+        }
+    }
+
+    template <typename TextureInfo>
+    void WriteTextureInfoEnd(JsonWriter& json, const TextureInfo& info)
+    {
+        WriteExtrasAndExtensions(json, info);
+        json.EndObject();
+    }
+
+    bool IsDefault(const tinygltf::PbrMetallicRoughness& pbr)
+    {
+        return pbr.baseColorFactor == std::vector<double>{ 1.0, 1.0, 1.0, 1.0 }
+            && DoubleEqual(pbr.metallicFactor, 1.0)
+            && DoubleEqual(pbr.roughnessFactor, 1.0)
+            && pbr.baseColorTexture.index <= -1
+            && pbr.metallicRoughnessTexture.index <= -1
+            && pbr.extensions.empty()
+            && !HasJson(pbr.extras);
+    }
+
+    void WriteMaterial(JsonWriter& json, const tinygltf::Material& material)
+    {
+        json.BeginObject();
+        WriteName(json, material.name);
+        if (!DoubleEqual(material.alphaCutoff, 0.5))
+        {
+            json.Key("alphaCutoff");
+            json.Number(material.alphaCutoff);
+        }
+        if (material.alphaMode != "OPAQUE")
+        {
+            json.Key("alphaMode");
+            json.String(material.alphaMode);
+        }
+        if (material.doubleSided)
+        {
+            json.Key("doubleSided");
+            json.Bool(true);
+        }
+        if (material.normalTexture.index > -1)
+        {
+            WriteTextureInfoStart(json, "normalTexture", material.normalTexture);
+            if (!DoubleEqual(material.normalTexture.scale, 1.0))
+            {
+                json.Key("scale");
+                json.Number(material.normalTexture.scale);
+            }
+            WriteTextureInfoEnd(json, material.normalTexture);
+        }
+        if (material.occlusionTexture.index > -1)
+        {
+            WriteTextureInfoStart(json, "occlusionTexture", material.occlusionTexture);
+            if (!DoubleEqual(material.occlusionTexture.strength, 1.0))
+            {
+                json.Key("strength");
+                json.Number(material.occlusionTexture.strength);
+            }
+            WriteTextureInfoEnd(json, material.occlusionTexture);
+        }
+        if (material.emissiveTexture.index > -1)
+        {
+            WriteTextureInfoStart(json, "emissiveTexture", material.emissiveTexture);
+            WriteTextureInfoEnd(json, material.emissiveTexture);
+        }
+        if (material.emissiveFactor != std::vector<double>{ 0.0, 0.0, 0.0 })
+        {
+            WriteNumberArray(json, "emissiveFactor", material.emissiveFactor);
+        }
+
+        // left out completely when everything in it is default
+        const tinygltf::PbrMetallicRoughness& pbr = material.pbrMetallicRoughness;
+        if (!IsDefault(pbr))
+        {
+            json.Key("pbrMetallicRoughness");
+            json.BeginObject();
+            if (pbr.baseColorFactor != std::vector<double>{ 1.0, 1.0, 1.0, 1.0 })
+            {
+                WriteNumberArray(json, "baseColorFactor", pbr.baseColorFactor);
+            }
+            if (!DoubleEqual(pbr.metallicFactor, 1.0))
+            {
+                json.Key("metallicFactor");
+                json.Number(pbr.metallicFactor);
+            }
+            if (!DoubleEqual(pbr.roughnessFactor, 1.0))
+            {
+                json.Key("roughnessFactor");
+                json.Number(pbr.roughnessFactor);
+            }
+            if (pbr.baseColorTexture.index > -1)
+            {
+                WriteTextureInfoStart(json, "baseColorTexture", pbr.baseColorTexture);
+                WriteTextureInfoEnd(json, pbr.baseColorTexture);
+            }
+            if (pbr.metallicRoughnessTexture.index > -1)
+            {
+                WriteTextureInfoStart(json, "metallicRoughnessTexture", pbr.metallicRoughnessTexture);
+                WriteTextureInfoEnd(json, pbr.metallicRoughnessTexture);
+            }
+            WriteExtrasAndExtensions(json, pbr);
+            json.EndObject();
+        }
+
+        WriteExtrasAndExtensions(json, material);
+        json.EndObject();
+    }
+
+    void WriteAttributes(JsonWriter& json, const std::map<std::string, int>& attributes)
+    {
+        json.BeginObject();
+        for (const auto& attribute : attributes)
+        {
+            json.Key(attribute.first);
+            json.Integer(attribute.second);
+        }
+        json.EndObject();
+    }
+
+    void WriteMesh(JsonWriter& json, const tinygltf::Mesh& mesh)
+    {
+        json.BeginObject();
+        json.Key("primitives");
+        json.BeginArray();
+        for (const auto& primitive : mesh.primitives)
+        {
+            json.BeginObject();
+            json.Key("attributes");
+            WriteAttributes(json, primitive.attributes);
+            if (primitive.indices > -1)
+            {
+                json.Key("indices");
+                json.Integer(primitive.indices);
+            }
+            if (primitive.material > -1)
+            {
+                json.Key("material");
+                json.Integer(primitive.material);
+            }
+            json.Key("mode");
+            json.Integer(primitive.mode);
+            if (!primitive.targets.empty())
+            {
+                json.Key("targets");
+                json.BeginArray();
+                for (const auto& target : primitive.targets)
+                {
+                    WriteAttributes(json, target);
+                }
+                json.EndArray();
+            }
+            WriteExtrasAndExtensions(json, primitive);
+            json.EndObject();
+        }
+        json.EndArray();
+
+        WriteNumberArray(json, "weights", mesh.weights);
+        WriteName(json, mesh.name);
+        WriteExtrasAndExtensions(json, mesh);
+        json.EndObject();
+    }
+
+    void WriteNode(JsonWriter& json, const tinygltf::Node& node)
+    {
+        json.BeginObject();
+        WriteNumberArray(json, "translation", node.translation);
+        WriteNumberArray(json, "rotation", node.rotation);
+        WriteNumberArray(json, "scale", node.scale);
+        WriteNumberArray(json, "matrix", node.matrix);
+        if (node.mesh != -1)
+        {
+            json.Key("mesh");
+            json.Integer(node.mesh);
+        }
+        if (node.skin != -1)
+        {
+            json.Key("skin");
+            json.Integer(node.skin);
+        }
+        if (node.camera != -1)
+        {
+            json.Key("camera");
+            json.Integer(node.camera);
+        }
+        WriteNumberArray(json, "weights", node.weights);
+        WriteExtrasAndExtensions(json, node);
+        WriteName(json, node.name);
+        WriteIntegerArray(json, "children", node.children);
+        json.EndObject();
+    }
+
+    void WriteSampler(JsonWriter& json, const tinygltf::Sampler& sampler)
+    {
+        json.BeginObject();
+        WriteName(json, sampler.name);
+        if (sampler.magFilter != -1)
+        {
+            json.Key("magFilter");
+            json.Integer(sampler.magFilter);
+        }
+        if (sampler.minFilter != -1)
+        {
+            json.Key("minFilter");
+            json.Integer(sampler.minFilter);
+        }
+        json.Key("wrapS");
+        json.Integer(sampler.wrapS);
+        json.Key("wrapT");
+        json.Integer(sampler.wrapT);
+        WriteExtrasAndExtensions(json, sampler);
+        json.EndObject();
+    }
+
+    void WriteScene(JsonWriter& json, const tinygltf::Scene& scene)
+    {
+        json.BeginObject();
+        WriteIntegerArray(json, "nodes", scene.nodes);
+        WriteName(json, scene.name);
+        WriteExtrasAndExtensions(json, scene);
+        json.EndObject();
+    }
+
+    void WriteSkin(JsonWriter& json, const tinygltf::Skin& skin)
+    {
+        json.BeginObject();
+        WriteIntegerArray(json, "joints", skin.joints);
+        if (skin.inverseBindMatrices >= 0)
+        {
+            json.Key("inverseBindMatrices");
+            json.Integer(skin.inverseBindMatrices);
+        }
+        if (skin.skeleton >= 0)
+        {
+            json.Key("skeleton");
+            json.Integer(skin.skeleton);
+        }
+        WriteName(json, skin.name);
+        WriteExtrasAndExtensions(json, skin);
+        json.EndObject();
+    }
+
+    void WriteTexture(JsonWriter& json, const tinygltf::Texture& texture)
+    {
+        json.BeginObject();
+        if (texture.sampler > -1)
+        {
+            json.Key("sampler");
+            json.Integer(texture.sampler);
+        }
+        if (texture.source > -1)
+        {
+            json.Key("source");
+            json.Integer(texture.source);
+        }
+        WriteName(json, texture.name);
+        WriteExtrasAndExtensions(json, texture);
+        json.EndObject();
+    }
+
+    void WriteStrings(JsonWriter& json, const char* key, const std::vector<std::string>& values)
+    {
+        if (values.empty())
+        {
+            return;
+        }
+        json.Key(key);
+        json.BeginArray();
+        for (const auto& value : values)
+        {
+            json.String(value);
+        }
+        json.EndArray();
+    }
+
+    template <typename T, typename WriteFunc>
+    void WriteList(JsonWriter& json, const char* key, const std::vector<T>& list, WriteFunc write)
+    {
+        if (list.empty())
+        {
+            return;
+        }
+        json.Key(key);
+        json.BeginArray();
+        for (const T& item : list)
+        {
+            write(json, item);
+        }
+        json.EndArray();
+    }
+
+    void WriteModel(JsonWriter& json, const tinygltf::Model& model, const std::vector<std::string>& bufferUris,
+        const std::vector<size_t>& bufferSizes)
+    {
+        json.BeginObject();
+        WriteList(json, "accessors", model.accessors, WriteAccessor);
+        if (!model.animations.empty())
+        {
+            // animations without channels are dropped
+            json.Key("animations");
+            json.BeginArray();
+            for (const auto& animation : model.animations)
+            {
+                if (!animation.channels.empty())
+                {
+                    WriteAnimation(json, animation);
+                }
+            }
+            json.EndArray();
+        }
+
+        json.Key("asset");
+        WriteAsset(json, model.asset);
+
+        if (!model.buffers.empty())
+        {
+            json.Key("buffers");
+            json.BeginArray();
+            for (size_t i = 0; i < model.buffers.size(); i++)
+            {
+                WriteBuffer(json, model.buffers[i], i < bufferUris.size() ? bufferUris[i] : std::string(),
+                    i < bufferSizes.size() ? bufferSizes[i] : model.buffers[i].data.size());
+            }
+            json.EndArray();
+        }
+        WriteList(json, "bufferViews", model.bufferViews, WriteBufferView);
+        WriteList(json, "cameras", model.cameras, WriteCamera);
+        WriteStrings(json, "extensionsRequired", model.extensionsRequired);
+        WriteStrings(json, "extensionsUsed", model.extensionsUsed);
+        WriteList(json, "images", model.images, WriteImage);
+        WriteList(json, "materials", model.materials, WriteMaterial);
+        WriteList(json, "meshes", model.meshes, WriteMesh);
+        WriteList(json, "nodes", model.nodes, WriteNode);
+        WriteList(json, "samplers", model.samplers, WriteSampler);
+        if (model.defaultScene > -1)
+        {
+            json.Key("scene");
+            json.Integer(model.defaultScene);
+        }
+        WriteList(json, "scenes", model.scenes, WriteScene);
+        WriteList(json, "skins", model.skins, WriteSkin);
+        WriteList(json, "textures", model.textures, WriteTexture);
+        WriteExtrasAndExtensions(json, model);
+        json.EndObject();
+    }
+
+    std::string Directory(const std::string& filepath)
+    {
+        size_t lastSlash = filepath.find_last_of("/\\");
+        return lastSlash != std::string::npos ? filepath.substr(0, lastSlash + 1) : std::string();
+    }
+
+    std::string Stem(const std::string& filepath)
+    {
+        size_t lastSlash = filepath.find_last_of("/\\");
+        std::string filename = lastSlash != std::string::npos ? filepath.substr(lastSlash + 1) : filepath;
+        size_t lastDot = filename.find_last_of('.');
+        return lastDot != std::string::npos ? filename.substr(0, lastDot) : filename;
+    }
+
+    bool IsDataUri(const std::string& uri)
+    {
+        return uri.compare(0, 5, "data:") == 0;
+    }
+
+    void WriteTile(JsonWriter& json, const std::vector<TilesetTile>& tiles, int index)
+    {
+        const TilesetTile& tile = tiles[index];
+        json.BeginObject();
+        json.Key("boundingVolume");
+        json.BeginObject();
+        json.Key("box");
+        json.BeginArray();
+        for (double value : tile.box)
+        {
+            json.Number(value);
+        }
+        json.EndArray();
+        json.EndObject();
+        json.Key("geometricError");
+        json.Number(tile.geometricError);
+        if (index == 0)
+        {
+            json.Key("refine");
+            json.String("REPLACE");
+        }
+        if (!tile.uri.empty())
+        {
+            json.Key("content");
+            json.BeginObject();
+            json.Key("uri");
+            json.String(tile.uri);
+            json.EndObject();
+        }
+        if (!tile.children.empty())
+        {
+            json.Key("children");
+            json.BeginArray();
+            for (int child : tile.children)
+            {
+                WriteTile(json, tiles, child);
+            }
+            json.EndArray();
+        }
+        json.EndObject();
+    }
+
+    void AppendUint32(std::string& out, uint32_t value)
+    {
+        // glb is little endian, like every platform blender runs on
+        char bytes[4];
+        std::memcpy(bytes, &value, sizeof(value));
+        out.append(bytes, sizeof(bytes));
+    }
+}
+
+void WriteGltfJson(const tinygltf::Model& model, std::ostream& out, bool compact, const std::vector<std::string>& bufferUris,
+    const std::vector<size_t>& bufferSizes)
+{
+    std::string buffer;
+    buffer.reserve(128 * 1024);
+    JsonWriter json(buffer, &out, compact);
+    WriteModel(json, model, bufferUris, bufferSizes);
+    json.Flush();
+}
+
+void WriteGltfJson(const tinygltf::Model& model, std::string& out, bool compact, const std::vector<std::string>& bufferUris,
+    const std::vector<size_t>& bufferSizes)
+{
+    JsonWriter json(out, nullptr, compact);
+    WriteModel(json, model, bufferUris, bufferSizes);
+}
+
+bool BuildGlbPrefix(const tinygltf::Model& model, bool compact, const std::vector<std::string>& bufferUris, size_t binSize,
+    std::string& prefix)
+{
+    bool hasBin = !model.buffers.empty();
+    std::vector<size_t> bufferSizes;
+    if (hasBin)
+    {
+        bufferSizes.push_back(binSize);
+    }
+
+    std::string json;
+    WriteGltfJson(model, json, compact, bufferUris, bufferSizes);
+    json.append((4 - json.size() % 4) % 4, ' ');
+
+    size_t binPadding = GlbPadding(binSize);
+    size_t totalSize = 12 + 8 + json.size() + (hasBin ? 8 + binSize + binPadding : 0);
+    if (totalSize > std::numeric_limits<uint32_t>::max())
+    {
+        std::cerr << "GLB would be bigger than 4GB" << std::endl;
+        return false;
+    }
+
+    prefix.clear();
+    prefix.reserve(28 + json.size());
+    AppendUint32(prefix, 0x46546C67); // "glTF"
+    AppendUint32(prefix, 2);
+    AppendUint32(prefix, static_cast<uint32_t>(totalSize));
+    AppendUint32(prefix, static_cast<uint32_t>(json.size()));
+    AppendUint32(prefix, 0x4E4F534A); // "JSON"
+    prefix += json;
+    if (hasBin)
+    {
+        AppendUint32(prefix, static_cast<uint32_t>(binSize + binPadding));
+        AppendUint32(prefix, 0x004E4942); // "BIN\0"
+    }
+    return true;
+}
+
+std::vector<std::string> BufferFileUris(const tinygltf::Model& model, const std::string& filepath, bool binary)
+{
+    std::string stem = Stem(filepath);
+    std::vector<std::string> bufferUris(model.buffers.size());
+    for (size_t i = 0; i < model.buffers.size(); i++)
+    {
+        if (binary && i == 0)
+        {
+            continue;
+        }
+        const std::string& uri = model.buffers[i].uri;
+        bufferUris[i] = !uri.empty() && !IsDataUri(uri) ? uri : stem + (i == 0 ? std::string() : "_" + std::to_string(i)) + ".bin";
+    }
+    return bufferUris;
+}
+
+bool WriteGlb(const tinygltf::Model& model, bool compact, std::vector<unsigned char>& out)
+{
+    const std::vector<unsigned char>* bin = model.buffers.empty() ? nullptr : &model.buffers[0].data;
+    std::string prefix;
+    if (!BuildGlbPrefix(model, compact, BufferFileUris(model, "model.glb", true), bin ? bin->size() : 0, prefix))
+    {
+        return false;
+    }
+    size_t binPadding = GlbPadding(bin ? bin->size() : 0);
+    out.clear();
+    out.reserve(prefix.size() + (bin ? bin->size() + binPadding : 0));
+    out.insert(out.end(), prefix.begin(), prefix.end());
+    if (bin)
+    {
+        out.insert(out.end(), bin->begin(), bin->end());
+        out.insert(out.end(), binPadding, 0);
+    }
+    return true;
+}
+
+bool WriteGltfFile(const tinygltf::Model& model, const std::string& filepath, const GltfWriteOptions& options,
+    std::vector<std::string>& writtenFiles, AsyncFileWriter* fileWriter)
+{
+    std::string directory = Directory(filepath);
+
+    // every buffer gets a .bin next to the gltf, except the first one of a glb which goes into its BIN chunk
+    std::vector<std::string> bufferUris = BufferFileUris(model, filepath, options.binary);
+    for (size_t i = 0; i < model.buffers.size(); i++)
+    {
+        if (bufferUris[i].empty())
+        {
+            continue;
+        }
+
+        std::string binPath = directory + bufferUris[i];
+        if (fileWriter)
+        {
+            // written while we are busy with the json
+            writtenFiles.push_back(binPath);
+            fileWriter->Write(binPath, { { model.buffers[i].data.data(), model.buffers[i].data.size() } });
+            continue;
+        }
+
+        std::ofstream binFile(binPath, std::ios::binary);
+        if (!binFile)
+        {
+            std::cerr << "Can't write buffer file: " << binPath << std::endl;
+            return false;
+        }
+        writtenFiles.push_back(binPath);
+        binFile.write(reinterpret_cast<const char*>(model.buffers[i].data.data()), static_cast<std::streamsize>(model.buffers[i].data.size()));
+        if (!binFile.good())
+        {
+            std::cerr << "Failed writing buffer file: " << binPath << std::endl;
+            return false;
+        }
+    }
+
+    if (!options.binary)
+    {
+        std::ofstream file(filepath, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Can't write file: " << filepath << std::endl;
+            return false;
+        }
+        writtenFiles.push_back(filepath);
+        WriteGltfJson(model, file, options.compact, bufferUris);
+        return file.good();
+    }
+
+    // GLB: header, JSON chunk padded with spaces, BIN chunk padded with zeros
+    auto prefixOwner = std::make_shared<std::string>();
+    std::string& prefix = *prefixOwner;
+    size_t binSize = model.buffers.empty() ? 0 : model.buffers[0].data.size();
+    if (!BuildGlbPrefix(model, options.compact, bufferUris, binSize, prefix))
+    {
+        return false;
+    }
+    size_t binPadding = GlbPadding(binSize);
+
+    static const char zeros[4] = {};
+    writtenFiles.push_back(filepath);
+    if (fileWriter)
+    {
+        std::vector<AsyncFileWriter::Segment> segments = { { prefix.data(), prefix.size() } };
+        if (!model.buffers.empty())
+        {
+            segments.push_back({ model.buffers[0].data.data(), model.buffers[0].data.size() });
+            segments.push_back({ zeros, binPadding });
+        }
+        fileWriter->Write(filepath, std::move(segments), prefixOwner);
+        return true;
+    }
+
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Can't write file: " << filepath << std::endl;
+        return false;
+    }
+    file.write(prefix.data(), static_cast<std::streamsize>(prefix.size()));
+    if (!model.buffers.empty())
+    {
+        const std::vector<unsigned char>& bin = model.buffers[0].data;
+        file.write(reinterpret_cast<const char*>(bin.data()), static_cast<std::streamsize>(bin.size()));
+        file.write(zeros, static_cast<std::streamsize>(binPadding));
+    }
+    return file.good();
+}
+
+bool WriteMappedGltfFile(const tinygltf::Model& model, const std::string& filepath, const GltfWriteOptions& options, size_t binSize,
+    const std::function<void(unsigned char*)>& fillBuffer, std::vector<std::string>& writtenFiles)
+{
+    if (model.buffers.size() != 1 || binSize == 0)
+    {
+        std::cerr << "Mapped output needs exactly one non-empty buffer" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> bufferUris = BufferFileUris(model, filepath, options.binary);
+    MappedFile mapped;
+    if (options.binary)
+    {
+        std::string prefix;
+        if (!BuildGlbPrefix(model, options.compact, bufferUris, binSize, prefix))
+        {
+            return false;
+        }
+
+        // the padding after the BIN chunk is already zero
+        writtenFiles.push_back(filepath);
+        if (!mapped.Open(filepath, prefix.size() + binSize + GlbPadding(binSize)))
+        {
+            return false;
+        }
+        std::memcpy(mapped.Data(), prefix.data(), prefix.size());
+        fillBuffer(mapped.Data() + prefix.size());
+        return mapped.Close();
+    }
+
+    std::string binPath = Directory(filepath) + bufferUris[0];
+    writtenFiles.push_back(binPath);
+    if (!mapped.Open(binPath, binSize))
+    {
+        return false;
+    }
+    fillBuffer(mapped.Data());
+    if (!mapped.Close())
+    {
+        return false;
+    }
+
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Can't write file: " << filepath << std::endl;
+        return false;
+    }
+    writtenFiles.push_back(filepath);
+    WriteGltfJson(model, file, options.compact, bufferUris, { binSize });
+    return file.good();
+}
+
+bool WriteTilesetFile(const std::vector<TilesetTile>& tiles, double geometricError, const std::string& path, bool compact)
+{
+    if (tiles.empty())
+    {
+        std::cerr << "No tiles to write" << std::endl;
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Can't write file: " << path << std::endl;
+        return false;
+    }
+
+    std::string buffer;
+    JsonWriter json(buffer, &file, compact);
+    json.BeginObject();
+    json.Key("asset");
+    json.BeginObject();
+    json.Key("version");
+    json.String("1.1");
+    json.EndObject();
+    json.Key("geometricError");
+    json.Number(geometricError);
+    json.Key("root");
+    WriteTile(json, tiles, 0);
+    json.EndObject();
+    json.Flush();
+    return file.good();
+}
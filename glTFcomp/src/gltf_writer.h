@@ -0,0 +1,75 @@
+#pragma once
+
+//stl
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class AsyncFileWriter;
+
+// only declared here, tiny_gltf.h may be included once with its implementation per file
+namespace tinygltf
+{
+    class Model;
+}
+
+// Writes a tinygltf::Model as glTF json straight into a stream, without building a json document first.
+// It writes the same properties as tinygltf's serializer (lights and audio are left out, we never make them),
+// but buffers are never base64 encoded: they go to .bin files next to a .gltf, or into the BIN chunk of a .glb.
+struct GltfWriteOptions
+{
+    bool binary = false; // .glb instead of .gltf + .bin
+    bool compact = true; // no indentation or newlines
+};
+
+// bufferUris[i] is written as the uri of buffer i, an empty one is left out (buffer 0 of a .glb).
+// bufferSizes[i] replaces the byteLength of a buffer whose data isn't in the model (mapped output)
+void WriteGltfJson(const tinygltf::Model& model, std::ostream& out, bool compact, const std::vector<std::string>& bufferUris,
+    const std::vector<size_t>& bufferSizes = {});
+void WriteGltfJson(const tinygltf::Model& model, std::string& out, bool compact, const std::vector<std::string>& bufferUris,
+    const std::vector<size_t>& bufferSizes = {});
+
+// Zeros after the BIN chunk's data to keep the glb 4-byte aligned
+inline size_t GlbPadding(size_t binSize)
+{
+    return (4 - binSize % 4) % 4;
+}
+
+// Everything of a .glb in front of the BIN chunk's data: header, padded JSON chunk and the BIN chunk header.
+// binSize is the byteLength of buffer 0, its data doesn't have to be in the model yet
+bool BuildGlbPrefix(const tinygltf::Model& model, bool compact, const std::vector<std::string>& bufferUris, size_t binSize,
+    std::string& prefix);
+
+// Uris of the .bin files WriteGltfFile writes next to filepath: <name>.bin, <name>_1.bin, ...
+// Empty for the buffer that goes into the BIN chunk of a glb
+std::vector<std::string> BufferFileUris(const tinygltf::Model& model, const std::string& filepath, bool binary);
+
+// The whole .glb in memory, buffer 0 is copied into the BIN chunk
+bool WriteGlb(const tinygltf::Model& model, bool compact, std::vector<unsigned char>& out);
+
+// Writes the .gltf with its .bin files or the .glb. The files it created are added to writtenFiles,
+// also when it fails halfway, so the caller can clean them up.
+// With a fileWriter the .bin files and the .glb are only queued: the model's buffers have to stay
+// untouched until fileWriter->Finish(), which also tells whether they were written.
+bool WriteGltfFile(const tinygltf::Model& model, const std::string& filepath, const GltfWriteOptions& options,
+    std::vector<std::string>& writtenFiles, AsyncFileWriter* fileWriter = nullptr);
+
+// Like WriteGltfFile for a model with a single buffer whose data isn't in the model: the .bin (or the .glb) is
+// created at its final size and mapped, and fillBuffer copies buffer 0's binSize bytes straight into the mapping.
+// The json is written with binSize as the buffer's byteLength. The mapping starts out zeroed, so gaps can be skipped
+bool WriteMappedGltfFile(const tinygltf::Model& model, const std::string& filepath, const GltfWriteOptions& options, size_t binSize,
+    const std::function<void(unsigned char*)>& fillBuffer, std::vector<std::string>& writtenFiles);
+
+// Tile of a tileset.json (3D Tiles 1.1, the content is a glb). box is center and three half axes, in the
+// tileset's z-up frame: the viewer turns the y-up glb content to z-up itself
+struct TilesetTile
+{
+    double box[12] = {};
+    double geometricError = 0.0;
+    std::string uri; // empty for a tile without content
+    std::vector<int> children;
+};
+
+// Writes tiles[0] as the root with its children below it, refine REPLACE: a child replaces its parent's content
+bool WriteTilesetFile(const std::vector<TilesetTile>& tiles, double geometricError, const std::string& path, bool compact);
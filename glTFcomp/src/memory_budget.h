@@ -0,0 +1,98 @@
+#pragma once
+
+#include "export_progress.h"
+
+//stl
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Caps the estimated bytes that export stages keep alive at the same time.
+// Stages acquire their estimate before they are submitted and give it back as soon as their
+// output is written, so the submitter (python adding objects) is what waits, never a worker.
+class MemoryBudget
+{
+public:
+    // 0 = no limit
+    void SetLimit(size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            limit = bytes;
+        }
+        released.notify_all();
+    }
+
+    // Blocks until the bytes fit. Something bigger than the whole budget is let through
+    // once nothing else is in flight, otherwise it would wait forever.
+    void Acquire(size_t bytes, const ExportProgress* progress = nullptr)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (limit != 0 && used != 0 && used + bytes > limit)
+        {
+            // cancelling doesn't wake us up, so look at it every now and then
+            released.wait_for(lock, std::chrono::milliseconds(50));
+            if (progress)
+            {
+                progress->ThrowIfCancelled();
+            }
+        }
+        used += bytes;
+        peak = std::max(peak, used);
+    }
+
+    void Release(size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used -= std::min(bytes, used);
+        }
+        released.notify_all();
+    }
+
+    void ResetPeak() { std::lock_guard<std::mutex> lock(mutex); peak = used; }
+
+    size_t Limit() const { std::lock_guard<std::mutex> lock(mutex); return limit; }
+    size_t Used() const { std::lock_guard<std::mutex> lock(mutex); return used; }
+    size_t Peak() const { std::lock_guard<std::mutex> lock(mutex); return peak; }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable released;
+    size_t limit = 0;
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+// Bytes acquired for one stage. Shared by the tasks of that stage: whatever is left gets released
+// when the last task lets go of it, which the scheduler also does for tasks it skipped after a failure.
+class MemoryLease
+{
+public:
+    MemoryLease(MemoryBudget& memoryBudget, size_t bytes, const ExportProgress* progress = nullptr)
+        : budget(memoryBudget)
+    {
+        budget.Acquire(bytes, progress);
+        remaining = bytes;
+    }
+    ~MemoryLease() { Release(); }
+
+    MemoryLease(const MemoryLease&) = delete;
+    MemoryLease& operator=(const MemoryLease&) = delete;
+
+    // Give back part of the lease once the buffers it was for are freed
+    void Release(size_t bytes = SIZE_MAX)
+    {
+        bytes = std::min(bytes, remaining);
+        remaining -= bytes;
+        budget.Release(bytes);
+    }
+
+private:
+    MemoryBudget& budget;
+    size_t remaining = 0;
+};
@@ -0,0 +1,245 @@
+#include "mesh_chunker.h"
+
+//stl
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+namespace
+{
+    // most buckets a mesh is split into, every bucket keeps a file open while the triangles come in
+    constexpr size_t maxBuckets = 256;
+    // memory all buckets together collect before writing to their files
+    constexpr size_t pendingBytes = 16 * 1024 * 1024;
+
+    // Corner records are looked up by their index in the chunk, so the map doesn't need copies of them
+    struct RecordHash
+    {
+        const unsigned char* records;
+        size_t recordSize;
+        size_t operator()(uint32_t corner) const
+        {
+            // FNV-1a over the bytes, a record is only floats so there is no padding in there
+            const unsigned char* bytes = records + corner * recordSize;
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < recordSize; i++)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    struct RecordEqual
+    {
+        const unsigned char* records;
+        size_t recordSize;
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            return std::memcmp(records + a * recordSize, records + b * recordSize, recordSize) == 0;
+        }
+    };
+
+    bool Seek(std::FILE* file, size_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+}
+
+MeshChunker::MeshChunker(std::string dir, size_t triangles, size_t extras)
+    : directory(std::move(dir)), chunkTriangles(std::max<size_t>(triangles, 1)), extraFloats(extras),
+    recordSize(sizeof(Vertex) + extras * sizeof(float))
+{
+}
+
+MeshChunker::~MeshChunker()
+{
+    for (auto& bucket : buckets)
+    {
+        if (bucket.file)
+        {
+            std::fclose(bucket.file);
+        }
+    }
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+bool MeshChunker::Begin(const float boundsMin[3], const float boundsMax[3], size_t triangleCount)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        std::cerr << "Can't make chunk directory: " << directory << std::endl;
+        return false;
+    }
+
+    // cubic cells, shrunk until there are about as many buckets as chunks. A flat mesh just gets a flat grid
+    size_t wanted = std::min(maxBuckets, std::max<size_t>(1, (triangleCount + chunkTriangles - 1) / chunkTriangles));
+    float extent[3];
+    float largest = 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        gridMin[i] = boundsMin[i];
+        extent[i] = std::max(0.0f, boundsMax[i] - boundsMin[i]);
+        largest = std::max(largest, extent[i]);
+    }
+    cellSize = largest > 0.0f ? largest : 1.0f;
+    dims[0] = dims[1] = dims[2] = 1;
+    while (static_cast<size_t>(dims[0]) * dims[1] * dims[2] < wanted)
+    {
+        float smaller = cellSize * 0.8f;
+        int next[3];
+        for (int i = 0; i < 3; i++)
+        {
+            next[i] = std::max(1, static_cast<int>(std::ceil(extent[i] / smaller)));
+        }
+        if (static_cast<size_t>(next[0]) * next[1] * next[2] > maxBuckets)
+        {
+            break;
+        }
+        cellSize = smaller;
+        std::copy(next, next + 3, dims);
+    }
+
+    size_t bucketCount = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+    buckets.resize(bucketCount);
+    for (size_t i = 0; i < bucketCount; i++)
+    {
+        buckets[i].path = (std::filesystem::path(directory) / ("bucket_" + std::to_string(i) + ".bin")).string();
+    }
+    pendingCorners = std::max<size_t>(3 * 1024, pendingBytes / bucketCount / recordSize / 3 * 3);
+    return true;
+}
+
+bool MeshChunker::AddTriangles(const Vertex* corners, const float* extras, size_t cornerCount)
+{
+    for (size_t t = 0; t + 2 < cornerCount; t += 3)
+    {
+        int cell[3];
+        for (int i = 0; i < 3; i++)
+        {
+            float centre = (corners[t].position[i] + corners[t + 1].position[i] + corners[t + 2].position[i]) / 3.0f;
+            float scaled = (centre - gridMin[i]) / cellSize;
+            // NaN ends up in the first cell too
+            cell[i] = !(scaled > 0.0f) ? 0 : scaled >= static_cast<float>(dims[i]) ? dims[i] - 1 : static_cast<int>(scaled);
+        }
+
+        Bucket& bucket = buckets[(static_cast<size_t>(cell[2]) * dims[1] + cell[1]) * dims[0] + cell[0]];
+        for (size_t c = t; c < t + 3; c++)
+        {
+            const unsigned char* vertex = reinterpret_cast<const unsigned char*>(corners + c);
+            bucket.pending.insert(bucket.pending.end(), vertex, vertex + sizeof(Vertex));
+            if (extraFloats > 0)
+            {
+                const unsigned char* extra = reinterpret_cast<const unsigned char*>(extras + c * extraFloats);
+                bucket.pending.insert(bucket.pending.end(), extra, extra + extraFloats * sizeof(float));
+            }
+        }
+        bucket.triangles++;
+        if (bucket.pending.size() >= pendingCorners * recordSize && !Flush(bucket))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MeshChunker::Flush(Bucket& bucket)
+{
+    if (bucket.pending.empty())
+    {
+        return true;
+    }
+    if (!bucket.file)
+    {
+        bucket.file = std::fopen(bucket.path.c_str(), "wb");
+        if (!bucket.file)
+        {
+            std::cerr << "Can't write chunk file: " << bucket.path << std::endl;
+            return false;
+        }
+    }
+    if (std::fwrite(bucket.pending.data(), 1, bucket.pending.size(), bucket.file) != bucket.pending.size())
+    {
+        std::cerr << "Failed writing chunk file: " << bucket.path << std::endl;
+        return false;
+    }
+    bucket.pending.clear();
+    return true;
+}
+
+bool MeshChunker::EndInput()
+{
+    bool success = true;
+    for (size_t b = 0; b < buckets.size(); b++)
+    {
+        Bucket& bucket = buckets[b];
+        success = Flush(bucket) && success;
+        std::vector<unsigned char>().swap(bucket.pending);
+        if (bucket.file)
+        {
+            success = std::fclose(bucket.file) == 0 && success;
+            bucket.file = nullptr;
+        }
+
+        // a bucket that got more than its share is read back in several pieces
+        for (size_t first = 0; first < bucket.triangles; first += chunkTriangles)
+        {
+            chunks.push_back({ b, first, std::min(chunkTriangles, bucket.triangles - first) });
+        }
+    }
+    return success;
+}
+
+bool MeshChunker::ReadChunk(size_t i, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<float>& extras) const
+{
+    const Chunk& chunk = chunks[i];
+    const std::string& path = buckets[chunk.bucket].path;
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "Can't read chunk file: " << path << std::endl;
+        return false;
+    }
+
+    size_t cornerCount = chunk.triangles * 3;
+    std::vector<unsigned char> corners(cornerCount * recordSize);
+    bool success = Seek(file, chunk.firstTriangle * 3 * recordSize) &&
+        std::fread(corners.data(), 1, corners.size(), file) == corners.size();
+    std::fclose(file);
+    if (!success)
+    {
+        std::cerr << "Failed reading chunk file: " << path << std::endl;
+        return false;
+    }
+
+    // corners of neighbouring faces come in as copies, weld them back into shared vertices
+    std::unordered_map<uint32_t, uint32_t, RecordHash, RecordEqual> welded(cornerCount / 2,
+        RecordHash{ corners.data(), recordSize }, RecordEqual{ corners.data(), recordSize });
+    vertices.clear();
+    extras.clear();
+    indices.resize(cornerCount);
+    for (size_t c = 0; c < cornerCount; c++)
+    {
+        auto inserted = welded.emplace(static_cast<uint32_t>(c), static_cast<uint32_t>(vertices.size()));
+        if (inserted.second)
+        {
+            const unsigned char* record = corners.data() + c * recordSize;
+            vertices.emplace_back();
+            std::memcpy(&vertices.back(), record, sizeof(Vertex));
+            const float* extra = reinterpret_cast<const float*>(record + sizeof(Vertex));
+            extras.insert(extras.end(), extra, extra + extraFloats);
+        }
+        indices[c] = inserted.first->second;
+    }
+    return true;
+}
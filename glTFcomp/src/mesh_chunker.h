@@ -0,0 +1,64 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Splits a mesh that is too big to expand in memory into spatial chunks on disk.
+// Triangles come in windows and go to the bucket of a grid over the mesh's bounds that holds their centre,
+// every bucket is a file in the chunk directory. Reading back hands out at most chunkTriangles triangles at a time,
+// welded, so whatever works on a chunk only needs memory for one chunk, not for the whole mesh.
+// Every corner can carry extraFloats floats next to its Vertex (see VertexExtras), they go along and count for the welding.
+// The directory and its files are removed again by the destructor.
+class MeshChunker
+{
+public:
+    MeshChunker(std::string directory, size_t chunkTriangles, size_t extraFloats = 0);
+    ~MeshChunker();
+
+    MeshChunker(const MeshChunker&) = delete;
+    MeshChunker& operator=(const MeshChunker&) = delete;
+
+    // Sets up the grid over the (gltf space) bounds, sized for about triangleCount triangles
+    bool Begin(const float boundsMin[3], const float boundsMax[3], size_t triangleCount);
+    // Adds whole triangles, three corners each. extras has extraFloats per corner, or is null without them
+    bool AddTriangles(const Vertex* corners, const float* extras, size_t cornerCount);
+    // Writes out what is still pending, closes the bucket files and cuts them into chunks
+    bool EndInput();
+
+    size_t ChunkCount() const { return chunks.size(); }
+    // Reads chunk i back with identical corners welded. Different chunks can be read at the same time
+    bool ReadChunk(size_t i, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<float>& extras) const;
+
+private:
+    struct Bucket
+    {
+        std::string path;
+        std::FILE* file = nullptr; // opened with its first flush
+        std::vector<unsigned char> pending; // whole corner records
+        size_t triangles = 0;
+    };
+
+    struct Chunk
+    {
+        size_t bucket;
+        size_t firstTriangle;
+        size_t triangles;
+    };
+
+    bool Flush(Bucket& bucket);
+
+    std::string directory;
+    size_t chunkTriangles;
+    size_t extraFloats;
+    size_t recordSize; // bytes of one corner in the files
+    size_t pendingCorners = 0; // corners a bucket collects before they go to its file
+    float gridMin[3] = {};
+    float cellSize = 1.0f;
+    int dims[3] = { 1, 1, 1 };
+    std::vector<Bucket> buckets;
+    std::vector<Chunk> chunks;
+};
@@ -0,0 +1,263 @@
+#include "mesh_cleanup.h"
+#include "task_scheduler.h"
+
+//stl
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+    // FNV-1a over the vertex and its extras, both are only floats so there is no padding in there
+    uint64_t CornerHash(const Vertex& v, const float* extra, size_t extraStride)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const void* data, size_t size) {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        add(&v, sizeof(Vertex));
+        add(extra, extraStride * sizeof(float));
+        return hash;
+    }
+
+    bool SamePosition(const Vertex& a, const Vertex& b)
+    {
+        return a.position[0] == b.position[0] && a.position[1] == b.position[1] && a.position[2] == b.position[2];
+    }
+
+    bool FinitePosition(const Vertex& v)
+    {
+        return std::isfinite(v.position[0]) && std::isfinite(v.position[1]) && std::isfinite(v.position[2]);
+    }
+
+    // Replaces what isn't finite, a bad normal is only flagged: it gets the normal of a face later on
+    size_t SanitizeVertex(Vertex& v, float* extra, size_t extraStride, bool& badNormal)
+    {
+        size_t replaced = 0;
+        badNormal = !std::isfinite(v.normal[0]) || !std::isfinite(v.normal[1]) || !std::isfinite(v.normal[2]);
+        replaced += badNormal ? 1 : 0;
+        for (float& value : v.texcoord)
+        {
+            replaced += std::isfinite(value) ? 0 : 1;
+            value = std::isfinite(value) ? value : 0.0f;
+        }
+        for (size_t i = 0; i < extraStride; i++)
+        {
+            replaced += std::isfinite(extra[i]) ? 0 : 1;
+            extra[i] = std::isfinite(extra[i]) ? extra[i] : 0.0f;
+        }
+        return replaced;
+    }
+
+    void FaceNormal(const Vertex& a, const Vertex& b, const Vertex& c, float out[3])
+    {
+        float e1[3];
+        float e2[3];
+        for (int i = 0; i < 3; i++)
+        {
+            e1[i] = b.position[i] - a.position[i];
+            e2[i] = c.position[i] - a.position[i];
+        }
+        out[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        out[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        out[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        float length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+        for (int i = 0; i < 3; i++)
+        {
+            // a sliver too thin for a direction points up, like the tiles do with cancelled normals
+            out[i] = length > 0.0f && std::isfinite(length) ? out[i] / length : (i == 1 ? 1.0f : 0.0f);
+        }
+    }
+}
+
+CleanupCounts CleanMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<float>& extras, size_t extraStride)
+{
+    CleanupCounts counts;
+    TaskScheduler& scheduler = GetScheduler();
+    size_t vertexCount = vertices.size();
+    size_t faceCount = indices.size() / 3;
+    if (extras.size() != vertexCount * extraStride)
+    {
+        extraStride = 0;
+    }
+
+    // values that aren't finite, per vertex
+    std::vector<uint8_t> badNormals(vertexCount, 0);
+    std::atomic<size_t> nonFinite{ 0 };
+    scheduler.ParallelFor(vertexCount, 16384, [&](size_t begin, size_t end)
+    {
+        size_t replaced = 0;
+        for (size_t v = begin; v < end; v++)
+        {
+            bool badNormal = false;
+            replaced += SanitizeVertex(vertices[v], extraStride > 0 ? &extras[v * extraStride] : nullptr, extraStride, badNormal);
+            badNormals[v] = badNormal ? 1 : 0;
+        }
+        nonFinite += replaced;
+    });
+    counts.nonFiniteValues = nonFinite;
+
+    // degenerate faces, and a key per face that is the same for the same corners in the same winding
+    std::vector<uint8_t> keep(faceCount, 1);
+    std::vector<std::pair<uint64_t, uint32_t>> faceKeys(faceCount); // key, face
+    std::atomic<size_t> degenerate{ 0 };
+    scheduler.ParallelFor(faceCount, 16384, [&](size_t begin, size_t end)
+    {
+        size_t dropped = 0;
+        for (size_t f = begin; f < end; f++)
+        {
+            const uint32_t* face = &indices[f * 3];
+            bool valid = face[0] < vertexCount && face[1] < vertexCount && face[2] < vertexCount;
+            valid = valid && FinitePosition(vertices[face[0]]) && FinitePosition(vertices[face[1]]) && FinitePosition(vertices[face[2]]);
+            valid = valid && !SamePosition(vertices[face[0]], vertices[face[1]]) && !SamePosition(vertices[face[1]], vertices[face[2]]) &&
+                !SamePosition(vertices[face[0]], vertices[face[2]]);
+            if (!valid)
+            {
+                keep[f] = 0;
+                dropped++;
+                continue;
+            }
+
+            // the rotation that starts at the smallest corner hash, the corners are all different so that is one
+            uint64_t hashes[3];
+            for (int c = 0; c < 3; c++)
+            {
+                hashes[c] = CornerHash(vertices[face[c]], extraStride > 0 ? &extras[face[c] * extraStride] : nullptr, extraStride);
+            }
+            int first = hashes[0] <= hashes[1] && hashes[0] <= hashes[2] ? 0 : hashes[1] <= hashes[2] ? 1 : 2;
+            uint64_t key = hashes[first];
+            key = (key ^ hashes[(first + 1) % 3]) * 1099511628211ull;
+            key = (key ^ hashes[(first + 2) % 3]) * 1099511628211ull;
+            faceKeys[f] = { key, static_cast<uint32_t>(f) };
+        }
+        degenerate += dropped;
+    });
+    counts.degenerateFaces = degenerate;
+
+    // Duplicates have the same key, sorting brings them together. The first face of the mesh stays
+    auto sameCorner = [&](uint32_t a, uint32_t b) {
+        return std::memcmp(&vertices[a], &vertices[b], sizeof(Vertex)) == 0 &&
+            (extraStride == 0 || std::memcmp(&extras[a * extraStride], &extras[b * extraStride], extraStride * sizeof(float)) == 0);
+    };
+    auto sameFace = [&](size_t a, size_t b) {
+        for (int rotation = 0; rotation < 3; rotation++)
+        {
+            bool same = true;
+            for (int c = 0; c < 3 && same; c++)
+            {
+                same = sameCorner(indices[a * 3 + c], indices[b * 3 + (c + rotation) % 3]);
+            }
+            if (same)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    std::vector<std::pair<uint64_t, uint32_t>> sorted;
+    sorted.reserve(faceCount);
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        if (keep[f])
+        {
+            sorted.push_back(faceKeys[f]);
+        }
+    }
+    std::vector<std::pair<uint64_t, uint32_t>>().swap(faceKeys);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t run = 0; run < sorted.size();)
+    {
+        size_t runEnd = run + 1;
+        while (runEnd < sorted.size() && sorted[runEnd].first == sorted[run].first)
+        {
+            runEnd++;
+        }
+        // a run is the same face a few times nearly always, a hash collision is checked all the same
+        for (size_t i = run + 1; i < runEnd; i++)
+        {
+            for (size_t j = run; j < i; j++)
+            {
+                if (keep[sorted[j].second] && sameFace(sorted[j].second, sorted[i].second))
+                {
+                    keep[sorted[i].second] = 0;
+                    counts.duplicateFaces++;
+                    break;
+                }
+            }
+        }
+        run = runEnd;
+    }
+
+    // a bad normal gets the normal of the first face it is in, one that is in none goes away below anyway
+    if (std::find(badNormals.begin(), badNormals.end(), 1) != badNormals.end())
+    {
+        for (size_t f = 0; f < faceCount; f++)
+        {
+            const uint32_t* face = &indices[f * 3];
+            if (!keep[f] || !(badNormals[face[0]] || badNormals[face[1]] || badNormals[face[2]]))
+            {
+                continue;
+            }
+            float normal[3];
+            FaceNormal(vertices[face[0]], vertices[face[1]], vertices[face[2]], normal);
+            for (int c = 0; c < 3; c++)
+            {
+                if (badNormals[face[c]])
+                {
+                    std::copy(normal, normal + 3, vertices[face[c]].normal);
+                    badNormals[face[c]] = 0;
+                }
+            }
+        }
+    }
+
+    // compact: the vertices of the faces that stay, in the order they were in
+    std::vector<uint8_t> used(vertexCount, 0);
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        for (int c = 0; keep[f] && c < 3; c++)
+        {
+            used[indices[f * 3 + c]] = 1;
+        }
+    }
+    std::vector<uint32_t> remap(vertexCount, 0);
+    uint32_t next = 0;
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (used[v])
+        {
+            remap[v] = next;
+            if (next != v)
+            {
+                vertices[next] = vertices[v];
+                std::copy_n(extras.begin() + v * extraStride, extraStride, extras.begin() + static_cast<size_t>(next) * extraStride);
+            }
+            next++;
+        }
+    }
+    counts.unusedVertices = vertexCount - next;
+    vertices.resize(next);
+    extras.resize(static_cast<size_t>(next) * extraStride);
+
+    size_t kept = 0;
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        if (keep[f])
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                indices[kept * 3 + c] = remap[indices[f * 3 + c]];
+            }
+            kept++;
+        }
+    }
+    indices.resize(kept * 3);
+    return counts;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <cstdint>
+#include <vector>
+
+// Cleanup along the lines of draco's MeshCleanup, for a mesh that is about to get tangents and go to draco or the raw path:
+// - normals, uvs and extras that are NaN or infinite are replaced: a normal by the normal of a face it is in, the rest by 0
+// - faces with an index out of range, a position that isn't finite or two corners on the same position are degenerate
+// - a face with the same corners as an earlier one, in the same winding, is a duplicate. Corners are compared on all of
+//   their data, so two faces on the same positions with different uvs both stay, like draco's point ids
+// - vertices no face uses are dropped, the rest keep their order
+// The extras (extraStride floats per vertex, see VertexExtras) go along with their vertices
+CleanupCounts CleanMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<float>& extras, size_t extraStride);
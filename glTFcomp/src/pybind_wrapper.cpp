@@ -1,11 +1,122 @@
 #include "../external/pybind11/include/pybind11/pybind11.h"
+#include "../external/pybind11/include/pybind11/stl.h"
 #include <iostream>
+#include <tuple>
 
-#include "comp_func.h"
 #include "gltf_loader.h"
+#include "gltf_optimizer.h"
+#include "batch_convert.h"
+#include "task_scheduler.h"
+#include "export_job.h"
+
+// Settings of ExportSession(...) and ExportSession.begin(...), their arguments are SessionArgs()
+static ExportSettings SessionSettings(const std::string& exportDir, const std::string& filepath, bool useDraco,
+    int dracoLevel, bool useJpg, int jpgLevel, bool zip, size_t memoryBudgetMb,
+    bool streamingJson, bool compactJson, bool inMemory, bool directIo, bool mapBuffer, bool bufferPerMesh, bool loadOrder, bool passthroughTextures, bool tangents,
+    float animationTolerance, bool quantizeAnimation, float morphTolerance, int pointBits, size_t pointChunk, bool cleanup,
+    size_t chunkTriangles, const std::string& chunkDir,
+    bool tiling, size_t tileTriangles, int tileDepth)
+{
+    ExportSettings settings;
+    settings.exportDir = exportDir;
+    settings.filepath = filepath;
+    settings.useDraco = useDraco;
+    settings.dracoLevel = dracoLevel;
+    settings.useJpg = useJpg;
+    settings.jpgLevel = jpgLevel;
+    settings.zip = zip;
+    settings.memoryBudget = memoryBudgetMb * 1024 * 1024;
+    settings.streamingJson = streamingJson;
+    settings.compactJson = compactJson;
+    settings.inMemory = inMemory;
+    settings.directIo = directIo;
+    settings.mapBuffer = mapBuffer;
+    settings.bufferPerMesh = bufferPerMesh;
+    settings.loadOrder = loadOrder;
+    settings.passthroughTextures = passthroughTextures;
+    settings.tangents = tangents;
+    settings.animationTolerance = animationTolerance;
+    settings.quantizeAnimation = quantizeAnimation;
+    settings.morphTolerance = morphTolerance;
+    settings.pointBits = pointBits;
+    settings.pointChunk = pointChunk;
+    settings.cleanup = cleanup;
+    settings.chunkTriangles = chunkTriangles;
+    settings.chunkDir = chunkDir;
+    settings.tiling = tiling;
+    settings.tileTriangles = tileTriangles;
+    settings.tileDepth = tileDepth;
+    return settings;
+}
+
+// Python names and defaults of SessionSettings' parameters, in the same order
+static auto SessionArgs()
+{
+    return std::make_tuple(
+        py::arg("exportDir"),
+        py::arg("filepath"),
+        py::arg("useDraco"),
+        py::arg("dracoLevel"),
+        py::arg("usePng"),
+        py::arg("jpgLevel"),
+        py::arg("zip"),
+        py::arg("memory_budget_mb") = 0,
+        py::arg("streaming_json") = true,
+        py::arg("compact_json") = true,
+        py::arg("in_memory") = false,
+        py::arg("direct_io") = false,
+        py::arg("map_buffer") = false,
+        py::arg("buffer_per_mesh") = false,
+        py::arg("load_order") = false,
+        py::arg("passthrough_textures") = true,
+        py::arg("tangents") = true,
+        py::arg("animation_tolerance") = 0.0001f,
+        py::arg("quantize_animation") = false,
+        py::arg("morph_tolerance") = 0.0001f,
+        py::arg("point_bits") = 16,
+        py::arg("point_chunk") = 1000000,
+        py::arg("cleanup") = true,
+        py::arg("chunk_triangles") = 0,
+        py::arg("chunk_dir") = "",
+        py::arg("tiles") = false,
+        py::arg("tile_triangles") = 200000,
+        py::arg("tile_depth") = 8);
+}
+
+// The constructor and begin take the same arguments, these turn SessionSettings into both
+template <typename... Args>
+static auto SessionFactory(ExportSettings (*build)(Args...))
+{
+    return [build](Args... args) { return std::make_shared<ExportSession>(build(args...)); };
+}
+
+template <typename... Args>
+static auto SessionBegin(ExportSettings (*build)(Args...))
+{
+    return [build](ExportSession& session, Args... args) { session.Begin(build(args...)); };
+}
+
+// Settings of a re-export, the output path fills in filepath and exportDir
+static ExportSettings OptimizeSettings(bool useDraco, int dracoLevel, bool useJpg, int jpgLevel, size_t memoryBudgetMb,
+    bool passthroughTextures, bool tangents, bool cleanup, int pointBits)
+{
+    ExportSettings settings;
+    settings.useDraco = useDraco;
+    settings.dracoLevel = dracoLevel;
+    settings.useJpg = useJpg;
+    settings.jpgLevel = jpgLevel;
+    settings.memoryBudget = memoryBudgetMb * 1024 * 1024;
+    settings.passthroughTextures = passthroughTextures;
+    settings.keepJpeg = true; // a jpeg of the source model stays one, as png it is only bigger
+    settings.tangents = tangents;
+    settings.cleanup = cleanup;
+    settings.pointBits = pointBits;
+    return settings;
+}
 
 PYBIND11_MODULE(glTFCompL, m) {
     m.doc() = "compression plugin";
+    InitImageEncoding();
     m.def("ReadBlenderData", &ReadBlenderData,
         "Export Blender data to glTF with optional Draco compression",
         py::arg("mesh_data"),
@@ -17,4 +128,217 @@ PYBIND11_MODULE(glTFCompL, m) {
         py::arg("usePng"), 
         py::arg("jpgLevel"), 
         py::arg("zip"));
+
+    py::class_<ExportSession, std::shared_ptr<ExportSession>> session(m, "ExportSession",
+        "Streams objects into one export, each object is compressed in the background as soon as it is added");
+    std::apply([&](auto&&... args) {
+            session.def(py::init(SessionFactory(&SessionSettings)), args...);
+            session.def("begin", SessionBegin(&SessionSettings),
+                "Start a new export with this session, keeps the caches and buffers of the previous one", args...);
+        }, SessionArgs());
+    session
+        .def("add_object", [](ExportSession& session, const py::dict& mesh_data, const py::list& textures) {
+                ObjectData object = IngestBlenderData(mesh_data, textures, session.Settings().chunkTriangles);
+                // may wait for memory from the budget, don't hold up other python threads meanwhile
+                py::gil_scoped_release releaseGil;
+                session.AddObject(std::move(object));
+            },
+            "Copy the object's arrays and start compressing them in the background. "
+            "An object that gets split into chunks is read from its arrays in place instead, "
+            "they must not be changed until finish returns. Blocks while the session's memory budget is used up",
+            py::arg("mesh_data"),
+            py::arg("textures"))
+        .def("add_point_cloud", [](ExportSession& session, const py::dict& point_data) {
+                ObjectData cloud = IngestPointCloud(point_data);
+                py::gil_scoped_release releaseGil;
+                session.AddObject(std::move(cloud));
+            },
+            "Copy a point cloud (name, vertices, optional normals and rgb/rgba colors per point) and start encoding it "
+            "as draco point cloud chunks in the background",
+            py::arg("point_data"))
+        .def("optimize", [](ExportSession& session, const std::string& input, const std::string& output, bool useDraco,
+            int dracoLevel, bool useJpg, int jpgLevel, size_t memoryBudgetMb, bool passthroughTextures, bool tangents, bool cleanup, int pointBits) {
+                ExportSettings settings = OptimizeSettings(useDraco, dracoLevel, useJpg, jpgLevel, memoryBudgetMb, passthroughTextures,
+                    tangents, cleanup, pointBits);
+                py::gil_scoped_release releaseGil;
+                return OptimizeGltf(input, output, std::move(settings), session);
+            },
+            "Re-export an existing .gltf/.glb as a new export of this session, so its caches carry over between files. "
+            "Returns False when the input can't be loaded or the export fails",
+            py::arg("input"),
+            py::arg("output"),
+            py::arg("use_draco") = true,
+            py::arg("draco_level") = 7,
+            py::arg("use_jpg") = false,
+            py::arg("jpg_level") = 100,
+            py::arg("memory_budget_mb") = 0,
+            py::arg("passthrough_textures") = true,
+            py::arg("tangents") = true,
+            py::arg("cleanup") = true,
+            py::arg("point_bits") = 16)
+        .def("finish", [](ExportSession& session) {
+                bool finished = false;
+                {
+                    py::gil_scoped_release releaseGil;
+                    finished = session.Finish();
+                }
+                ReleaseFinishedArrays();
+                return finished;
+            },
+            "Wait for all objects and write the file, returns False when it failed or got cancelled")
+        .def("finish_async", [](std::shared_ptr<ExportSession> session, py::object progressCallback, double callbackInterval) {
+                return std::make_shared<ExportJob>(std::move(session), std::move(progressCallback), callbackInterval);
+            },
+            "Like finish but in the background, returns an ExportJob",
+            py::arg("progress_callback") = py::none(),
+            py::arg("callback_interval") = 0.1)
+        .def("cancel", &ExportSession::Cancel)
+        .def("progress", [](const ExportSession& session) { return session.Progress().Fraction(); })
+        .def("set_cache_limits", [](ExportSession& session, size_t textureMb, size_t meshMb) {
+                session.SetCacheLimits(textureMb * 1024 * 1024, meshMb * 1024 * 1024);
+            },
+            "Memory the session may keep for encoded textures and compressed meshes between exports",
+            py::arg("texture_mb"),
+            py::arg("mesh_mb"))
+        .def("clear_caches", &ExportSession::ClearCaches)
+        .def("cache_stats", &ExportSession::CacheStats, "Hits, misses and bytes of the texture and mesh caches")
+        .def("memory_stats", &ExportSession::MemoryStats, "Memory budget, bytes in flight and the peak of this export")
+        .def("cleanup_stats", &ExportSession::CleanupStats,
+            "Degenerate and duplicate faces, unused vertices and NaN/infinite values the cleanup took out of this export's meshes")
+        .def("memory_files", [](ExportSession& session) {
+                // every view keeps its ExportBuffer alive, which keeps the native bytes alive
+                py::dict files;
+                for (auto& file : session.TakeMemoryFiles())
+                {
+                    std::string name = file.name;
+                    files[py::str(name)] = py::memoryview(py::cast(std::move(file)));
+                }
+                return files;
+            },
+            "Files of the last in_memory export as {name: memoryview}, without copying them. "
+            "Can be taken once, a .glb is a single file");
+
+    py::class_<MemoryFile>(m, "ExportBuffer", py::buffer_protocol(),
+        "Read only bytes of one file of an in-memory export")
+        .def_buffer([](MemoryFile& file) {
+                return py::buffer_info(const_cast<unsigned char*>(file.data), 1, py::format_descriptor<unsigned char>::format(),
+                    1, { static_cast<py::ssize_t>(file.size) }, { 1 }, true);
+            })
+        .def_readonly("name", &MemoryFile::name)
+        .def("__len__", [](const MemoryFile& file) { return file.size; });
+
+    py::class_<ExportJob, std::shared_ptr<ExportJob>>(m, "ExportJob",
+        "An export running on background threads, created by start_export")
+        .def("progress", &ExportJob::Progress, "Progress from 0 to 1")
+        .def("wait", [](ExportJob& job, double timeout) {
+                bool done = false;
+                {
+                    py::gil_scoped_release releaseGil;
+                    done = job.Wait(timeout);
+                }
+                ReleaseFinishedArrays();
+                return done;
+            },
+            "Wait for the export to finish, returns False when the timeout ran out (negative = no timeout)",
+            py::arg("timeout") = -1.0)
+        .def("cancel", &ExportJob::Cancel, "Stop the export, files it already wrote get removed")
+        .def("done", &ExportJob::IsDone)
+        .def("succeeded", &ExportJob::Succeeded)
+        .def("cancelled", &ExportJob::IsCancelled)
+        .def("error", &ExportJob::Error, "Error message if the export failed with one");
+
+    m.def("start_export", &StartExport,
+        "Start exporting Blender data to glTF in the background. "
+        "progress_callback(fraction) is called from a background thread at most every callback_interval seconds",
+        py::arg("mesh_data"),
+        py::arg("exportDir"),
+        py::arg("filepath"),
+        py::arg("textures"),
+        py::arg("useDraco"),
+        py::arg("dracoLevel"),
+        py::arg("usePng"),
+        py::arg("jpgLevel"),
+        py::arg("zip"),
+        py::arg("progress_callback") = py::none(),
+        py::arg("callback_interval") = 0.1);
+
+    m.def("OptimizeGltf", [](const std::string& input, const std::string& output, bool useDraco, int dracoLevel, bool useJpg,
+        int jpgLevel, size_t memoryBudgetMb, bool passthroughTextures, bool tangents, bool cleanup, int pointBits) {
+            ExportSettings settings = OptimizeSettings(useDraco, dracoLevel, useJpg, jpgLevel, memoryBudgetMb, passthroughTextures,
+                tangents, cleanup, pointBits);
+            py::gil_scoped_release releaseGil;
+            return OptimizeGltf(input, output, std::move(settings));
+        },
+        "Re-export an existing .gltf/.glb: every mesh once with a node per instance, meshes cleaned and draco compressed, textures re-encoded "
+        "(as png unless use_jpg, textures already in that format and jpegs are copied with passthrough_textures). "
+        "The extension of output picks .gltf or .glb. Skins, animations and morph targets are left out",
+        py::arg("input"),
+        py::arg("output"),
+        py::arg("use_draco") = true,
+        py::arg("draco_level") = 7,
+        py::arg("use_jpg") = false,
+        py::arg("jpg_level") = 100,
+        py::arg("memory_budget_mb") = 0,
+        py::arg("passthrough_textures") = true,
+        py::arg("tangents") = true,
+        py::arg("cleanup") = true,
+        py::arg("point_bits") = 16);
+
+    m.def("BatchConvert", [](const std::string& inputDir, const std::string& outputDir, bool useDraco, int dracoLevel, bool useJpg,
+        int jpgLevel, size_t memoryBudgetMb, bool passthroughTextures, bool tangents, bool cleanup, int pointBits, int workers,
+        const std::string& journal, const std::string& reportPath, bool force) {
+            BatchSettings batch;
+            batch.inputDir = inputDir;
+            batch.outputDir = outputDir;
+            batch.journal = journal;
+            batch.report = reportPath;
+            batch.workers = workers;
+            batch.memoryBudget = memoryBudgetMb * 1024 * 1024;
+            batch.force = force;
+            // the memory budget is for the whole batch, the workers get their share of it
+            ExportSettings settings = OptimizeSettings(useDraco, dracoLevel, useJpg, jpgLevel, 0, passthroughTextures, tangents, cleanup, pointBits);
+            BatchReport report;
+            {
+                py::gil_scoped_release releaseGil;
+                report = BatchConvert(batch, settings);
+            }
+            py::dict out;
+            out["files"] = report.files;
+            out["converted"] = report.converted;
+            out["skipped"] = report.skipped;
+            out["failed"] = report.failed;
+            out["workers"] = report.workers;
+            out["input_bytes"] = report.inputBytes;
+            out["output_bytes"] = report.outputBytes;
+            out["seconds"] = report.seconds;
+            out["convert_seconds"] = report.convertSeconds;
+            out["failures"] = report.failures;
+            return out;
+        },
+        "Re-export every .gltf/.glb under input_dir into the same tree under output_dir as .glb, on a pool of workers. "
+        "A journal in output_dir makes a stopped batch resume and skips files that are up to date, "
+        "the report (also written as batch_report.json) has the files, bytes and time",
+        py::arg("input_dir"),
+        py::arg("output_dir"),
+        py::arg("use_draco") = true,
+        py::arg("draco_level") = 7,
+        py::arg("use_jpg") = false,
+        py::arg("jpg_level") = 100,
+        py::arg("memory_budget_mb") = 0,
+        py::arg("passthrough_textures") = true,
+        py::arg("tangents") = true,
+        py::arg("cleanup") = true,
+        py::arg("point_bits") = 16,
+        py::arg("workers") = 0,
+        py::arg("journal") = "",
+        py::arg("report") = "",
+        py::arg("force") = false);
+
+    m.def("SetThreadCount", &SetThreadCount,
+        "Set the amount of worker threads used for exporting (0 = one per core). "
+        "Returns False and keeps the current threads while an export is still running",
+        py::arg("threadCount"),
+        py::call_guard<py::gil_scoped_release>());
+    m.def("GetThreadCount", &GetThreadCount,
+        "Get the amount of worker threads used for exporting");
 }
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "tangents.h"
+#include "task_scheduler.h"
+
+//stl
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+    struct VertexHash
+    {
+        size_t operator()(const Vertex& v) const
+        {
+            // FNV-1a over the bytes, Vertex is only floats so there is no padding in there
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < sizeof(Vertex); i++)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    struct VertexEqual
+    {
+        bool operator()(const Vertex& a, const Vertex& b) const
+        {
+            return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+        }
+    };
+
+    // What one corner adds to the tangent of its vertex
+    struct CornerTangent
+    {
+        float tangent[3]; // weighted by the angle of the face at the corner
+        bool positive; // uv winding of the face, the sign of the bitangent
+        bool valid; // faces without uv area add nothing
+    };
+
+    float Dot(const float a[3], const float b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // returns the length it had
+    float Normalize(float v[3])
+    {
+        float length = std::sqrt(Dot(v, v));
+        if (length > FLT_MIN)
+        {
+            v[0] /= length;
+            v[1] /= length;
+            v[2] /= length;
+        }
+        return length;
+    }
+
+    // v without its part along the normal, normalized
+    float ProjectOnPlane(float v[3], const float normal[3])
+    {
+        float along = Dot(v, normal);
+        for (int i = 0; i < 3; i++)
+        {
+            v[i] -= normal[i] * along;
+        }
+        return Normalize(v);
+    }
+
+    // any direction on the normal's plane, for vertices whose faces have no uvs to go by
+    void Perpendicular(const float normal[3], float out[3])
+    {
+        float axis[3] = { 0.0f, 0.0f, 0.0f };
+        float ax = std::fabs(normal[0]);
+        float ay = std::fabs(normal[1]);
+        float az = std::fabs(normal[2]);
+        axis[ax <= ay && ax <= az ? 0 : ay <= az ? 1 : 2] = 1.0f;
+        std::copy(axis, axis + 3, out);
+        if (ProjectOnPlane(out, normal) <= FLT_MIN)
+        {
+            out[0] = 1.0f;
+            out[1] = 0.0f;
+            out[2] = 0.0f;
+        }
+    }
+}
+
+void GenerateTangents(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<float>& extras, size_t extraStride,
+    std::vector<float>& tangents)
+{
+    size_t cornerCount = indices.size() / 3 * 3;
+    std::vector<CornerTangent> corners(cornerCount);
+
+    // the face part is where the work is, every face on its own
+    GetScheduler().ParallelFor(cornerCount / 3, 4096, [&](size_t begin, size_t end)
+    {
+        for (size_t f = begin; f < end; f++)
+        {
+            const Vertex* v[3] = { &vertices[indices[f * 3]], &vertices[indices[f * 3 + 1]], &vertices[indices[f * 3 + 2]] };
+            float s1 = v[1]->texcoord[0] - v[0]->texcoord[0];
+            float t1 = v[1]->texcoord[1] - v[0]->texcoord[1];
+            float s2 = v[2]->texcoord[0] - v[0]->texcoord[0];
+            float t2 = v[2]->texcoord[1] - v[0]->texcoord[1];
+            float area = s1 * t2 - t1 * s2;
+            bool positive = area > 0.0f;
+
+            // direction of increasing u on the face
+            float faceTangent[3];
+            for (int i = 0; i < 3; i++)
+            {
+                faceTangent[i] = t2 * (v[1]->position[i] - v[0]->position[i]) - t1 * (v[2]->position[i] - v[0]->position[i]);
+            }
+            bool valid = std::fabs(area) > FLT_MIN && Normalize(faceTangent) > FLT_MIN;
+            if (!positive)
+            {
+                faceTangent[0] = -faceTangent[0];
+                faceTangent[1] = -faceTangent[1];
+                faceTangent[2] = -faceTangent[2];
+            }
+
+            for (int c = 0; c < 3; c++)
+            {
+                CornerTangent& corner = corners[f * 3 + c];
+                corner.positive = positive;
+                corner.valid = false;
+                if (!valid)
+                {
+                    continue;
+                }
+
+                const float* normal = v[c]->normal;
+                float tangent[3] = { faceTangent[0], faceTangent[1], faceTangent[2] };
+                float edge1[3];
+                float edge2[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    edge1[i] = v[(c + 1) % 3]->position[i] - v[c]->position[i];
+                    edge2[i] = v[(c + 2) % 3]->position[i] - v[c]->position[i];
+                }
+                if (ProjectOnPlane(tangent, normal) <= FLT_MIN)
+                {
+                    continue;
+                }
+                ProjectOnPlane(edge1, normal);
+                ProjectOnPlane(edge2, normal);
+                float angle = std::acos(std::clamp(Dot(edge1, edge2), -1.0f, 1.0f));
+                for (int i = 0; i < 3; i++)
+                {
+                    corner.tangent[i] = tangent[i] * angle;
+                }
+                corner.valid = true;
+            }
+        }
+    });
+
+    // MikkTSpace welds corners with the same data itself, so do the same for vertices that are still separate copies
+    std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> welded;
+    welded.reserve(vertices.size());
+    std::vector<uint32_t> group(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        group[v] = welded.emplace(vertices[v], static_cast<uint32_t>(welded.size())).first->second;
+    }
+
+    // one sum per welded vertex and winding
+    std::vector<float> sums(welded.size() * 2 * 3, 0.0f);
+    for (size_t c = 0; c < cornerCount; c++)
+    {
+        if (corners[c].valid)
+        {
+            float* sum = &sums[(group[indices[c]] * 2 + (corners[c].positive ? 0 : 1)) * 3];
+            for (int i = 0; i < 3; i++)
+            {
+                sum[i] += corners[c].tangent[i];
+            }
+        }
+    }
+
+    auto writeTangent = [&](uint32_t vertex, bool positive) {
+        float* tangent = &tangents[static_cast<size_t>(vertex) * 4];
+        const float* sum = &sums[(group[vertex] * 2 + (positive ? 0 : 1)) * 3];
+        std::copy(sum, sum + 3, tangent);
+        if (Normalize(tangent) <= FLT_MIN)
+        {
+            Perpendicular(vertices[vertex].normal, tangent);
+        }
+        tangent[3] = positive ? 1.0f : -1.0f;
+    };
+
+    // Corners of faces with valid uvs first, a vertex they use with both windings is split.
+    // The degenerate faces take whatever their vertices ended up with
+    const uint8_t unassigned = 0;
+    const uint8_t assignedPositive = 1;
+    const uint8_t assignedNegative = 2;
+    std::vector<uint8_t> assigned(vertices.size(), unassigned);
+    std::vector<uint32_t> mirrored(vertices.size(), UINT32_MAX);
+    tangents.assign(vertices.size() * 4, 0.0f);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t c = 0; c < cornerCount; c++)
+        {
+            const CornerTangent& corner = corners[c];
+            if (corner.valid != (pass == 0))
+            {
+                continue;
+            }
+
+            uint32_t vertex = indices[c];
+            uint8_t winding = corner.positive ? assignedPositive : assignedNegative;
+            if (assigned[vertex] == unassigned)
+            {
+                assigned[vertex] = winding;
+                writeTangent(vertex, corner.positive);
+                continue;
+            }
+            if (assigned[vertex] == winding || pass == 1)
+            {
+                continue;
+            }
+
+            if (mirrored[vertex] == UINT32_MAX)
+            {
+                mirrored[vertex] = static_cast<uint32_t>(vertices.size());
+                Vertex copy = vertices[vertex];
+                vertices.push_back(copy);
+                for (size_t i = 0; i < extraStride; i++)
+                {
+                    extras.push_back(extras[vertex * extraStride + i]);
+                }
+                group.push_back(group[vertex]);
+                assigned.push_back(winding);
+                mirrored.push_back(UINT32_MAX);
+                tangents.resize(tangents.size() + 4);
+                writeTangent(mirrored[vertex], corner.positive);
+            }
+            indices[c] = mirrored[vertex];
+        }
+    }
+
+    // vertices no face uses still get something valid
+    for (size_t v = 0; v < assigned.size(); v++)
+    {
+        if (assigned[v] == unassigned)
+        {
+            writeTangent(static_cast<uint32_t>(v), true);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <cstdint>
+#include <vector>
+
+// Tangents the way MikkTSpace makes them, so a normal map baked against MikkTSpace looks the same as when the viewer
+// generates them itself: per face the uv directions, projected onto the corner's normal and weighted by the corner's angle,
+// summed over every corner with the same position, normal and uv and the same uv winding.
+// tangents gets 4 floats per vertex, xyz and the bitangent sign in w like glTF's TANGENT.
+// A vertex shared by faces with mirrored uvs needs two tangents, it gets split: vertices, indices and the extras
+// (extraStride floats per vertex, see VertexExtras) may grow.
+void GenerateTangents(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<float>& extras, size_t extraStride,
+    std::vector<float>& tangents);
@@ -0,0 +1,384 @@
+#include "task_scheduler.h"
+
+//stl
+#include <algorithm>
+
+namespace
+{
+    // Which scheduler/worker the current thread belongs to, used to push to the local queue
+    thread_local const TaskScheduler* tlsScheduler = nullptr;
+    thread_local int tlsWorkerIndex = -1;
+}
+
+TaskScheduler::TaskScheduler(int threadCount)
+{
+    StartWorkers(threadCount);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    StopWorkers();
+}
+
+bool TaskScheduler::SetThreadCount(int count)
+{
+    int resolved = count > 0 ? count : static_cast<int>(std::thread::hardware_concurrency());
+    if (std::max(resolved, 1) == GetThreadCount())
+    {
+        return true;
+    }
+    // a worker would join itself
+    if (CurrentWorkerIndex() >= 0)
+    {
+        return false;
+    }
+
+    // nothing can be submitted while we hold this, so no tasks now means none until the new workers run
+    std::unique_lock<std::shared_mutex> lock(resizeMutex);
+    if (liveTasks > 0)
+    {
+        return false;
+    }
+    StopWorkers();
+    StartWorkers(count);
+    return true;
+}
+
+int TaskScheduler::GetThreadCount() const
+{
+    return threadCount;
+}
+
+int TaskScheduler::CurrentWorkerIndex() const
+{
+    return tlsScheduler == this ? tlsWorkerIndex : -1;
+}
+
+void TaskScheduler::StartWorkers(int count)
+{
+    if (count <= 0)
+    {
+        count = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    count = std::max(count, 1);
+
+    stopping = false;
+    queues.clear();
+    for (int i = 0; i < count; i++)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    threadCount = count;
+    for (int i = 0; i < count; i++)
+    {
+        workers.emplace_back(&TaskScheduler::WorkerLoop, this, i);
+    }
+}
+
+void TaskScheduler::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleepCondition.notify_all();
+
+    // workers drain all queued work before they exit
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+TaskHandle TaskScheduler::Submit(std::function<void()> func, const std::vector<TaskHandle>& dependencies)
+{
+    std::shared_lock<std::shared_mutex> lock(resizeMutex, std::defer_lock);
+    if (CurrentWorkerIndex() < 0)
+    {
+        lock.lock();
+    }
+    liveTasks++;
+
+    auto task = std::make_shared<Task>();
+    task->func = std::move(func);
+    task->dependencies = dependencies;
+
+    // the extra count keeps the task from being queued while we are still registering it
+    task->pendingDependencies = static_cast<int>(dependencies.size()) + 1;
+    for (const auto& dependency : dependencies)
+    {
+        if (!dependency)
+        {
+            task->pendingDependencies--;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->done)
+        {
+            task->pendingDependencies--;
+        }
+        else
+        {
+            dependency->dependents.push_back(task);
+        }
+    }
+
+    if (--task->pendingDependencies == 0)
+    {
+        Enqueue(task);
+    }
+    return task;
+}
+
+void TaskScheduler::Enqueue(const TaskHandle& task)
+{
+    int workerIndex = CurrentWorkerIndex();
+    size_t queueIndex = workerIndex >= 0 ? static_cast<size_t>(workerIndex) : nextQueue++ % queues.size();
+
+    {
+        std::lock_guard<std::mutex> lock(queues[queueIndex]->mutex);
+        queues[queueIndex]->tasks.push_back(task);
+    }
+    queuedCount++;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_all();
+}
+
+TaskHandle TaskScheduler::PopTask(int workerIndex)
+{
+    // own work first, newest task is the one most likely still in cache
+    if (workerIndex >= 0)
+    {
+        WorkerQueue& own = *queues[workerIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            TaskHandle task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queuedCount--;
+            return task;
+        }
+    }
+
+    // steal the oldest task from somebody else
+    size_t count = queues.size();
+    size_t start = workerIndex >= 0 ? static_cast<size_t>(workerIndex) + 1 : 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        WorkerQueue& victim = *queues[(start + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            TaskHandle task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queuedCount--;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void TaskScheduler::RunTask(const TaskHandle& task)
+{
+    for (const auto& dependency : task->dependencies)
+    {
+        if (dependency && dependency->error)
+        {
+            task->error = dependency->error;
+            break;
+        }
+    }
+
+    if (!task->error)
+    {
+        try
+        {
+            task->func();
+        }
+        catch (...)
+        {
+            task->error = std::current_exception();
+        }
+    }
+    // release captured buffers as soon as possible
+    task->func = nullptr;
+    task->dependencies.clear();
+
+    std::vector<TaskHandle> dependents;
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->done = true;
+        dependents.swap(task->dependents);
+    }
+
+    for (const auto& dependent : dependents)
+    {
+        if (--dependent->pendingDependencies == 0)
+        {
+            Enqueue(dependent);
+        }
+    }
+
+    // wake up anyone waiting on this task
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_all();
+    liveTasks--;
+}
+
+void TaskScheduler::WorkerLoop(int workerIndex)
+{
+    tlsScheduler = this;
+    tlsWorkerIndex = workerIndex;
+
+    while (true)
+    {
+        TaskHandle task = PopTask(workerIndex);
+        if (task)
+        {
+            RunTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this] { return stopping || queuedCount > 0; });
+        if (stopping && queuedCount == 0)
+        {
+            break;
+        }
+    }
+
+    tlsScheduler = nullptr;
+    tlsWorkerIndex = -1;
+}
+
+void TaskScheduler::Wait(const TaskHandle& task)
+{
+    if (!task)
+    {
+        return;
+    }
+
+    int workerIndex = CurrentWorkerIndex();
+    while (!task->done)
+    {
+        TaskHandle other;
+        if (workerIndex >= 0)
+        {
+            other = PopTask(workerIndex);
+        }
+        else
+        {
+            // the task may finish right before this and let a resize through
+            std::shared_lock<std::shared_mutex> lock(resizeMutex);
+            other = PopTask(workerIndex);
+        }
+        if (other)
+        {
+            RunTask(other);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [&] { return task->done || queuedCount > 0; });
+    }
+
+    if (task->error)
+    {
+        std::rethrow_exception(task->error);
+    }
+}
+
+void TaskScheduler::WaitAll(const std::vector<TaskHandle>& tasks)
+{
+    // wait for everything first so no task is still running when we rethrow
+    std::exception_ptr firstError;
+    for (const auto& task : tasks)
+    {
+        try
+        {
+            Wait(task);
+        }
+        catch (...)
+        {
+            if (!firstError)
+            {
+                firstError = std::current_exception();
+            }
+        }
+    }
+
+    if (firstError)
+    {
+        std::rethrow_exception(firstError);
+    }
+}
+
+void TaskScheduler::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    grainSize = std::max<size_t>(grainSize, 1);
+
+    // a few chunks per worker so stealing can even out uneven chunks
+    size_t maxChunks = static_cast<size_t>(GetThreadCount()) * 4;
+    size_t chunkCount = std::max<size_t>(1, std::min(count / grainSize, maxChunks));
+    size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    if (chunkCount == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    std::vector<TaskHandle> chunks;
+    chunks.reserve(chunkCount);
+    for (size_t begin = chunkSize; begin < count; begin += chunkSize)
+    {
+        size_t end = std::min(begin + chunkSize, count);
+        chunks.push_back(Submit([&func, begin, end] { func(begin, end); }));
+    }
+
+    // the calling thread takes the first chunk itself
+    std::exception_ptr error;
+    try
+    {
+        func(0, std::min(chunkSize, count));
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    WaitAll(chunks);
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+TaskScheduler& GetScheduler()
+{
+    // Deliberately leaked: joining threads from a static destructor while the module
+    // is being unloaded can hang the host application (loader lock on Windows).
+    static TaskScheduler* scheduler = new TaskScheduler();
+    return *scheduler;
+}
+
+bool SetThreadCount(int threadCount)
+{
+    return GetScheduler().SetThreadCount(threadCount);
+}
+
+int GetThreadCount()
+{
+    return GetScheduler().GetThreadCount();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+//stl
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing scheduler shared by every export stage.
+// Each worker owns a deque: it pushes and pops its own work at the back (LIFO, cache friendly)
+// and steals from the front of the other workers when it runs dry.
+// Tasks can depend on other tasks, a task only gets queued once all of its dependencies finished.
+// If a dependency threw, the task is skipped and carries that exception on to its own dependents.
+
+struct Task
+{
+    std::function<void()> func;
+    std::atomic<int> pendingDependencies{ 0 };
+    std::atomic<bool> done{ false };
+    std::mutex mutex; // guards dependents
+    std::vector<std::shared_ptr<Task>> dependencies; // dropped once the task ran
+    std::vector<std::shared_ptr<Task>> dependents;
+    std::exception_ptr error;
+};
+using TaskHandle = std::shared_ptr<Task>;
+
+class TaskScheduler
+{
+public:
+    // 0 threads means one worker per hardware thread
+    explicit TaskScheduler(int threadCount = 0);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // Restarts the workers with the new count. Only done while the pool is idle: returns false, and changes nothing,
+    // when a task is queued, waiting on dependencies or running, or when called from a worker
+    bool SetThreadCount(int threadCount);
+    int GetThreadCount() const;
+
+    TaskHandle Submit(std::function<void()> func, const std::vector<TaskHandle>& dependencies = {});
+
+    // Waiting threads help out with queued work so nested waits inside tasks can't deadlock the pool.
+    // Rethrows the exception of the task if it threw one.
+    void Wait(const TaskHandle& task);
+    void WaitAll(const std::vector<TaskHandle>& tasks);
+
+    // Splits [0, count) in chunks of at least grainSize and runs them on the pool.
+    void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& func);
+
+    // Index of the calling worker, -1 when called from a thread that isn't part of this pool
+    int CurrentWorkerIndex() const;
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<TaskHandle> tasks;
+    };
+
+    void StartWorkers(int threadCount);
+    void StopWorkers();
+    void WorkerLoop(int workerIndex);
+    void Enqueue(const TaskHandle& task);
+    TaskHandle PopTask(int workerIndex);
+    void RunTask(const TaskHandle& task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::atomic<size_t> queuedCount{ 0 };
+    std::atomic<size_t> liveTasks{ 0 }; // submitted and not finished yet
+    std::atomic<int> threadCount{ 0 };
+    // Threads outside the pool hold it shared while they touch the queues, a resize holds it exclusively.
+    // Workers don't need it: a resize only happens when there are no tasks, and it joins them before the queues change
+    std::shared_mutex resizeMutex;
+    std::atomic<size_t> nextQueue{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+};
+
+// The scheduler owned by the module, created on first use
+TaskScheduler& GetScheduler();
+bool SetThreadCount(int threadCount);
+int GetThreadCount();
@@ -0,0 +1,219 @@
+#include "tiling.h"
+
+//stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace
+{
+    float Centre(const TileItem& item, int axis)
+    {
+        return (item.boundsMin[axis] + item.boundsMax[axis]) * 0.5f;
+    }
+
+    int BuildNode(std::vector<TileNode>& nodes, const std::vector<TileItem>& items, std::vector<size_t> nodeItems,
+        const float cellMin[3], float cellSize, int depth, size_t maxTriangles, int maxDepth)
+    {
+        int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        {
+            TileNode& node = nodes.back();
+            std::copy(cellMin, cellMin + 3, node.cellMin);
+            node.cellSize = cellSize;
+            for (size_t n = 0; n < nodeItems.size(); n++)
+            {
+                const TileItem& item = items[nodeItems[n]];
+                for (int i = 0; i < 3; i++)
+                {
+                    node.boundsMin[i] = n == 0 ? item.boundsMin[i] : std::min(node.boundsMin[i], item.boundsMin[i]);
+                    node.boundsMax[i] = n == 0 ? item.boundsMax[i] : std::max(node.boundsMax[i], item.boundsMax[i]);
+                }
+                node.triangles += item.triangles;
+            }
+            node.items = nodeItems;
+        }
+
+        float childMin[3];
+        std::copy(cellMin, cellMin + 3, childMin);
+        while (nodes[index].triangles > maxTriangles && nodeItems.size() > 1 && depth < maxDepth)
+        {
+            float half = cellSize * 0.5f;
+            std::vector<size_t> octants[8];
+            for (size_t item : nodeItems)
+            {
+                int octant = 0;
+                for (int i = 0; i < 3; i++)
+                {
+                    if (Centre(items[item], i) >= childMin[i] + half)
+                    {
+                        octant |= 1 << i;
+                    }
+                }
+                octants[octant].push_back(item);
+            }
+
+            int used = 0;
+            int last = 0;
+            for (int o = 0; o < 8; o++)
+            {
+                if (!octants[o].empty())
+                {
+                    used++;
+                    last = o;
+                }
+            }
+
+            if (used == 1)
+            {
+                // everything is in one octant, a node for that would only repeat this one
+                for (int i = 0; i < 3; i++)
+                {
+                    childMin[i] += (last >> i & 1) ? half : 0.0f;
+                }
+                cellSize = half;
+                depth++;
+                continue;
+            }
+
+            for (int o = 0; o < 8; o++)
+            {
+                if (octants[o].empty())
+                {
+                    continue;
+                }
+                float octantMin[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    octantMin[i] = childMin[i] + ((o >> i & 1) ? half : 0.0f);
+                }
+                int child = BuildNode(nodes, items, std::move(octants[o]), octantMin, half, depth + 1, maxTriangles, maxDepth);
+                nodes[index].children.push_back(child);
+            }
+            break;
+        }
+        return index;
+    }
+
+    struct Cluster
+    {
+        double position[3] = {};
+        double normal[3] = {};
+        double texcoord[2] = {};
+        uint32_t count = 0;
+    };
+}
+
+std::vector<TileNode> BuildTileOctree(const std::vector<TileItem>& items, size_t maxTriangles, int maxDepth)
+{
+    std::vector<TileNode> nodes;
+    if (items.empty())
+    {
+        return nodes;
+    }
+
+    // a cube around the item centres
+    float centreMin[3];
+    float centreMax[3];
+    for (size_t n = 0; n < items.size(); n++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            centreMin[i] = n == 0 ? Centre(items[n], i) : std::min(centreMin[i], Centre(items[n], i));
+            centreMax[i] = n == 0 ? Centre(items[n], i) : std::max(centreMax[i], Centre(items[n], i));
+        }
+    }
+    float size = std::max({ centreMax[0] - centreMin[0], centreMax[1] - centreMin[1], centreMax[2] - centreMin[2], 1e-6f });
+
+    std::vector<size_t> all(items.size());
+    for (size_t n = 0; n < all.size(); n++)
+    {
+        all[n] = n;
+    }
+    // a little bigger, so the centres on the far side don't fall out of it
+    BuildNode(nodes, items, std::move(all), centreMin, size * 1.0001f, 0, maxTriangles, maxDepth);
+    return nodes;
+}
+
+void ClusterVertices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+    const std::vector<float>& extras, size_t extraStride, const float origin[3], float cellSize,
+    std::vector<Vertex>& outVertices, std::vector<uint32_t>& outIndices, std::vector<float>& outExtras)
+{
+    outVertices.clear();
+    outIndices.clear();
+    outExtras.clear();
+
+    // 21 bits per axis, with the middle at the origin so vertices a bit outside the grid still get a cell
+    auto cellKey = [&](const Vertex& v) {
+        uint64_t key = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            double cell = std::floor((v.position[i] - origin[i]) / cellSize);
+            int64_t clamped = static_cast<int64_t>(std::clamp(cell, -1048576.0, 1048575.0)) + 1048576;
+            key |= static_cast<uint64_t>(clamped) << (21 * i);
+        }
+        return key;
+    };
+
+    std::unordered_map<uint64_t, uint32_t> cellClusters;
+    std::vector<Cluster> clusters;
+    std::vector<double> clusterExtras; // extraStride per cluster
+    std::vector<uint32_t> remap(vertices.size());
+    for (size_t n = 0; n < vertices.size(); n++)
+    {
+        const Vertex& v = vertices[n];
+        auto inserted = cellClusters.emplace(cellKey(v), static_cast<uint32_t>(clusters.size()));
+        if (inserted.second)
+        {
+            clusters.emplace_back();
+            clusterExtras.resize(clusterExtras.size() + extraStride, 0.0);
+        }
+        Cluster& cluster = clusters[inserted.first->second];
+        for (int i = 0; i < 3; i++)
+        {
+            cluster.position[i] += v.position[i];
+            cluster.normal[i] += v.normal[i];
+        }
+        cluster.texcoord[0] += v.texcoord[0];
+        cluster.texcoord[1] += v.texcoord[1];
+        cluster.count++;
+        for (size_t i = 0; i < extraStride; i++)
+        {
+            clusterExtras[inserted.first->second * extraStride + i] += extras[n * extraStride + i];
+        }
+        remap[n] = inserted.first->second;
+    }
+
+    outVertices.resize(clusters.size());
+    outExtras.resize(clusters.size() * extraStride);
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        const Cluster& cluster = clusters[c];
+        Vertex& v = outVertices[c];
+        double length = std::sqrt(cluster.normal[0] * cluster.normal[0] + cluster.normal[1] * cluster.normal[1] + cluster.normal[2] * cluster.normal[2]);
+        for (int i = 0; i < 3; i++)
+        {
+            v.position[i] = static_cast<float>(cluster.position[i] / cluster.count);
+            // opposite normals cancel out, any direction is as good as another then
+            v.normal[i] = length > 0.0 ? static_cast<float>(cluster.normal[i] / length) : (i == 1 ? 1.0f : 0.0f);
+        }
+        v.texcoord[0] = static_cast<float>(cluster.texcoord[0] / cluster.count);
+        v.texcoord[1] = static_cast<float>(cluster.texcoord[1] / cluster.count);
+        for (size_t i = 0; i < extraStride; i++)
+        {
+            outExtras[c * extraStride + i] = static_cast<float>(clusterExtras[c * extraStride + i] / cluster.count);
+        }
+    }
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        uint32_t a = remap[indices[t]];
+        uint32_t b = remap[indices[t + 1]];
+        uint32_t c = remap[indices[t + 2]];
+        if (a != b && b != c && a != c)
+        {
+            outIndices.insert(outIndices.end(), { a, b, c });
+        }
+    }
+}
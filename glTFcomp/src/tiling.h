@@ -0,0 +1,41 @@
+#pragma once
+
+#include "gltf_loader.h"
+
+//stl
+#include <cstddef>
+#include <vector>
+
+// Something that goes into the tiles: an object, or one chunk of a big one. Bounds in gltf space
+struct TileItem
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    size_t triangles = 0;
+};
+
+// Node of the tile octree. Every node has the items of its whole subtree: a leaf shows them as they are,
+// a node above it shows a simplified version of them until the viewer gets close enough for the children.
+struct TileNode
+{
+    float cellMin[3]; // the octree cell, a cube the item centres are in
+    float cellSize = 0.0f;
+    float boundsMin[3]; // tight around the items, may stick out of the cell
+    float boundsMax[3];
+    std::vector<size_t> items;
+    std::vector<int> children;
+    size_t triangles = 0;
+    bool IsLeaf() const { return children.empty(); }
+};
+
+// Octree over the item centres, node 0 is the root and parents come before their children.
+// A node is split while it has more than maxTriangles triangles, more than one item and is less than maxDepth deep.
+// A cell whose items all end up in the same octant doesn't get a node for that, the octant is split right away.
+std::vector<TileNode> BuildTileOctree(const std::vector<TileItem>& items, size_t maxTriangles, int maxDepth);
+
+// Vertex clustering: every vertex snaps to the average of the vertices in its cell of a grid from origin,
+// triangles that collapse are dropped. Vertices at most a cell diagonal away is the error that gives.
+// The extras (extraStride floats per vertex, see VertexExtras) are averaged the same way.
+void ClusterVertices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+    const std::vector<float>& extras, size_t extraStride, const float origin[3], float cellSize,
+    std::vector<Vertex>& outVertices, std::vector<uint32_t>& outIndices, std::vector<float>& outExtras);